@@ -0,0 +1,1333 @@
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <csv.hpp>
+#include <edit.hpp>
+#include <gather.hpp>
+#include <json.hpp>
+#include <ndjson.hpp>
+#include <query.hpp>
+#include <rpc.hpp>
+#include <serialize.hpp>
+#include <shared.hpp>
+#include <thread.hpp>
+#include <writer.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <netinet/in.h>
+#   include <netinet/tcp.h>
+#   include <sys/socket.h>
+#   include <sys/wait.h>
+#   include <time.h>
+#   include <unistd.h>
+#endif
+
+namespace {
+
+    // Heap allocations so far, to check that steady states make none.
+    unsigned long long heap_allocations = 0;
+
+}
+
+void * operator new (std::size_t size)
+{
+    ++heap_allocations;
+    void *const data = std::malloc((size == 0)? 1 : size);
+    if (data == 0) {
+        throw (std::bad_alloc());
+    }
+    return (data);
+}
+
+void operator delete (void * data) throw ()
+{
+    std::free(data);
+}
+
+#if __cplusplus >= 201402L
+void operator delete (void * data, std::size_t) throw ()
+{
+    std::free(data);
+}
+#endif
+
+namespace {
+
+    typedef int(*benchmark)(int);
+
+    // Wall clock, in seconds.
+    double now ()
+    {
+#ifdef _WIN32
+        LARGE_INTEGER frequency, counter;
+        ::QueryPerformanceFrequency(&frequency);
+        ::QueryPerformanceCounter(&counter);
+        return (double(counter.QuadPart) / double(frequency.QuadPart));
+#else
+        ::timespec now;
+        ::clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec + (now.tv_nsec * 1e-9));
+#endif
+    }
+
+    // Array of `records` small, heterogeneous records.
+    std::string make_document (int records)
+    {
+        std::ostringstream text;
+        text << '[';
+        for (int i=0; (i < records); ++i)
+        {
+            text
+                << ((i == 0)? "" : ",")
+                << "{\"id\":" << i
+                << ",\"name\":\"record-" << i << "\""
+                << ",\"tags\":[\"alpha\",\"beta\",\"gamma\"]"
+                << ",\"score\":" << (i % 100) << ".25"
+                << ",\"active\":" << (((i % 2) == 0)? "true" : "false")
+                << "}";
+        }
+        text << ']';
+        return (text.str());
+    }
+
+    // Touch every node, the way a typical read-only consumer does.
+    double traverse (::cJSON * root, int& nodes)
+    {
+        double checksum = 0.0;
+        std::vector< ::cJSON*> stack(1, root);
+        nodes = 0;
+        while (!stack.empty())
+        {
+            ::cJSON *const node = stack.back();
+            stack.pop_back(), ++nodes;
+            if (node->string != 0) {
+                checksum += node->string[0];
+            }
+            if (node->type == cJSON_Number) {
+                checksum += node->valuedouble;
+            }
+            if (node->type == cJSON_String) {
+                checksum += std::strlen(node->valuestring);
+            }
+            if ((node != root) && (node->next != 0)) {
+                stack.push_back(node->next);
+            }
+            if (node->child != 0) {
+                stack.push_back(node->child);
+            }
+        }
+        return (checksum);
+    }
+
+    // Time `rounds` traversals, report nanoseconds per node.
+    double time_traversal (::cJSON * root, int rounds)
+    {
+        int nodes = 0;
+        double checksum = 0.0;
+        const double start = now();
+        for (int i=0; (i < rounds); ++i) {
+            checksum += traverse(root, nodes);
+        }
+        const double stop = now();
+        if (checksum == 0.0) {
+            std::cerr << "(unexpected checksum)" << std::endl;
+        }
+        return (((stop - start) * 1e9) / (double(nodes) * rounds));
+    }
+
+    // Leaves the heap full of small holes, so that the nodes of the next
+    // document get scattered all over the heap, like they would after a
+    // long series of mutations.
+    class Fragmenter
+    {
+        /* data. */
+    private:
+        std::vector<void*> myBlocks;
+
+        /* construction. */
+    public:
+        explicit Fragmenter (int blocks)
+        {
+            std::srand(42);
+            myBlocks.reserve(blocks);
+            for (int i=0; (i < blocks); ++i) {
+                myBlocks.push_back(std::malloc(16 + (std::rand() % 112)));
+            }
+            for (std::size_t i=0; (i < myBlocks.size()); ++i)
+            {
+                if ((std::rand() % 2) == 0) {
+                    std::free(myBlocks[i]), myBlocks[i] = 0;
+                }
+            }
+        }
+
+        ~Fragmenter ()
+        {
+            for (std::size_t i=0; (i < myBlocks.size()); ++i) {
+                std::free(myBlocks[i]);
+            }
+        }
+    };
+
+    int compact (int records)
+    {
+        const std::string text = make_document(records);
+        const int rounds = 10;
+        Fragmenter fragmenter(records * 30);
+        json::Document document(text);
+        const double before = time_traversal(document.data(), rounds);
+        const double start = now();
+        document.compact();
+        const double elapsed = now() - start;
+        const double after = time_traversal(document.data(), rounds);
+        std::cout
+            << "compact: " << records << " records, "
+            << "traversal " << before << " -> " << after << " ns/node, "
+            << "compact() took " << (elapsed * 1e3) << " ms."
+            << std::endl;
+        return (EXIT_SUCCESS);
+    }
+
+    // Time `rounds` random record lookups, report nanoseconds per lookup.
+    double time_lookups (::cJSON * root, int rounds)
+    {
+        std::vector< ::cJSON*> records;
+        for (::cJSON * node = root->child; (node != 0); node = node->next) {
+            records.push_back(node);
+        }
+        std::srand(7);
+        double checksum = 0.0;
+        const double start = now();
+        for (int i=0; (i < rounds); ++i)
+        {
+            const std::size_t j = ((std::size_t(std::rand()) << 16)
+                ^ std::size_t(std::rand())) % records.size();
+            const ::cJSON * node = records[j]->child;
+            for (; (node != 0); node = node->next) {
+                checksum += node->valuedouble;
+            }
+        }
+        const double stop = now();
+        if (checksum < 0.0) {
+            std::cerr << "(unexpected checksum)" << std::endl;
+        }
+        return (((stop - start) * 1e9) / double(rounds));
+    }
+
+    int hugepages (int records)
+    {
+        const std::string text = make_document(records);
+        static const struct {
+            const char * name;
+            json::Arena::Pages pages;
+        } configurations[] = {
+            { "default", json::Arena::default_pages },
+            { "huge", json::Arena::huge_pages },
+            { "reserved", json::Arena::reserved_huge_pages },
+        };
+        for (int i=0; (i < 3); ++i)
+        {
+            json::Document document(configurations[i].pages);
+            json::Parser parser(document, text.data(), text.size());
+            if (parser.parse() != json::Parser::complete) {
+                std::cerr << "hugepages: parse failed." << std::endl;
+                return (EXIT_FAILURE);
+            }
+            const json::Arena::Statistics statistics = document.statistics();
+            const double traversal = time_traversal(document.data(), 3);
+            const double lookups = time_lookups(document.data(), 2000000);
+            std::cout
+                << "hugepages: " << configurations[i].name << ", "
+                << (statistics.capacity >> 20) << " MB in "
+                << statistics.blocks << " blocks, "
+                << (statistics.huge_page_bytes >> 20) << " MB huge, "
+                << "traversal " << traversal << " ns/node, "
+                << "lookup " << lookups << " ns/record."
+                << std::endl;
+        }
+        return (EXIT_SUCCESS);
+    }
+
+    // Counts characters, discards them.
+    class Counter :
+        public std::streambuf
+    {
+        /* data. */
+    private:
+        std::size_t mySize;
+
+        /* construction. */
+    public:
+        Counter ()
+            : mySize(0)
+        {}
+
+        /* methods. */
+    public:
+        std::size_t size () const {
+            return (mySize);
+        }
+
+        /* overrides. */
+    protected:
+        virtual int_type overflow (int_type character)
+        {
+            ++mySize;
+            return (traits_type::not_eof(character));
+        }
+
+        virtual std::streamsize xsputn (const char *,
+                                        std::streamsize size)
+        {
+            mySize += size;
+            return (size);
+        }
+    };
+
+    // Evict the document from the CPU caches.
+    void flush_caches ()
+    {
+        static std::vector<char> junk(64*1024*1024);
+        for (std::size_t i=0; (i < junk.size()); i += 64) {
+            ++junk[i];
+        }
+    }
+
+    int serialize (int records)
+    {
+        const std::string text = make_document(records);
+        Fragmenter fragmenter(records * 30);
+        json::Document document(text);
+        double best = 0.0;
+        std::size_t size = 0;
+        for (int i=0; (i < 5); ++i)
+        {
+            Counter counter;
+            std::ostream stream(&counter);
+            flush_caches();
+            const double start = now();
+            stream << json::List(document);
+            const double elapsed = now() - start;
+            best = ((i == 0) || (elapsed < best))? elapsed : best;
+            size = counter.size();
+        }
+        double measured = 0.0;
+        std::size_t expected = 0;
+        for (int i=0; (i < 5); ++i)
+        {
+            flush_caches();
+            const double start = now();
+            expected = json::serialized_size(json::List(document));
+            const double elapsed = now() - start;
+            measured = ((i == 0) || (elapsed < measured))? elapsed : measured;
+        }
+        std::cout
+            << "serialize: " << records << " records, "
+            << size << " bytes in " << (best * 1e3) << " ms." << std::endl
+            << "  serialized_size(): " << (measured * 1e3) << " ms."
+            << std::endl;
+        return ((expected == size)? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Serialize a large document again after changing a few fields.
+    int incremental (int records)
+    {
+        json::Document document(make_document(records));
+        json::Editor editor(document);
+        std::vector<json::Map> items;
+        for (::cJSON * item = document.data()->child;
+             (item != 0); item = item->next)
+        {
+            items.push_back(json::Map(item));
+        }
+
+        double full = 0.0;
+        double edited = 0.0;
+        std::size_t size = 0;
+        for (int i=0; (i < 6); ++i)
+        {
+            for (int j=0; (j < 10); ++j)
+            {
+                editor.set(items[(i*7919 + j*104729) % items.size()],
+                           "score", editor.number(i+j));
+            }
+            Counter counter;
+            std::ostream stream(&counter);
+            double start = now();
+            stream << document.root();
+            double elapsed = now() - start;
+            full = ((i < 2) || (elapsed < full))? elapsed : full;
+
+            // The first pass fills the cache.
+            Counter copy;
+            std::ostream other(&copy);
+            start = now();
+            editor.write(other);
+            elapsed = now() - start;
+            edited = ((i < 2) || (elapsed < edited))? elapsed : edited;
+            size = counter.size();
+            if (copy.size() != size) {
+                return (EXIT_FAILURE);
+            }
+        }
+        const json::Editor::Statistics statistics = editor.statistics();
+        std::cout
+            << "incremental: " << records << " records, "
+            << size << " bytes, 10 changes per pass." << std::endl
+            << "  operator<<:      " << (full * 1e3) << " ms." << std::endl
+            << "  Editor::write(): " << (edited * 1e3) << " ms ("
+            << statistics.rebuilt << " rebuilt, " << statistics.reused
+            << " reused)." << std::endl;
+        return (EXIT_SUCCESS);
+    }
+
+    // Build a list of 50 items per record, one item at a time.
+    int append (int records)
+    {
+        const std::size_t items = std::size_t(records) * 50;
+        json::Document document(std::string("[]"));
+        json::Editor editor(document);
+        const json::List list(document);
+        double start = now();
+        for (std::size_t i=0; (i < items); ++i) {
+            editor.push_back(list, editor.number(double(i)));
+        }
+        const double built = now() - start;
+        start = now();
+        const std::size_t size = editor.size(list);
+        const double last = double(editor.back(list));
+        const double counted = now() - start;
+        if ((size != items) || (last != double(items-1))) {
+            return (EXIT_FAILURE);
+        }
+
+        // Walking to the tail each time, for a few items only.
+        const int few = static_cast<int>(std::min<std::size_t>(items, 20000));
+        ::cJSON *const array = ::cJSON_CreateArray();
+        start = now();
+        for (int i=0; (i < few); ++i) {
+            ::cJSON_AddItemToArray(array, ::cJSON_CreateNumber(i));
+        }
+        const double walked = now() - start;
+        ::cJSON_Delete(array);
+        std::cout
+            << "append: " << items << " items." << std::endl
+            << "  Editor::push_back():    " << (built * 1e3) << " ms, "
+            << ((built * 1e9) / items) << " ns/item." << std::endl
+            << "  size() + back():        " << (counted * 1e6) << " us."
+            << std::endl
+            << "  cJSON_AddItemToArray(): " << (walked * 1e3) << " ms for "
+            << few << " items, " << ((walked * 1e9) / few) << " ns/item."
+            << std::endl;
+        return (EXIT_SUCCESS);
+    }
+
+    // Keep changing sessions in a long-lived document, and check that its
+    // arena stops growing.
+    int churn (int records)
+    {
+        const int sessions = std::max(1, records/10);
+        std::ostringstream text;
+        text << '{';
+        for (int i=0; (i < sessions); ++i)
+        {
+            text
+                << ((i == 0)? "" : ",") << "\"session-" << i << "\":"
+                << "{\"user\":\"user-" << i << "\",\"seen\":0,"
+                << "\"token\":\"\",\"cart\":[]}";
+        }
+        text << '}';
+        json::Document document(text.str());
+        json::Editor editor(document);
+        std::vector<json::Map> items;
+        for (::cJSON * item = document.data()->child;
+             (item != 0); item = item->next)
+        {
+            items.push_back(json::Map(item));
+        }
+
+        std::vector<std::string> tokens;
+        for (int i=0; (i < 48); ++i) {
+            tokens.push_back(std::string(8 + i, 'x'));
+        }
+        Counter counter;
+        std::ostream output(&counter);
+
+        const int rounds = 4;
+        const int changes = records * 5;
+        std::size_t sizes[rounds];
+        unsigned long long heap[rounds];
+        double elapsed = 0.0;
+        for (int round=0; (round < rounds); ++round)
+        {
+            const double start = now();
+            const unsigned long long allocations = heap_allocations;
+            for (int i=0; (i < changes); ++i)
+            {
+                const json::Map& session =
+                    items[(std::size_t(i) * 7919) % sessions];
+                editor.set(session, "seen", editor.number(i));
+                editor.set(session, "token",
+                           editor.string(tokens[(i * 31) % 48]));
+                if ((i % 10) == 0)
+                {
+                    const json::List cart = editor.list();
+                    for (int j=0; (j < i%4); ++j) {
+                        editor.push_back(cart, editor.string("item"));
+                    }
+                    editor.set(session, "cart", cart);
+                }
+                if ((i % 100000) == 0) {
+                    editor.write(output);
+                }
+            }
+            elapsed = now() - start;
+            heap[round] = heap_allocations - allocations;
+            sizes[round] = document.statistics().size;
+        }
+        const json::Editor::Memory memory = editor.memory();
+        std::cout
+            << "churn: " << sessions << " sessions, " << changes
+            << " changes per round." << std::endl
+            << "  last round: " << ((elapsed * 1e9) / changes)
+            << " ns/change." << std::endl
+            << "  arena after each round:";
+        for (int round=0; (round < rounds); ++round) {
+            std::cout << ' ' << sizes[round];
+        }
+        std::cout << " bytes." << std::endl << "  heap allocations:";
+        for (int round=0; (round < rounds); ++round) {
+            std::cout << ' ' << heap[round];
+        }
+        std::cout
+            << "." << std::endl
+            << "  reuse rate: "
+            << ((100.0 * memory.recycled) / memory.allocated) << "%, idle: "
+            << memory.idle << ", slack: " << memory.slack
+            << ", abandoned: " << memory.abandoned << " bytes." << std::endl;
+        return (((sizes[rounds-1] == sizes[rounds-2]) &&
+                 (heap[rounds-1] == 0))? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Keep a request's payload, by copy or by serializing and parsing it.
+    int extract (int records)
+    {
+        json::Document request(
+            "{\"id\":1,\"payload\":" + make_document(records) + "}");
+        const json::Map map(request);
+        double parsed = 0.0;
+        double copied = 0.0;
+        double cloned = 0.0;
+        for (int i=0; (i < 5); ++i)
+        {
+            double start = now();
+            std::ostringstream text;
+            text << map["payload"];
+            json::Document first(text.str());
+            double elapsed = now() - start;
+            parsed = ((i == 0) || (elapsed < parsed))? elapsed : parsed;
+
+            start = now();
+            json::Document second;
+            second.extract(map["payload"]);
+            elapsed = now() - start;
+            copied = ((i == 0) || (elapsed < copied))? elapsed : copied;
+
+            start = now();
+            json::Document third;
+            request.clone(third);
+            elapsed = now() - start;
+            cloned = ((i == 0) || (elapsed < cloned))? elapsed : cloned;
+        }
+        std::cout
+            << "extract: " << records << " records." << std::endl
+            << "  serialize + parse: " << (parsed * 1e3) << " ms."
+            << std::endl
+            << "  extract():         " << (copied * 1e3) << " ms."
+            << std::endl
+            << "  clone():           " << (cloned * 1e3) << " ms."
+            << std::endl;
+        return (EXIT_SUCCESS);
+    }
+
+    // Serialize a large list on all processors.
+    int parallel (int records)
+    {
+        const std::string text = make_document(records);
+        json::Document document(text);
+        const unsigned int threads = json::processors();
+        double single = 0.0;
+        double several = 0.0;
+        std::size_t size = 0;
+        for (int i=0; (i < 5); ++i)
+        {
+            Counter counter;
+            std::ostream stream(&counter);
+            double start = now();
+            stream << json::List(document);
+            double elapsed = now() - start;
+            single = ((i == 0) || (elapsed < single))? elapsed : single;
+
+            Counter other;
+            std::ostream copy(&other);
+            start = now();
+            json::serialize(copy, json::List(document), threads);
+            elapsed = now() - start;
+            several = ((i == 0) || (elapsed < several))? elapsed : several;
+            size = counter.size();
+            if (other.size() != size) {
+                return (EXIT_FAILURE);
+            }
+        }
+        std::cout
+            << "parallel: " << records << " records, " << size << " bytes."
+            << std::endl
+            << "  operator<<:  " << (single * 1e3) << " ms." << std::endl
+            << "  serialize(): " << (several * 1e3) << " ms, "
+            << threads << " thread(s)." << std::endl;
+        return (EXIT_SUCCESS);
+    }
+
+    int lookup (int records)
+    {
+        // One large map, scattered over the heap.
+        std::ostringstream text;
+        text << '{';
+        for (int i=0; (i < records); ++i) {
+            text << ((i == 0)? "" : ",") << "\"key-" << i << "\":" << i;
+        }
+        text << '}';
+        Fragmenter fragmenter(records * 4);
+        json::Document document(text.str());
+        const json::Map map(document);
+        std::vector<std::string> keys;
+        for (int i=0; (i < 100); ++i)
+        {
+            std::ostringstream key;
+            key << "key-" << ((std::size_t(i) * 7919) % records);
+            keys.push_back(key.str());
+        }
+        flush_caches();
+        double total = 0.0;
+        const double start = now();
+        for (std::size_t i=0; (i < keys.size()); ++i) {
+            total += double(map[keys[i]]);
+        }
+        const double elapsed = now() - start;
+        if (total < 0.0) {
+            std::cerr << "(unexpected checksum)" << std::endl;
+        }
+        std::cout
+            << "lookup: " << records << " keys, "
+            << ((elapsed * 1e6) / keys.size()) << " us/lookup."
+            << std::endl;
+        return (EXIT_SUCCESS);
+    }
+
+    // Select 1% of NDJSON records by field value, with and without the
+    // raw-byte prefilter, and compare to just splitting the lines.
+    int prefilter (int records)
+    {
+        std::ostringstream stream;
+        for (int i=0; (i < records); ++i)
+        {
+            stream
+                << "{\"id\":" << i
+                << ",\"status\":\"" << (((i % 100) == 0)? "error" : "ok")
+                << "\",\"latency_ms\":" << (i % 500)
+                << ",\"message\":\"request " << i
+                << (((i % 10) == 0)? " retried after error" : " served")
+                << "\",\"tags\":[\"alpha\",\"beta\"]}\n";
+        }
+        const std::string text = stream.str();
+        const json::Selector selector("/status", "\"error\"");
+        const double megabytes = text.size() / (1024.0 * 1024.0);
+
+        // 0: split lines, 1: parse every record, 2: prefilter each record,
+        // 3: search the whole buffer for candidates.
+        json::Arena arena;
+        int matches[4] = { 0, 0, 0, 0 };
+        double elapsed[4] = { 0.0, 0.0, 0.0, 0.0 };
+        for (int pass=0; (pass < 3); ++pass)
+        {
+            const double start = now();
+            const char * line = text.data();
+            const char *const last = text.data() + text.size();
+            while (line < last)
+            {
+                const char *const end = static_cast<const char*>(
+                    std::memchr(line, '\n', last - line));
+                if (pass == 0) {
+                    matches[pass] += (*line == '{');
+                }
+                else if (pass == 1)
+                {
+                    json::Parser parser(arena, line, end - line);
+                    matches[pass] +=
+                        (parser.parse() == json::Parser::complete) &&
+                        selector.matches(json::Any(parser.root()));
+                    arena.clear();
+                }
+                else
+                {
+                    matches[pass] += selector.matches(line, end-line, arena);
+                    arena.clear();
+                }
+                line = end + 1;
+            }
+            elapsed[pass] = now() - start;
+        }
+        const double start = now();
+        std::size_t offset = 0;
+        std::size_t length = 0;
+        const char * record = 0;
+        while ((record = selector.next(
+                    text.data(), text.size(), offset, length)) != 0)
+        {
+            matches[3] += selector.matches(record, length, arena);
+            arena.clear();
+        }
+        elapsed[3] = now() - start;
+        if ((matches[1] != matches[2]) || (matches[1] != matches[3])) {
+            std::cerr << "(prefilter rejected a match)" << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout
+            << "prefilter: " << matches[3] << " of " << matches[0]
+            << " records selected." << std::endl
+            << "  split lines:  " << (megabytes / elapsed[0]) << " MB/s."
+            << std::endl
+            << "  parse all:    " << (megabytes / elapsed[1]) << " MB/s."
+            << std::endl
+            << "  per record:   " << (megabytes / elapsed[2]) << " MB/s."
+            << std::endl
+            << "  whole buffer: " << (megabytes / elapsed[3]) << " MB/s."
+            << std::endl;
+        return (EXIT_SUCCESS);
+    }
+
+    // Evaluate `.status == "error" && .latency_ms > 250` over a list of
+    // records where some lack `latency_ms`: hand-written code with
+    // Map::operator[], against a compiled expression.
+    int filter (int records)
+    {
+        std::ostringstream text;
+        text << '[';
+        for (int i=0; (i < records); ++i)
+        {
+            text
+                << ((i == 0)? "" : ",")
+                << "{\"id\":" << i
+                << ",\"host\":\"web-" << (i % 16) << "\""
+                << ",\"status\":\"" << (((i % 10) == 0)? "error" : "ok")
+                << "\"";
+            if ((i % 3) != 0) {
+                text << ",\"latency_ms\":" << (i % 500);
+            }
+            text << "}";
+        }
+        text << ']';
+        json::Document document(text.str());
+        ::cJSON *const first = document.root().data()->child;
+        const json::Expression expression(
+            ".status == \"error\" && .latency_ms > 250");
+
+        int matches[2] = { 0, 0 };
+        double start = now();
+        for (::cJSON * node = first; (node != 0); node = node->next)
+        {
+            const json::Map record = json::Any(node);
+            try {
+                matches[0] +=
+                    (std::string(record["status"]) == "error") &&
+                    (double(record["latency_ms"]) > 250);
+            }
+            catch (const std::exception&) {
+            }
+        }
+        const double adhoc = now() - start;
+        start = now();
+        for (::cJSON * node = first; (node != 0); node = node->next) {
+            matches[1] += expression.matches(json::Any(node));
+        }
+        const double compiled = now() - start;
+        if (matches[0] != matches[1]) {
+            std::cerr << "(results differ)" << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout
+            << "filter: " << matches[1] << " of " << records
+            << " records selected." << std::endl
+            << "  Map::operator[]: " << ((adhoc * 1e9) / records)
+            << " ns/record." << std::endl
+            << "  expression:      " << ((compiled * 1e9) / records)
+            << " ns/record." << std::endl;
+        return (EXIT_SUCCESS);
+    }
+
+
+    int csv (int records)
+    {
+        std::ostringstream text;
+        text << '[';
+        for (int i=0; (i < records); ++i)
+        {
+            text
+                << ((i == 0)? "" : ",")
+                << "{\"id\":" << i
+                << ",\"host\":\"web-" << (i % 16) << "\""
+                << ",\"status\":\"" << (((i % 10) == 0)? "error" : "ok")
+                << "\",\"message\":\"request " << i
+                << (((i % 7) == 0)? ", retried" : "") << "\"";
+            if ((i % 3) != 0) {
+                text << ",\"latency_ms\":" << (i % 500) << ".25";
+            }
+            text << "}";
+        }
+        text << ']';
+        const std::string data = text.str();
+        json::Document document(data);
+        ::cJSON *const first = document.root().data()->child;
+        static const char *const columns[] = {
+            "id", "host", "status", "latency_ms", "message"
+        };
+
+        // Walk the records and look up each column, with iostreams.
+        std::ostringstream adhoc;
+        double start = now();
+        for (::cJSON * node = first; (node != 0); node = node->next)
+        {
+            const json::Map record = json::Any(node);
+            for (int i=0; (i < 5); ++i)
+            {
+                json::Any value(0);
+                adhoc << ((i == 0)? "" : ",");
+                if (!record.get(columns[i], value)) {
+                    continue;
+                }
+                if (value.is_number()) {
+                    adhoc << double(value);
+                    continue;
+                }
+                const std::string cell(value);
+                if (cell.find_first_of(",\"\r\n") == std::string::npos) {
+                    adhoc << cell;
+                    continue;
+                }
+                adhoc << '"';
+                for (std::size_t j=0; (j < cell.size()); ++j) {
+                    adhoc << ((cell[j] == '"')? "\"\"" : cell.substr(j, 1));
+                }
+                adhoc << '"';
+            }
+            adhoc << '\n';
+        }
+        const double walked = now() - start;
+
+        // Same, with the exporter.
+        std::ostringstream exported;
+        start = now();
+        {
+            json::Csv csv(exported,
+                          ".id, .host, .status, .latency_ms, .message");
+            for (::cJSON * node = first; (node != 0); node = node->next) {
+                csv.write(json::Any(node));
+            }
+        }
+        const double written = now() - start;
+
+        // Straight from the text, a record at a time.
+        std::ostringstream streamed;
+        start = now();
+        {
+            json::Csv csv(streamed,
+                          ".id, .host, .status, .latency_ms, .message");
+            csv.write(data.data(), data.size());
+        }
+        const double parsed = now() - start;
+        if ((adhoc.str() != exported.str()) ||
+            (exported.str() != streamed.str()))
+        {
+            std::cerr << "(results differ)" << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout
+            << "csv: " << exported.str().size() << " bytes." << std::endl
+            << "  Map::get() and iostreams: " << ((walked * 1e9) / records)
+            << " ns/record." << std::endl
+            << "  Csv::write(Any):          " << ((written * 1e9) / records)
+            << " ns/record." << std::endl
+            << "  Csv::write(text):         " << ((parsed * 1e9) / records)
+            << " ns/record, parsing included." << std::endl;
+        return (EXIT_SUCCESS);
+    }
+
+
+#ifndef _WIN32
+    // Read until the other end is closed.
+    void drain (void * context)
+    {
+        const int descriptor = *static_cast<int*>(context);
+        char data[64*1024];
+        while (::read(descriptor, data, sizeof(data)) > 0)
+            ;
+    }
+
+    // Send documents with large strings over a socket.
+    int gather (int records)
+    {
+        const int blobs = std::max(1, records/200);
+        std::ostringstream text;
+        text << '[';
+        for (int i=0; (i < blobs); ++i)
+        {
+            text
+                << ((i == 0)? "" : ",")
+                << "{\"id\":" << i << ",\"type\":\"text/html\",\"body\":\""
+                << "<html><body>" << std::string(64*1024, 'x')
+                << "</body></html>\"}";
+        }
+        text << ']';
+        json::Document document(text.str());
+
+        double copied = 0.0;
+        double gathered = 0.0;
+        std::size_t size = 0;
+        std::size_t referenced = 0;
+        for (int i=0; (i < 5); ++i)
+        {
+            int sockets[2];
+            if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+                return (EXIT_FAILURE);
+            }
+            json::Thread reader(&drain, &sockets[1]);
+
+            double start = now();
+            std::ostringstream stream;
+            stream << json::List(document);
+            const std::string output = stream.str();
+            for (std::size_t offset = 0; (offset < output.size());)
+            {
+                const ::ssize_t sent = ::write(
+                    sockets[0], output.data()+offset, output.size()-offset);
+                if (sent <= 0) {
+                    return (EXIT_FAILURE);
+                }
+                offset += sent;
+            }
+            double elapsed = now() - start;
+            copied = ((i == 0) || (elapsed < copied))? elapsed : copied;
+
+            start = now();
+            json::Gather gather;
+            gather.write(json::List(document));
+            size = gather.size(), referenced = gather.referenced();
+            gather.send(sockets[0]);
+            elapsed = now() - start;
+            gathered = ((i == 0) || (elapsed < gathered))? elapsed : gathered;
+
+            ::shutdown(sockets[0], SHUT_WR);
+            reader.join();
+            ::close(sockets[0]), ::close(sockets[1]);
+        }
+        std::cout
+            << "gather: " << blobs << " records, " << size << " bytes, "
+            << referenced << " referenced." << std::endl
+            << "  ostream + write: " << (copied * 1e3) << " ms." << std::endl
+            << "  gather + writev: " << (gathered * 1e3) << " ms."
+            << std::endl;
+        return (EXIT_SUCCESS);
+    }
+#endif
+
+#ifndef _WIN32
+    // Records to serialize, a thousand at a time, in order.
+    struct Transform
+    {
+        std::vector< ::cJSON* > items;
+        json::OrderedWriter * output;
+        volatile long next;
+        bool failed;
+    };
+
+    void transform (void * context)
+    {
+        Transform& job = *static_cast<Transform*>(context);
+        const long chunks = long(job.items.size() + 999) / 1000;
+        json::OrderedWriter::Batch batch;
+        try {
+            for (;;)
+            {
+                const long chunk = json::atomic_increment(job.next) - 1;
+                if (chunk >= chunks) {
+                    break;
+                }
+                batch.reset(chunk);
+                const std::size_t last = std::min(
+                    job.items.size(), std::size_t(chunk+1) * 1000);
+                for (std::size_t i = chunk*1000; (i < last); ++i) {
+                    batch.append(json::Any(job.items[i]));
+                }
+                job.output->submit(batch);
+            }
+        }
+        catch (const std::exception&) {
+            job.failed = true;
+        }
+    }
+
+    // Write records as NDJSON from one thread, then from all processors.
+    int ordered (int records)
+    {
+        const std::string text = make_document(records);
+        json::Document document(text);
+        Transform job;
+        for (::cJSON * item = document.data()->child;
+             (item != 0); item = item->next)
+        {
+            job.items.push_back(item);
+        }
+        const char path[] = "ordered.ndjson";
+        const unsigned int threads = json::processors();
+        double single = 0.0;
+        double several = 0.0;
+        json::OrderedWriter::Statistics statistics;
+        for (int i=0; (i < 5); ++i)
+        {
+            double start = now();
+            {
+                std::ofstream file(path, std::ios::binary);
+                for (std::size_t j=0; (j < job.items.size()); ++j) {
+                    file << json::Any(job.items[j]) << '\n';
+                }
+            }
+            double elapsed = now() - start;
+            single = ((i == 0) || (elapsed < single))? elapsed : single;
+
+            start = now();
+            json::OrderedWriter output(path);
+            job.output = &output, job.next = 0, job.failed = false;
+            std::vector<json::Thread*> workers;
+            try {
+                for (unsigned int j=0; (j < threads); ++j) {
+                    workers.push_back(new json::Thread(&transform, &job));
+                }
+            }
+            catch (...) {
+                job.failed = true;
+            }
+            for (std::size_t j=0; (j < workers.size()); ++j) {
+                delete workers[j];
+            }
+            output.close();
+            elapsed = now() - start;
+            several = ((i == 0) || (elapsed < several))? elapsed : several;
+            statistics = output.statistics();
+            if (job.failed) {
+                return (EXIT_FAILURE);
+            }
+        }
+        std::remove(path);
+        std::cout
+            << "ordered: " << records << " records, "
+            << statistics.bytes << " bytes in " << statistics.writes
+            << " writes." << std::endl
+            << "  ofstream:      " << (single * 1e3) << " ms." << std::endl
+            << "  OrderedWriter: " << (several * 1e3) << " ms, "
+            << threads << " thread(s)." << std::endl;
+        return (EXIT_SUCCESS);
+    }
+#endif
+
+#ifndef _WIN32
+    // Hand a parsed document to another process.
+    int shared (int records)
+    {
+        const std::string text = make_document(records);
+        double start = now();
+        {
+            json::Document document(text);
+        }
+        const double parsed = now() - start;
+
+        // The child doesn't have the parent's mapping, so it can open the
+        // document at the same address.
+        int sockets[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+            return (EXIT_FAILURE);
+        }
+        const ::pid_t child = ::fork();
+        if (child == 0)
+        {
+            const int descriptor = json::SharedDocument::receive(sockets[1]);
+            start = now();
+            const json::SharedDocument document(descriptor);
+            const double opened = now() - start;
+            std::cout
+                << "  open (other process): " << (opened * 1e3) << " ms"
+                << (document.relocated()? ", relocated." : ".") << std::endl;
+            std::exit(EXIT_SUCCESS);
+        }
+        start = now();
+        const json::SharedDocument document(text.data(), text.size());
+        const double created = now() - start;
+        std::cout
+            << "shared: " << records << " records, "
+            << document.size() << " bytes." << std::endl
+            << "  parse (Document):     " << (parsed * 1e3) << " ms."
+            << std::endl
+            << "  parse (shared):       " << (created * 1e3) << " ms."
+            << std::endl;
+        document.send(sockets[0]);
+        int status = 0;
+        ::waitpid(child, &status, 0);
+        ::close(sockets[0]), ::close(sockets[1]);
+
+        // Here, the address is taken by the original.
+        start = now();
+        const json::SharedDocument copy(::dup(document.descriptor()));
+        const double relocated = now() - start;
+        std::cout
+            << "  open (same process):  " << (relocated * 1e3) << " ms"
+            << (copy.relocated()? ", relocated." : ".") << std::endl;
+        return ((status == 0)? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+#endif
+
+#ifdef __linux__
+    void add (const json::Any& params, std::ostream& result, void *)
+    {
+        const json::List operands(params);
+        result << (double(operands[0]) + double(operands[1]));
+    }
+
+    void serve (void * server)
+    {
+        static_cast<json::RpcServer*>(server)->run();
+    }
+
+    // One connection sending a request (or batch), then waiting for the
+    // response, over and over.
+    struct Client
+    {
+        unsigned short port;
+        int messages;
+        int batch;
+        std::vector<double> latencies;
+        bool failed;
+    };
+
+    void send_requests (void * context)
+    {
+        Client& client = *static_cast<Client*>(context);
+        client.failed = true;
+        const int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+        ::sockaddr_in endpoint;
+        std::memset(&endpoint, 0, sizeof(endpoint));
+        endpoint.sin_family = AF_INET;
+        endpoint.sin_port = htons(client.port);
+        endpoint.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        const int enable = 1;
+        ::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY,
+                     &enable, sizeof(enable));
+        if (::connect(socket, reinterpret_cast<::sockaddr*>(&endpoint),
+                      sizeof(endpoint)) != 0)
+        {
+            ::close(socket); return;
+        }
+        std::ostringstream text;
+        text << ((client.batch > 1)? "[" : "");
+        for (int i=0; (i < client.batch); ++i)
+        {
+            text
+                << ((i == 0)? "" : ",")
+                << "{\"jsonrpc\":\"2.0\",\"method\":\"add\","
+                << "\"params\":[" << i << ",0.5],\"id\":" << i << "}";
+        }
+        text << ((client.batch > 1)? "]" : "") << std::endl;
+        const std::string message = text.str();
+
+        char data[64*1024];
+        for (int i=0; (i < client.messages); ++i)
+        {
+            const double start = now();
+            if (::write(socket, message.data(), message.size()) !=
+                ::ssize_t(message.size()))
+            {
+                ::close(socket); return;
+            }
+            for (bool done = false; !done;)
+            {
+                const ::ssize_t size = ::read(socket, data, sizeof(data));
+                if (size <= 0) {
+                    ::close(socket); return;
+                }
+                done = (data[size-1] == '\n');
+            }
+            client.latencies.push_back(now() - start);
+        }
+        ::close(socket);
+        client.failed = false;
+    }
+
+    // Closed-loop load on a local server.
+    int rpc (int records)
+    {
+        const int connections = 8;
+        const unsigned int threads =
+            std::max(1u, json::processors()/2);
+        json::RpcServer server("127.0.0.1", 0, threads);
+        server.bind("add", &add);
+        json::Thread running(&serve, &server);
+
+        int status = EXIT_SUCCESS;
+        const int batches[] = { 1, 100 };
+        for (int b=0; (b < 2); ++b)
+        {
+            std::vector<Client> clients(connections);
+            for (int i=0; (i < connections); ++i)
+            {
+                clients[i].port = server.port();
+                clients[i].messages =
+                    std::max(1, records/batches[b]/connections);
+                clients[i].batch = batches[b];
+                clients[i].failed = false;
+            }
+            const double start = now();
+            {
+                std::vector<json::Thread*> senders;
+                for (int i=0; (i < connections); ++i) {
+                    senders.push_back(
+                        new json::Thread(&send_requests, &clients[i]));
+                }
+                for (int i=0; (i < connections); ++i) {
+                    delete senders[i];
+                }
+            }
+            const double elapsed = now() - start;
+
+            std::vector<double> latencies;
+            for (int i=0; (i < connections); ++i)
+            {
+                status = clients[i].failed? EXIT_FAILURE : status;
+                latencies.insert(latencies.end(),
+                    clients[i].latencies.begin(), clients[i].latencies.end());
+            }
+            if (latencies.empty()) {
+                break;
+            }
+            std::sort(latencies.begin(), latencies.end());
+            const std::size_t n = latencies.size();
+            std::cout
+                << "rpc: " << n << " messages of " << batches[b]
+                << " request(s), " << connections << " connections, "
+                << threads << " loop(s)." << std::endl
+                << "  throughput: "
+                << (n*batches[b] / elapsed) << " requests/s." << std::endl
+                << "  latency:    p50 " << (latencies[n*50/100] * 1e6)
+                << " us, p99 " << (latencies[n*99/100] * 1e6)
+                << " us, p999 " << (latencies[n*999/1000] * 1e6)
+                << " us." << std::endl;
+        }
+        server.stop();
+        return (status);
+    }
+#endif
+}
+
+int main (int argc, char ** argv)
+try
+{
+    // List benchmarks to run.
+    static const struct {
+        const char * name;
+        benchmark run;
+    } benchmarks[] = {
+        { "compact", compact },
+        { "hugepages", hugepages },
+        { "serialize", serialize },
+        { "incremental", incremental },
+        { "append", append },
+        { "churn", churn },
+        { "extract", extract },
+        { "parallel", parallel },
+        { "lookup", lookup },
+        { "prefilter", prefilter },
+        { "filter", filter },
+        { "csv", csv },
+#ifndef _WIN32
+        { "gather", gather },
+#endif
+#ifndef _WIN32
+        { "ordered", ordered },
+        { "shared", shared },
+#endif
+#ifdef __linux__
+        { "rpc", rpc },
+#endif
+    };
+    static const int n = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+    // Usage: bench [name [records]]
+    const char *const name = (argc > 1)? argv[1] : 0;
+    const int records = (argc > 2)? std::atoi(argv[2]) : 200000;
+
+    int status = EXIT_SUCCESS;
+    for (int i=0; ((i < n) && (status == EXIT_SUCCESS)); ++i)
+    {
+        if ((name == 0) || (std::strcmp(name, benchmarks[i].name) == 0)) {
+            status = (*benchmarks[i].run)(records);
+        }
+    }
+    return (status);
+}
+catch (const std::exception& error)
+{
+    std::cerr
+        << "Error: '" << error.what() << "'."
+        << std::endl;
+    return (EXIT_FAILURE);
+}
+catch (...)
+{
+    std::cerr
+        << "Unknown error."
+        << std::endl;
+    return (EXIT_FAILURE);
+}
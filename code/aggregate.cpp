@@ -0,0 +1,452 @@
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @internal
+ * @file aggregate.cpp
+ * @brief Parallel group-by aggregation over NDJSON.
+ */
+
+#include "aggregate.hpp"
+#include "thread.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+    // Add `from`'s totals to `into`'s.
+    void combine (json::Aggregation::Group& into,
+                  const json::Aggregation::Group& from)
+    {
+        if (from.numbers > 0)
+        {
+            if (into.numbers == 0) {
+                into.min = from.min, into.max = from.max;
+            }
+            else {
+                into.min = std::min(into.min, from.min);
+                into.max = std::max(into.max, from.max);
+            }
+        }
+        into.count += from.count;
+        into.numbers += from.numbers;
+        into.sum += from.sum;
+    }
+
+    // Same number formatting as the rest of the serializer.
+    std::ostream& write_number (std::ostream& stream, double value)
+    {
+        char text[32];
+        return (stream.write(text, json::format(value, text)));
+    }
+
+    // Spilled groups are a sequence of: key size (4 bytes), key, then the
+    // count, numbers, sum, min and max fields (8 bytes each).
+    void encode (const json::Aggregation::Group& group, std::string& buffer)
+    {
+        const unsigned int size = static_cast<unsigned int>(group.key.size());
+        buffer.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        buffer.append(group.key);
+        buffer.append(reinterpret_cast<const char*>(&group.count), 8);
+        buffer.append(reinterpret_cast<const char*>(&group.numbers), 8);
+        buffer.append(reinterpret_cast<const char*>(&group.sum), 8);
+        buffer.append(reinterpret_cast<const char*>(&group.min), 8);
+        buffer.append(reinterpret_cast<const char*>(&group.max), 8);
+    }
+
+    bool decode (std::FILE * file, json::Aggregation::Group& group)
+    {
+        unsigned int size = 0;
+        if (std::fread(&size, sizeof(size), 1, file) != 1) {
+            return (false);
+        }
+        group.key.resize(size);
+        return (((size == 0) ||
+                 (std::fread(&group.key[0], 1, size, file) == size)) &&
+                (std::fread(&group.count, 8, 1, file) == 1) &&
+                (std::fread(&group.numbers, 8, 1, file) == 1) &&
+                (std::fread(&group.sum, 8, 1, file) == 1) &&
+                (std::fread(&group.min, 8, 1, file) == 1) &&
+                (std::fread(&group.max, 8, 1, file) == 1));
+    }
+
+}
+
+namespace json {
+
+    // Open addressing hash table of groups, with linear probing.  Slots
+    // keep the key hash, so probes only touch groups whose hash matches.
+    struct Aggregation::Table
+    {
+        struct Slot
+        {
+            unsigned long long hash;
+            std::size_t group;
+        };
+
+        std::vector<Group> groups;
+        std::vector<unsigned long long> hashes;
+        std::vector<Slot> slots;
+        std::size_t bytes;
+
+        Table ()
+            : bytes(0)
+        {
+            clear();
+        }
+
+        Group& find (const std::string& key, unsigned long long hash)
+        {
+            const std::size_t mask = slots.size() - 1;
+            std::size_t i = hash & mask;
+            for (; (slots[i].group != 0); i = (i+1) & mask)
+            {
+                if ((slots[i].hash == hash) &&
+                    (groups[slots[i].group-1].key == key))
+                {
+                    return (groups[slots[i].group-1]);
+                }
+            }
+            const Group group = { key, 0, 0, 0.0, 0.0, 0.0 };
+            groups.push_back(group), hashes.push_back(hash);
+            slots[i].hash = hash, slots[i].group = groups.size();
+            bytes += sizeof(Group) + sizeof(hash) + key.size();
+            if ((2 * groups.size()) > slots.size()) {
+                grow();
+            }
+            return (groups.back());
+        }
+
+        void grow ()
+        {
+            const Slot empty = { 0, 0 };
+            bytes -= slots.size() * sizeof(Slot);
+            std::vector<Slot>(2*slots.size(), empty).swap(slots);
+            bytes += slots.size() * sizeof(Slot);
+            const std::size_t mask = slots.size() - 1;
+            for (std::size_t j=0; (j < groups.size()); ++j)
+            {
+                std::size_t i = hashes[j] & mask;
+                while (slots[i].group != 0) {
+                    i = (i+1) & mask;
+                }
+                slots[i].hash = hashes[j], slots[i].group = j + 1;
+            }
+        }
+
+        void clear ()
+        {
+            const Slot empty = { 0, 0 };
+            std::vector<Group>().swap(groups);
+            std::vector<unsigned long long>().swap(hashes);
+            std::vector<Slot>(1024, empty).swap(slots);
+            bytes = slots.size() * sizeof(Slot);
+        }
+    };
+
+    // One temporary file per partition, shared by all threads.
+    struct Aggregation::Spills
+    {
+        Mutex mutex;
+        std::FILE * files[partitions];
+
+        Spills ()
+        {
+            std::fill(files, files+partitions, static_cast<std::FILE*>(0));
+        }
+
+        ~Spills ()
+        {
+            for (std::size_t i=0; (i < partitions); ++i) {
+                if (files[i] != 0) {
+                    std::fclose(files[i]);
+                }
+            }
+        }
+    };
+
+    struct Aggregation::Worker
+    {
+        Aggregation * aggregation;
+        Table * table;
+        const char * data;
+        std::size_t size;
+        std::size_t share;
+        Statistics statistics;
+        std::string error;
+    };
+
+    const std::size_t Aggregation::partitions;
+
+    Aggregation::Aggregation
+        (const std::string& key, const std::string& value,
+         std::size_t budget, const Expression * filter)
+        : myKey(key)
+        , myFilter(filter)
+        , myBudget(budget)
+        , mySpills(new Spills())
+    {
+        if (!value.empty()) {
+            myValue.push_back(Projection(value));
+        }
+        const Statistics statistics = { 0, 0, 0 };
+        myStatistics = statistics;
+    }
+
+    Aggregation::~Aggregation ()
+    {
+        for (std::size_t i=0; (i < myTables.size()); ++i) {
+            delete myTables[i];
+        }
+        delete mySpills;
+    }
+
+    void Aggregation::run (const char * data, std::size_t size,
+                           unsigned int threads)
+    {
+        threads = (threads == 0)? processors() : threads;
+        while (myTables.size() < threads) {
+            myTables.push_back(new Table());
+        }
+
+        // Split the input in one run of whole lines per thread.
+        std::vector<Worker> workers;
+        std::size_t offset = 0;
+        for (unsigned int i=0; ((i < threads) && (offset < size)); ++i)
+        {
+            std::size_t last = (i+1 == threads)? size :
+                std::max(offset, std::min(size, size/threads*(i+1)));
+            const char *const end = static_cast<const char*>(
+                std::memchr(data+last, '\n', size-last));
+            last = (end == 0)? size : (end - data) + 1;
+            const Statistics statistics = { 0, 0, 0 };
+            const Worker worker = {
+                this, myTables[i], data+offset, last-offset,
+                std::max<std::size_t>(myBudget/threads, 1), statistics,
+                std::string()
+            };
+            workers.push_back(worker), offset = last;
+        }
+        if (workers.size() == 1) {
+            work(&workers[0]);
+        }
+        else
+        {
+            std::vector<Thread*> running;
+            try {
+                for (std::size_t i=0; (i < workers.size()); ++i) {
+                    running.push_back(new Thread(&work, &workers[i]));
+                }
+            }
+            catch (...) {
+                for (std::size_t i=0; (i < running.size()); ++i) {
+                    delete running[i];
+                }
+                throw;
+            }
+            for (std::size_t i=0; (i < running.size()); ++i) {
+                delete running[i];
+            }
+        }
+
+        for (std::size_t i=0; (i < workers.size()); ++i)
+        {
+            if (!workers[i].error.empty()) {
+                throw (std::runtime_error(workers[i].error));
+            }
+            myStatistics.records += workers[i].statistics.records;
+            myStatistics.skipped += workers[i].statistics.skipped;
+            myStatistics.spills += workers[i].statistics.spills;
+        }
+    }
+
+    void Aggregation::work (void * context)
+    {
+        Worker& worker = *static_cast<Worker*>(context);
+        const Aggregation& self = *worker.aggregation;
+        try {
+            Arena arena;
+            std::ostringstream text;
+            std::string key;
+            Any value(0);
+            const char *const last = worker.data + worker.size;
+            std::size_t size = 0;
+            for (const char * line = worker.data;
+                 (line < last); line += size+1)
+            {
+                const char *const end = static_cast<const char*>(
+                    std::memchr(line, '\n', last-line));
+                size = ((end == 0)? last : end) - line;
+                if ((size == 0) || ((size == 1) && (*line == '\r'))) {
+                    continue;
+                }
+                Parser parser(arena, line, size);
+                if ((parser.parse() != Parser::complete) ||
+                    ((self.myFilter != 0) &&
+                     !self.myFilter->matches(Any(parser.root()))))
+                {
+                    ++worker.statistics.skipped, arena.clear();
+                    continue;
+                }
+                const Any root(parser.root());
+                if (self.myKey.get(0, root, value)) {
+                    text.str(""), text << value, key = text.str();
+                }
+                else {
+                    key = "null";
+                }
+                Group& group =
+                    worker.table->find(key, hash(key.data(), key.size()));
+                ++group.count;
+                if (!self.myValue.empty() &&
+                    self.myValue[0].get(0, root, value) && value.is_number())
+                {
+                    const double number = double(value);
+                    if (group.numbers++ == 0) {
+                        group.min = group.max = number;
+                    }
+                    group.min = std::min(group.min, number);
+                    group.max = std::max(group.max, number);
+                    group.sum += number;
+                }
+                ++worker.statistics.records;
+                arena.clear();
+                if (worker.table->bytes > worker.share) {
+                    worker.aggregation->spill(*worker.table);
+                    ++worker.statistics.spills;
+                }
+            }
+        }
+        catch (const std::exception& error) {
+            worker.error = error.what();
+        }
+    }
+
+    // Append the table's groups to the partition files, then empty it.
+    void Aggregation::spill (Table& table)
+    {
+        std::vector<std::string> buffers(partitions);
+        for (std::size_t i=0; (i < table.groups.size()); ++i) {
+            encode(table.groups[i], buffers[table.hashes[i] >> 58]);
+        }
+        table.clear();
+        const Lock lock(mySpills->mutex);
+        for (std::size_t i=0; (i < partitions); ++i)
+        {
+            if (buffers[i].empty()) {
+                continue;
+            }
+            std::FILE *& file = mySpills->files[i];
+            if ((file == 0) && ((file = std::tmpfile()) == 0)) {
+                throw (std::runtime_error("Could not create spill file."));
+            }
+            if (std::fwrite(buffers[i].data(), 1, buffers[i].size(), file)
+                != buffers[i].size())
+            {
+                throw (std::runtime_error("Could not write spill file."));
+            }
+        }
+    }
+
+    void Aggregation::write (std::ostream& stream)
+    {
+        // Gather each partition's groups in one table, write them, and move
+        // on to the next partition.  Without spills, there is just the one
+        // partition in memory.
+        bool spilled = false;
+        for (std::size_t p=0; (p < partitions); ++p) {
+            spilled = spilled || (mySpills->files[p] != 0);
+        }
+        std::vector<Table*> sources(myTables);
+        if (spilled)
+        {
+            for (std::size_t i=0; (i < myTables.size()); ++i) {
+                spill(*myTables[i]);
+            }
+            sources.clear();
+        }
+        const std::size_t rounds = spilled? partitions : 1;
+        Table merged;
+        Group group;
+        for (std::size_t p=0; (p < rounds); ++p)
+        {
+            for (std::size_t i=0; (i < sources.size()); ++i)
+            {
+                const Table& table = *sources[i];
+                for (std::size_t j=0; (j < table.groups.size()); ++j) {
+                    combine(merged.find(table.groups[j].key,
+                                        table.hashes[j]), table.groups[j]);
+                }
+            }
+            std::FILE *const file = mySpills->files[p];
+            if (file != 0)
+            {
+                std::rewind(file);
+                while (decode(file, group)) {
+                    combine(merged.find(group.key,
+                        hash(group.key.data(), group.key.size())), group);
+                }
+                if (std::ferror(file)) {
+                    throw (std::runtime_error("Could not read spill file."));
+                }
+            }
+            for (std::size_t i=0; (i < merged.groups.size()); ++i)
+            {
+                const Group& group = merged.groups[i];
+                stream
+                    << "{\"key\":" << group.key
+                    << ",\"count\":" << group.count;
+                if (!myValue.empty())
+                {
+                    if (group.numbers == 0) {
+                        stream << ",\"sum\":0,\"min\":null,\"max\":null";
+                    }
+                    else {
+                        write_number(stream << ",\"sum\":", group.sum);
+                        write_number(stream << ",\"min\":", group.min);
+                        write_number(stream << ",\"max\":", group.max);
+                    }
+                }
+                stream << "}\n";
+            }
+            merged.clear();
+        }
+
+        // Start over.
+        Spills *const spills = new Spills();
+        delete mySpills, mySpills = spills;
+        for (std::size_t i=0; (i < myTables.size()); ++i) {
+            myTables[i]->clear();
+        }
+    }
+
+}
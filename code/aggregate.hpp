@@ -0,0 +1,212 @@
+#ifndef _aggregate_hpp__
+#define _aggregate_hpp__
+
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file aggregate.hpp
+ * @brief Parallel group-by aggregation over NDJSON.
+ */
+
+#include "json.hpp"
+#include "query.hpp"
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace json {
+
+    /*!
+     * @brief Group NDJSON records by the value at one path, and count them
+     *  and sum, min and max the numbers at another.
+     *
+     * Records are parsed in parallel, each thread aggregating into its own
+     * hash table; the tables are merged at the end.  When the tables grow
+     * past the memory budget (many distinct keys), a thread spills its table
+     * to temporary files, partitioned by key hash, and starts over; the
+     * results are then merged one partition at a time, so that only a
+     * fraction of the groups is in memory at once.
+     *
+     * @code
+     *  json::Aggregation aggregation(".host", ".latency_ms", 256<<20);
+     *  aggregation.run(data, size);
+     *  aggregation.write(std::cout);
+     * @endcode
+     */
+    class Aggregation
+    {
+        /* nested types. */
+    private:
+        struct Table;
+        struct Spills;
+        struct Worker;
+
+    public:
+        /*!
+         * @brief Totals for one distinct key.
+         */
+        struct Group
+        {
+            /*!
+             * @brief The key's value, as compact JSON text.
+             */
+            std::string key;
+
+            /*!
+             * @brief Number of records with this key.
+             */
+            unsigned long long count;
+
+            /*!
+             * @brief Number of those records with a number at the value's
+             *  path.
+             */
+            unsigned long long numbers;
+
+            double sum;
+            double min;
+            double max;
+        };
+
+        /*!
+         * @brief Aggregation activity report.
+         */
+        struct Statistics
+        {
+            /*!
+             * @brief Number of records aggregated.
+             */
+            unsigned long long records;
+
+            /*!
+             * @brief Number of records skipped: invalid JSON or filtered
+             *  out.
+             */
+            unsigned long long skipped;
+
+            /*!
+             * @brief Number of times a table was spilled to disk.
+             */
+            unsigned long long spills;
+        };
+
+        /* class data. */
+    public:
+        /*!
+         * @brief Number of spill partitions.
+         */
+        static const std::size_t partitions = 64;
+
+        /* data. */
+    private:
+        Projection myKey;
+        std::vector<Projection> myValue;
+        const Expression * myFilter;
+        std::size_t myBudget;
+        std::vector<Table*> myTables;
+        Spills * mySpills;
+        Statistics myStatistics;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Prepare an aggregation.
+         * @param key Path to the grouping key, such as @c ".user.id".
+         *  Records without one are grouped under @c null.
+         * @param value Path to the number to sum, such as @c ".bytes", or
+         *  an empty string to only count records.
+         * @param budget Approximate bound on the memory used by the hash
+         *  tables, in bytes.
+         * @param filter Optional expression records must satisfy.  It must
+         *  outlive the aggregation.
+         *
+         * @throw std::runtime_error A path is not valid.
+         */
+        Aggregation (const std::string& key, const std::string& value,
+                     std::size_t budget, const Expression * filter=0);
+
+    private:
+        Aggregation (const Aggregation&);
+
+    public:
+        ~Aggregation ();
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Aggregate a buffer of NDJSON records.
+         * @param data Buffer holding whole records, one per line.
+         * @param size Size of @a data, in bytes.
+         * @param threads Number of threads to use, or 0 for one per
+         *  processor.
+         *
+         * May be called several times (e.g. once per file) before
+         * @c write().
+         *
+         * @throw std::runtime_error A spill file cannot be written.
+         */
+        void run (const char * data, std::size_t size,
+                  unsigned int threads=0);
+
+        /*!
+         * @brief Merge the per-thread results and write one line of JSON
+         *  per group, in no particular order.
+         * @param stream Output stream.
+         *
+         * The groups are then cleared, so that the aggregation can be run
+         * again on other input.
+         *
+         * Each line has the form @c {"key":...,"count":...} and, if there
+         * is a value path, @c "sum", @c "min" and @c "max" (@c null if no
+         * record of the group had a number there).
+         *
+         * @throw std::runtime_error A spill file cannot be read.
+         */
+        void write (std::ostream& stream);
+
+        /*!
+         * @brief Report activity so far.
+         */
+        Statistics statistics () const {
+            return (myStatistics);
+        }
+
+    private:
+        static void work (void * context);
+        void spill (Table& table);
+
+        /* operators. */
+    private:
+        Aggregation& operator= (const Aggregation&);
+    };
+
+}
+
+#endif /* _aggregate_hpp__ */
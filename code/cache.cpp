@@ -0,0 +1,315 @@
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @internal
+ * @file cache.cpp
+ * @brief Cache of parsed documents, keyed by content.
+ */
+
+#include "cache.hpp"
+#include "thread.hpp"
+
+#include <cstring>
+#include <exception>
+#include <map>
+#include <vector>
+
+namespace json {
+
+    struct DocumentCache::Entry
+    {
+        volatile long references;
+        const unsigned long long hash;
+        const std::string payload;
+        Document document;
+        std::size_t bytes;
+
+        // Position in the shard's recency list.
+        Entry * newer;
+        Entry * older;
+
+        Entry (unsigned long long hash, const char * data, std::size_t size)
+            : references(1)
+            , hash(hash)
+            , payload(data, size)
+            , bytes(0)
+            , newer(0)
+            , older(0)
+        {}
+    };
+
+    namespace {
+
+        // Drop one reference, deleting the entry with the last one.
+        template<typename Entry>
+        void release (Entry * entry)
+        {
+            if ((entry != 0) && (atomic_decrement(entry->references) == 0)) {
+                delete entry;
+            }
+        }
+
+    }
+
+    struct DocumentCache::Shard
+    {
+        typedef std::multimap<unsigned long long, Entry*> Index;
+
+        Mutex mutex;
+        Index index;
+        Entry * newest;
+        Entry * oldest;
+        std::size_t bytes;
+        std::size_t budget;
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned long long evictions;
+
+        Shard ()
+            : newest(0)
+            , oldest(0)
+            , bytes(0)
+            , budget(0)
+            , hits(0)
+            , misses(0)
+            , evictions(0)
+        {}
+
+        // Caller must hold the mutex.
+        Entry * find (unsigned long long hash,
+                      const char * data, std::size_t size) const
+        {
+            typedef Index::const_iterator Iterator;
+            const std::pair<Iterator,Iterator> range =
+                index.equal_range(hash);
+            Iterator match = range.first;
+            for (; (match != range.second); ++match)
+            {
+                const std::string& payload = match->second->payload;
+                if ((payload.size() == size) &&
+                    (std::memcmp(payload.data(), data, size) == 0))
+                {
+                    return (match->second);
+                }
+            }
+            return (0);
+        }
+
+        // Caller must hold the mutex.
+        void unlink (Entry * entry)
+        {
+            (entry->newer? entry->newer->older : newest) = entry->older;
+            (entry->older? entry->older->newer : oldest) = entry->newer;
+            entry->newer = entry->older = 0;
+        }
+
+        // Caller must hold the mutex.
+        void push (Entry * entry)
+        {
+            entry->older = newest, entry->newer = 0;
+            (newest? newest->newer : oldest) = entry;
+            newest = entry;
+        }
+
+        // Caller must hold the mutex.
+        void remove (Entry * entry)
+        {
+            typedef Index::iterator Iterator;
+            const std::pair<Iterator,Iterator> range =
+                index.equal_range(entry->hash);
+            Iterator match = range.first;
+            for (; (match != range.second); ++match)
+            {
+                if (match->second == entry) {
+                    index.erase(match); break;
+                }
+            }
+            unlink(entry);
+            bytes -= entry->bytes;
+        }
+    };
+
+    DocumentCache::Handle::Handle ()
+        : myEntry(0)
+    {
+    }
+
+    DocumentCache::Handle::Handle (Entry * entry)
+        : myEntry(entry)
+    {
+    }
+
+    DocumentCache::Handle::Handle (const Handle& other)
+        : myEntry(other.myEntry)
+    {
+        if (myEntry != 0) {
+            atomic_increment(myEntry->references);
+        }
+    }
+
+    DocumentCache::Handle::~Handle ()
+    {
+        release(myEntry);
+    }
+
+    DocumentCache::Handle&
+        DocumentCache::Handle::operator= (const Handle& other)
+    {
+        if (other.myEntry != 0) {
+            atomic_increment(other.myEntry->references);
+        }
+        release(myEntry), myEntry = other.myEntry;
+        return (*this);
+    }
+
+    const Document& DocumentCache::Handle::operator* () const
+    {
+        return (myEntry->document);
+    }
+
+    const Document * DocumentCache::Handle::operator-> () const
+    {
+        return (&myEntry->document);
+    }
+
+    DocumentCache::DocumentCache (std::size_t budget, std::size_t shards)
+        : myShards(new Shard[(shards == 0)? 1 : shards])
+        , myShardCount((shards == 0)? 1 : shards)
+    {
+        for (std::size_t i=0; (i < myShardCount); ++i) {
+            myShards[i].budget = budget / myShardCount;
+        }
+    }
+
+    DocumentCache::~DocumentCache ()
+    {
+        clear();
+        delete [] myShards;
+    }
+
+    DocumentCache::Handle DocumentCache::get (const char * data,
+                                              std::size_t size)
+    {
+        const unsigned long long key = hash(data, size);
+        Shard& shard = myShards[key % myShardCount];
+        {
+            const Lock lock(shard.mutex);
+            Entry *const entry = shard.find(key, data, size);
+            if (entry != 0)
+            {
+                ++shard.hits;
+                shard.unlink(entry), shard.push(entry);
+                atomic_increment(entry->references);
+                return (Handle(entry));
+            }
+            ++shard.misses;
+        }
+
+        // Parse without holding the lock.
+        Entry * entry = new Entry(key, data, size);
+        Parser parser(entry->document,
+                      entry->payload.data(), entry->payload.size());
+        if (parser.parse() != Parser::complete) {
+            delete entry;
+            throw (std::exception());
+        }
+        entry->bytes = sizeof(Entry)
+            + size + entry->document.statistics().capacity;
+        if (entry->bytes > shard.budget) {
+            return (Handle(entry));
+        }
+
+        std::vector<Entry*> victims;
+        {
+            const Lock lock(shard.mutex);
+            Entry *const existing = shard.find(key, data, size);
+            if (existing != 0)
+            {
+                // Another thread parsed the same payload meanwhile.
+                shard.unlink(existing), shard.push(existing);
+                atomic_increment(existing->references);
+                victims.push_back(entry), entry = existing;
+            }
+            else
+            {
+                atomic_increment(entry->references);
+                shard.index.insert(std::make_pair(key, entry));
+                shard.push(entry), shard.bytes += entry->bytes;
+                while (shard.bytes > shard.budget)
+                {
+                    Entry *const victim = shard.oldest;
+                    shard.remove(victim), ++shard.evictions;
+                    victims.push_back(victim);
+                }
+            }
+        }
+        for (std::size_t i=0; (i < victims.size()); ++i) {
+            release(victims[i]);
+        }
+        return (Handle(entry));
+    }
+
+    DocumentCache::Statistics DocumentCache::statistics () const
+    {
+        Statistics statistics;
+        statistics.hits = statistics.misses = statistics.evictions = 0;
+        statistics.entries = statistics.bytes = 0;
+        for (std::size_t i=0; (i < myShardCount); ++i)
+        {
+            Shard& shard = myShards[i];
+            const Lock lock(shard.mutex);
+            statistics.hits += shard.hits;
+            statistics.misses += shard.misses;
+            statistics.evictions += shard.evictions;
+            statistics.entries += shard.index.size();
+            statistics.bytes += shard.bytes;
+        }
+        return (statistics);
+    }
+
+    void DocumentCache::clear ()
+    {
+        for (std::size_t i=0; (i < myShardCount); ++i)
+        {
+            std::vector<Entry*> victims;
+            {
+                Shard& shard = myShards[i];
+                const Lock lock(shard.mutex);
+                while (shard.oldest != 0)
+                {
+                    Entry *const victim = shard.oldest;
+                    shard.remove(victim);
+                    victims.push_back(victim);
+                }
+            }
+            for (std::size_t j=0; (j < victims.size()); ++j) {
+                release(victims[j]);
+            }
+        }
+    }
+
+}
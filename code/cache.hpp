@@ -0,0 +1,239 @@
+#ifndef _cache_hpp__
+#define _cache_hpp__
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file cache.hpp
+ * @brief Cache of parsed documents, keyed by content.
+ */
+
+#include "json.hpp"
+#include <cstddef>
+#include <string>
+
+namespace json {
+
+    /*!
+     * @brief Thread-safe cache of parsed documents, keyed by content.
+     *
+     * Services that see the same payloads over and over (configuration,
+     * repeated requests) can look them up here instead of parsing them
+     * again.  Payloads are identified by a fast hash of their bytes,
+     * confirmed by a byte-wise comparison, and documents are shared between
+     * all the threads that request the same payload.
+     *
+     * The cache is split in independently locked shards, each of which
+     * evicts its least recently used documents when it goes over its share
+     * of the byte budget.  Evicted documents stay alive until the last
+     * @c Handle to them is released.
+     *
+     * @code
+     *  json::DocumentCache cache(64*1024*1024);
+     *  const json::DocumentCache::Handle document = cache.get(body);
+     *  const json::Map request(document->root());
+     * @endcode
+     */
+    class DocumentCache
+    {
+        /* nested types. */
+    private:
+        struct Entry;
+        struct Shard;
+
+    public:
+        /*!
+         * @brief Shared, read-only reference to a cached document.
+         *
+         * @note Documents obtained from the cache are shared between threads
+         *  and must not be modified.
+         */
+        class Handle
+        {
+            /* data. */
+        private:
+            Entry * myEntry;
+
+            /* construction. */
+        public:
+            /*!
+             * @brief Create a handle that refers to no document.
+             */
+            Handle ();
+
+            /*!
+             * @brief Share the document referred to by @a other.
+             */
+            Handle (const Handle& other);
+
+        private:
+            explicit Handle (Entry * entry);
+
+        public:
+            /*!
+             * @brief Release the reference to the document.
+             */
+            ~Handle ();
+
+            /* methods. */
+        public:
+            /*!
+             * @brief Checks if the handle refers to no document.
+             */
+            bool is_null () const {
+                return (myEntry == 0);
+            }
+
+            /* operators. */
+        public:
+            /*!
+             * @brief Share the document referred to by @a other.
+             */
+            Handle& operator= (const Handle& other);
+
+            /*!
+             * @brief Access the document.
+             * @pre is_null() == false
+             */
+            const Document& operator* () const;
+
+            /*!
+             * @brief Access the document.
+             * @pre is_null() == false
+             */
+            const Document * operator-> () const;
+
+            /* friends. */
+        private:
+            friend class DocumentCache;
+        };
+
+        /*!
+         * @brief Cache activity report.
+         *
+         * @see statistics()
+         */
+        struct Statistics
+        {
+            /*!
+             * @brief Number of lookups that found a cached document.
+             */
+            unsigned long long hits;
+
+            /*!
+             * @brief Number of lookups that had to parse the payload.
+             */
+            unsigned long long misses;
+
+            /*!
+             * @brief Number of documents evicted to honor the byte budget.
+             */
+            unsigned long long evictions;
+
+            /*!
+             * @brief Number of documents currently in the cache.
+             */
+            std::size_t entries;
+
+            /*!
+             * @brief Number of bytes currently charged to the cache.
+             */
+            std::size_t bytes;
+        };
+
+        /* data. */
+    private:
+        Shard * myShards;
+        std::size_t myShardCount;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Create an empty cache.
+         * @param budget Maximum number of bytes charged to cached documents
+         *  (payload bytes plus the parsed document's memory).
+         * @param shards Number of independently locked partitions.  Use at
+         *  least as many as there are threads hitting the cache.
+         */
+        explicit DocumentCache (std::size_t budget, std::size_t shards=16);
+
+    private:
+        DocumentCache (const DocumentCache&);
+
+    public:
+        /*!
+         * @brief Release the cache's references to all documents.
+         */
+        ~DocumentCache ();
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Obtain the document for @a size bytes of JSON at @a data,
+         *  parsing it only if it is not in the cache already.
+         * @param data Serialized JSON document.
+         * @param size Size of @a data, in bytes.
+         * @return A handle to the shared document.
+         *
+         * @throw std::exception @a data is not a valid JSON document.
+         *
+         * @note Payloads larger than a shard's share of the budget are parsed
+         *  but not cached.
+         */
+        Handle get (const char * data, std::size_t size);
+
+        /*!
+         * @brief Obtain the document for the JSON in @a text.
+         *
+         * @see get(const char*, std::size_t)
+         */
+        Handle get (const std::string& text) {
+            return (get(text.data(), text.size()));
+        }
+
+        /*!
+         * @brief Report activity counters and current usage.
+         */
+        Statistics statistics () const;
+
+        /*!
+         * @brief Release the cache's references to all documents.
+         */
+        void clear ();
+
+        /* operators. */
+    private:
+        DocumentCache& operator= (const DocumentCache&);
+
+        /* friends. */
+    private:
+        friend class Handle;
+    };
+
+}
+
+#endif /* _cache_hpp__ */
@@ -0,0 +1,370 @@
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file csv.cpp
+ * @brief CSV and TSV export of records.
+ */
+
+#include "csv.hpp"
+
+#include <cstring>
+#include <ostream>
+#include <sstream>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#   define JSONXX_SSE2
+#   include <emmintrin.h>
+#endif
+
+namespace {
+
+    bool space (char c)
+    {
+        return ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r'));
+    }
+
+    // Size of the list item starting at `data`: bytes up to the next comma
+    // or closing bracket outside strings and nested lists and maps.
+    std::size_t item (const char * data, std::size_t size)
+    {
+        int depth = 0;
+        bool quoted = false;
+        for (std::size_t i=0; (i < size); ++i)
+        {
+            const char c = data[i];
+            if (quoted) {
+                i += (c == '\\')? 1 : 0, quoted = (c != '"');
+            }
+            else if (c == '"') {
+                quoted = true;
+            }
+            else if ((c == '[') || (c == '{')) {
+                ++depth;
+            }
+            else if ((c == ']') || (c == '}')) {
+                if (depth-- == 0) {
+                    return (i);
+                }
+            }
+            else if ((c == ',') && (depth == 0)) {
+                return (i);
+            }
+        }
+        return (size);
+    }
+
+    // Check that a cell needs neither quotes nor escapes.  With SSE2, test
+    // 16 bytes at a time for the separator, the escape character and line
+    // breaks.
+    bool plain (const char * data, std::size_t size,
+                char separator, char escape)
+    {
+        std::size_t i = 0;
+#ifdef JSONXX_SSE2
+        const __m128i separators = _mm_set1_epi8(separator);
+        const __m128i escapes = _mm_set1_epi8(escape);
+        const __m128i newlines = _mm_set1_epi8('\n');
+        const __m128i returns = _mm_set1_epi8('\r');
+        for (; (i+16 <= size); i += 16)
+        {
+            const __m128i chunk = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(data+i));
+            const __m128i hits = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, separators),
+                             _mm_cmpeq_epi8(chunk, escapes)),
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, newlines),
+                             _mm_cmpeq_epi8(chunk, returns)));
+            if (_mm_movemask_epi8(hits) != 0) {
+                return (false);
+            }
+        }
+#endif
+        for (; (i < size); ++i)
+        {
+            const char c = data[i];
+            if ((c == separator) || (c == escape) ||
+                (c == '\n') || (c == '\r'))
+            {
+                return (false);
+            }
+        }
+        return (true);
+    }
+
+}
+
+namespace json {
+
+    const std::size_t Csv::buffer_size;
+
+    Csv::Csv (std::ostream& stream, const std::string& columns,
+              char separator, const Expression * filter)
+        : myStream(stream)
+        , myColumns(columns)
+        , mySeparator(separator)
+        , myFilter(filter)
+        , myPositions(myColumns.size(), -1)
+        , myBuffer(buffer_size)
+        , myUsed(0)
+    {
+        const Statistics statistics = { 0, 0, 0 };
+        myStatistics = statistics;
+    }
+
+    Csv::~Csv ()
+    {
+        flush();
+    }
+
+    void Csv::header ()
+    {
+        for (std::size_t i=0; (i < myColumns.size()); ++i)
+        {
+            if (i > 0) {
+                put(&mySeparator, 1);
+            }
+            const std::string name = myColumns.name(i);
+            text(name.data(), name.size());
+        }
+        put("\n", 1);
+    }
+
+    void Csv::write (const Any& record)
+    {
+        ::cJSON *const root = record.data();
+        const bool map = (root != 0) && ((root->type & 255) == cJSON_Object);
+        if (map) {
+            shape(root);
+        }
+        for (std::size_t i=0; (i < myColumns.size()); ++i)
+        {
+            if (i > 0) {
+                put(&mySeparator, 1);
+            }
+            const Path& path = myColumns.path(i);
+            if ((path.size() == 0) || (path.step(0).index >= 0)) {
+                cell(path.resolve(root));
+            }
+            else if (map && (myPositions[i] >= 0)) {
+                cell(path.resolve(myMembers[myPositions[i]], 1));
+            }
+        }
+        put("\n", 1);
+        ++myStatistics.rows;
+    }
+
+    void Csv::write (const char * data, std::size_t size)
+    {
+        Arena arena;
+        std::size_t i = 0;
+        while ((i < size) && space(data[i])) {
+            ++i;
+        }
+        if ((i < size) && (data[i] == '['))
+        {
+            // Split the list into items without parsing it whole.
+            for (++i; (i < size); )
+            {
+                while ((i < size) && space(data[i])) {
+                    ++i;
+                }
+                if ((i == size) || (data[i] == ']')) {
+                    break;
+                }
+                const std::size_t length = item(data+i, size-i);
+                row(data+i, length, arena), i += length;
+                if ((i < size) && (data[i] == ',')) {
+                    ++i;
+                }
+                else if ((i < size) && (data[i] != ']')) {
+                    ++myStatistics.invalid;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            const char *const last = data + size;
+            std::size_t length = 0;
+            for (const char * line = data+i; (line < last); line += length+1)
+            {
+                const char *const end = static_cast<const char*>(
+                    std::memchr(line, '\n', last-line));
+                length = ((end == 0)? last : end) - line;
+                std::size_t used = length;
+                while ((used > 0) && space(line[used-1])) {
+                    --used;
+                }
+                if (used > 0) {
+                    row(line, used, arena);
+                }
+            }
+        }
+        flush();
+    }
+
+    void Csv::flush ()
+    {
+        myStream.write(&myBuffer[0], myUsed);
+        myUsed = 0;
+    }
+
+    // Locate each column's first key among the members of `record`, unless
+    // it has the same keys, in the same order, as the previous record.
+    void Csv::shape (::cJSON * record)
+    {
+        myMembers.clear();
+        bool same = true;
+        std::size_t offset = 0;
+        for (::cJSON * member = record->child;
+             (member != 0); member = member->next)
+        {
+            myMembers.push_back(member);
+            if (same)
+            {
+                const std::size_t size = std::strlen(member->string) + 1;
+                same = (offset+size <= myShape.size()) && (std::memcmp(
+                    myShape.data()+offset, member->string, size) == 0);
+                offset += size;
+            }
+        }
+        if (same && (offset == myShape.size())) {
+            return;
+        }
+        myShape.clear();
+        for (std::size_t j=0; (j < myMembers.size()); ++j) {
+            myShape.append(myMembers[j]->string,
+                           std::strlen(myMembers[j]->string) + 1);
+        }
+        for (std::size_t i=0; (i < myColumns.size()); ++i)
+        {
+            const Path& path = myColumns.path(i);
+            myPositions[i] = -1;
+            if ((path.size() == 0) || (path.step(0).index >= 0)) {
+                continue;
+            }
+            const char *const key = path.step(0).key.c_str();
+            for (std::size_t j=0; (j < myMembers.size()); ++j)
+            {
+                if (std::strcmp(myMembers[j]->string, key) == 0) {
+                    myPositions[i] = static_cast<int>(j);
+                    break;
+                }
+            }
+        }
+    }
+
+    void Csv::cell (const ::cJSON * value)
+    {
+        const int type = (value == 0)? cJSON_NULL : (value->type & 255);
+        if (type == cJSON_False) {
+            put("false", 5);
+        }
+        else if (type == cJSON_True) {
+            put("true", 4);
+        }
+        else if (type == cJSON_Number)
+        {
+            char number[32];
+            put(number, format(value->valuedouble, number));
+        }
+        else if (type == cJSON_String) {
+            text(value->valuestring, std::strlen(value->valuestring));
+        }
+        else if (type != cJSON_NULL)
+        {
+            std::ostringstream json;
+            json << Any(const_cast< ::cJSON*>(value));
+            const std::string compact = json.str();
+            text(compact.data(), compact.size());
+        }
+    }
+
+    // Write a cell, quoted (CSV) or escaped (TSV) if needed.
+    void Csv::text (const char * data, std::size_t size)
+    {
+        const bool tabs = (mySeparator == '\t');
+        if (plain(data, size, mySeparator, tabs? '\\' : '"')) {
+            put(data, size);
+            return;
+        }
+        if (!tabs) {
+            put("\"", 1);
+        }
+        std::size_t run = 0;
+        for (std::size_t i=0; (i < size); ++i)
+        {
+            const char c = data[i];
+            if (!tabs && (c == '"')) {
+                put(data+run, i+1-run), run = i;
+            }
+            else if (tabs && ((c == '\t') || (c == '\\') ||
+                              (c == '\n') || (c == '\r')))
+            {
+                put(data+run, i-run), run = i+1;
+                put((c == '\t')? "\\t" : (c == '\\')? "\\\\" :
+                    (c == '\n')? "\\n" : "\\r", 2);
+            }
+        }
+        put(data+run, size-run);
+        if (!tabs) {
+            put("\"", 1);
+        }
+    }
+
+    void Csv::put (const char * data, std::size_t size)
+    {
+        if (size > (myBuffer.size() - myUsed))
+        {
+            flush();
+            if (size > myBuffer.size()) {
+                myStream.write(data, size);
+                return;
+            }
+        }
+        std::memcpy(&myBuffer[myUsed], data, size);
+        myUsed += size;
+    }
+
+    void Csv::row (const char * data, std::size_t size, Arena& arena)
+    {
+        Parser parser(arena, data, size);
+        if (parser.parse() != Parser::complete) {
+            ++myStatistics.invalid;
+        }
+        else if ((myFilter != 0) && !myFilter->matches(Any(parser.root())))
+        {
+            ++myStatistics.skipped;
+        }
+        else {
+            write(Any(parser.root()));
+        }
+        arena.clear();
+    }
+
+}
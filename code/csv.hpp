@@ -0,0 +1,190 @@
+#ifndef _csv_hpp__
+#define _csv_hpp__
+
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file csv.hpp
+ * @brief CSV and TSV export of records.
+ */
+
+#include "json.hpp"
+#include "query.hpp"
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace json {
+
+    /*!
+     * @brief Write records as rows of comma or tab separated values.
+     *
+     * Columns are paths into each record, as in a @c Projection.  Records
+     * of the same shape (the same keys, in the same order) are common, so
+     * the position of each column's first key among a record's members is
+     * looked up once per shape rather than once per row.
+     *
+     * Missing values and @c null are empty cells; numbers are spelled as
+     * by the serializer, and lists and maps as compact JSON.  With commas,
+     * cells holding a comma, quote or line break are quoted (RFC 4180).
+     * With tabs, tabs, line breaks and backslashes are escaped with a
+     * backslash instead.
+     *
+     * Rows are formatted in a fixed size buffer: after the first rows,
+     * writing allocates nothing (unless cells hold lists or maps).
+     *
+     * @code
+     *  json::Csv csv(std::cout, ".id, .user.name, .latency_ms");
+     *  csv.header();
+     *  csv.write(data, size);
+     * @endcode
+     */
+    class Csv
+    {
+        /* nested types. */
+    public:
+        /*!
+         * @brief Export activity report.
+         */
+        struct Statistics
+        {
+            /*!
+             * @brief Number of rows written, without the header.
+             */
+            unsigned long long rows;
+
+            /*!
+             * @brief Number of records skipped because they were not valid
+             *  JSON.
+             */
+            unsigned long long invalid;
+
+            /*!
+             * @brief Number of records skipped by the filter.
+             */
+            unsigned long long skipped;
+        };
+
+        /* class data. */
+    public:
+        /*!
+         * @brief Size of the output buffer.
+         */
+        static const std::size_t buffer_size = 64*1024;
+
+        /* data. */
+    private:
+        std::ostream& myStream;
+        Projection myColumns;
+        char mySeparator;
+        const Expression * myFilter;
+        std::string myShape;
+        std::vector<int> myPositions;
+        std::vector< ::cJSON*> myMembers;
+        std::vector<char> myBuffer;
+        std::size_t myUsed;
+        Statistics myStatistics;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Prepare to write rows to @a stream.
+         * @param stream Output stream.
+         * @param columns Paths to the columns' values, such as
+         *  @c ".id, .user.name".
+         * @param separator @c ',' for CSV or @c '\t' for TSV.
+         * @param filter Optional expression records must satisfy to be
+         *  written by @c write(const char*,std::size_t).  It must outlive
+         *  the writer.
+         *
+         * @throw std::runtime_error The paths are not valid.
+         */
+        Csv (std::ostream& stream, const std::string& columns,
+             char separator=',', const Expression * filter=0);
+
+    private:
+        Csv (const Csv&);
+
+    public:
+        /*!
+         * @brief Flush buffered rows.
+         */
+        ~Csv ();
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Write a row with the columns' names.
+         */
+        void header ();
+
+        /*!
+         * @brief Write the row for one record.
+         */
+        void write (const Any& record);
+
+        /*!
+         * @brief Write the rows for the records in a buffer.
+         * @param data Either a JSON list of records, or NDJSON records.
+         * @param size Size of @a data, in bytes.
+         *
+         * Records are parsed, written and released one at a time, so
+         * memory use does not depend on the number of records.  Records
+         * that are not valid JSON are skipped.
+         */
+        void write (const char * data, std::size_t size);
+
+        /*!
+         * @brief Hand buffered rows to the output stream.
+         */
+        void flush ();
+
+        /*!
+         * @brief Report activity so far.
+         */
+        Statistics statistics () const {
+            return (myStatistics);
+        }
+
+    private:
+        void shape (::cJSON * record);
+        void cell (const ::cJSON * value);
+        void text (const char * data, std::size_t size);
+        void put (const char * data, std::size_t size);
+        void row (const char * data, std::size_t size, Arena& arena);
+
+        /* operators. */
+    private:
+        Csv& operator= (const Csv&);
+    };
+
+}
+
+#endif /* _csv_hpp__ */
@@ -0,0 +1,627 @@
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file edit.cpp
+ * @brief Changes to parsed documents.
+ */
+
+#include "edit.hpp"
+#include "internal.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    // Nodes hold C strings, which would cut one with a NUL short.
+    const char * c_string (const std::string& text)
+    {
+        if (text.find('\0') != std::string::npos) {
+            throw (std::invalid_argument("String holds a NUL character."));
+        }
+        return (text.c_str());
+    }
+
+    using json::internal::Appender;
+
+    bool is_container (const ::cJSON * node)
+    {
+        return ((node->type == cJSON_Array) || (node->type == cJSON_Object));
+    }
+
+    ::cJSON * find (::cJSON * map, const char * key)
+    {
+        ::cJSON * item = map->child;
+        while ((item != 0) && (std::strcmp(item->string, key) != 0)) {
+            item = item->next;
+        }
+        return (item);
+    }
+
+    // Smallest `n` (at least `least`) such that `size` <= 2^n.
+    unsigned int ceiling (std::size_t size, unsigned int least)
+    {
+        unsigned int n = least;
+        while ((std::size_t(1) << n) < size) {
+            ++n;
+        }
+        return (n);
+    }
+
+    // Put `value` in place of `item`, in its parent's list of children.
+    void replace (::cJSON * parent, ::cJSON * item, ::cJSON * value)
+    {
+        value->prev = item->prev;
+        value->next = item->next;
+        if (item->prev != 0) {
+            item->prev->next = value;
+        }
+        else {
+            parent->child = value;
+        }
+        if (item->next != 0) {
+            item->next->prev = value;
+        }
+    }
+
+}
+
+namespace json {
+
+    // Text of a list or map, minus its child lists and maps.
+    struct Editor::Entry
+    {
+        ::cJSON * container;
+        bool dirty;
+        std::string text;
+
+        // Child lists and maps, by offset in `text`.
+        std::vector< std::pair<std::size_t, Entry*> > holes;
+
+        // Next idle entry, once its list or map is removed.
+        Entry * next;
+    };
+
+    // Value of `myRecent` when no record is known to be in use.
+    const std::size_t no_record = std::size_t(-1);
+
+    Editor::Editor (Document& document)
+        : myDocument(document)
+        , myRecords(64)
+        , myUsed(0)
+        , myRecent(no_record)
+        , myContainers(0)
+        , myEntries(0)
+        , myNodes(0)
+        , mySlab(0)
+        , myLeft(0)
+        , mySlabSize(Arena::min_block_size)
+    {
+        const Statistics statistics = { 0, 0, 0 };
+        myStatistics = statistics;
+        const Memory memory = { 0, 0, 0, 0, 0 };
+        myMemory = memory;
+        std::fill(myStrings, myStrings+classes, static_cast<char*>(0));
+        // New nodes come from the arena, so the old ones must too.
+        if (!myDocument.is_empty() &&
+            !myDocument.myArena.owns(myDocument.myData))
+        {
+            myDocument.compact();
+        }
+    }
+
+    Editor::~Editor ()
+    {
+        for (std::size_t i=0; (i < myRecords.size()); ++i) {
+            delete myRecords[i].entry;
+        }
+        while (myEntries != 0)
+        {
+            Entry *const entry = myEntries;
+            myEntries = entry->next;
+            delete entry;
+        }
+    }
+
+    Any Editor::null ()
+    {
+        return (Any(create(cJSON_NULL)));
+    }
+
+    Any Editor::boolean (bool value)
+    {
+        ::cJSON *const node = create(value? cJSON_True : cJSON_False);
+        node->valueint = value? 1 : 0;
+        return (Any(node));
+    }
+
+    Any Editor::number (double value)
+    {
+        ::cJSON *const node = create(cJSON_Number);
+        node->valuedouble = value;
+        node->valueint = internal::to_int(value);
+        return (Any(node));
+    }
+
+    Any Editor::string (const std::string& value)
+    {
+        char *const text = copy(value);
+        ::cJSON *const node = create(cJSON_String);
+        node->valuestring = text;
+        return (Any(node));
+    }
+
+    List Editor::list ()
+    {
+        return (List(create(cJSON_Array)));
+    }
+
+    Map Editor::map ()
+    {
+        return (Map(create(cJSON_Object)));
+    }
+
+    void Editor::reset (const Any& value)
+    {
+        if (myDocument.myData != 0) {
+            forget(myDocument.myData);
+        }
+        myDocument.myData = value.data();
+    }
+
+    void Editor::set (const Map& map, const std::string& key,
+                      const Any& value)
+    {
+        ::cJSON *const node = value.data();
+        ::cJSON *const item = find(map.data(), c_string(key));
+        if (item != 0) {
+            node->string = item->string, item->string = 0;
+            replace(map.data(), item, node);
+            Record *const record = find_record(map.data());
+            if ((record != 0) && record->counted &&
+                (record->tail.last == item))
+            {
+                record->tail.last = node;
+            }
+            forget(item);
+        }
+        else {
+            node->string = copy(key);
+            append(map.data(), node);
+        }
+        changed(map.data());
+    }
+
+    bool Editor::erase (const Map& map, const std::string& key)
+    {
+        ::cJSON *const item = find(map.data(), c_string(key));
+        if (item == 0) {
+            return (false);
+        }
+        if (item->prev != 0) {
+            item->prev->next = item->next;
+        }
+        else {
+            map.data()->child = item->next;
+        }
+        if (item->next != 0) {
+            item->next->prev = item->prev;
+        }
+        Record *const record = find_record(map.data());
+        if ((record != 0) && record->counted)
+        {
+            if (record->tail.last == item) {
+                record->tail.last = item->prev;
+            }
+            --record->tail.size;
+        }
+        forget(item);
+        changed(map.data());
+        return (true);
+    }
+
+    void Editor::push_back (const List& list, const Any& value)
+    {
+        append(list.data(), value.data());
+        changed(list.data());
+    }
+
+    std::size_t Editor::size (const List& list)
+    {
+        return (tail(list.data()).size);
+    }
+
+    std::size_t Editor::size (const Map& map)
+    {
+        return (tail(map.data()).size);
+    }
+
+    Any Editor::back (const List& list)
+    {
+        ::cJSON *const last = tail(list.data()).last;
+        if (last == 0) {
+            throw (std::exception());
+        }
+        return (Any(last));
+    }
+
+    void Editor::write (std::ostream& stream)
+    {
+        ::cJSON *const root = myDocument.myData;
+        if (root == 0) {
+            return;
+        }
+        if (!is_container(root)) {
+            stream << Any(root); return;
+        }
+        emit(stream, entry(root));
+    }
+
+    Editor::Statistics Editor::statistics () const
+    {
+        Statistics statistics = myStatistics;
+        statistics.containers = myContainers;
+        return (statistics);
+    }
+
+    Editor::Memory Editor::memory () const
+    {
+        return (myMemory);
+    }
+
+    ::cJSON * Editor::create (int type)
+    {
+        ::cJSON * node = myNodes;
+        if (node != 0) {
+            myNodes = node->next, myMemory.idle -= sizeof(::cJSON);
+            ++myMemory.recycled;
+        }
+        else {
+            node = static_cast< ::cJSON*>(
+                myDocument.myArena.allocate(sizeof(::cJSON)));
+            if (node == 0) {
+                throw (std::bad_alloc());
+            }
+        }
+        ++myMemory.allocated;
+        std::memset(node, 0, sizeof(::cJSON));
+        node->type = type;
+        return (node);
+    }
+
+    char * Editor::copy (const std::string& text)
+    {
+        const char *const string = c_string(text);
+        char *const data = block(text.size()+1);
+        std::memcpy(data, string, text.size()+1);
+        return (data);
+    }
+
+    char * Editor::block (std::size_t size)
+    {
+        const unsigned int size_class = ceiling(size, min_class);
+        const std::size_t capacity = std::size_t(1) << size_class;
+        char * data = myStrings[size_class];
+        if (data != 0)
+        {
+            std::memcpy(&myStrings[size_class], data, sizeof(char*));
+            myMemory.idle -= capacity, ++myMemory.recycled;
+        }
+        else if (size_class > slab_class)
+        {
+            data = static_cast<char*>(
+                myDocument.myArena.allocate(capacity, 1));
+            if (data == 0) {
+                throw (std::bad_alloc());
+            }
+            mySlabs[data] = data + capacity;
+        }
+        else
+        {
+            if (myLeft < capacity)
+            {
+                // Keep what is left of the slab, in pieces of each class.
+                for (unsigned int i = slab_class; (i >= min_class); --i)
+                {
+                    if ((myLeft & (std::size_t(1) << i)) != 0) {
+                        store(mySlab, i), mySlab += std::size_t(1) << i;
+                    }
+                }
+                myMemory.abandoned += myLeft & ((1 << min_class)-1);
+                mySlab = static_cast<char*>(
+                    myDocument.myArena.allocate(mySlabSize, 1));
+                if (mySlab == 0) {
+                    myLeft = 0; throw (std::bad_alloc());
+                }
+                mySlabs[mySlab] = mySlab + mySlabSize, myLeft = mySlabSize;
+                mySlabSize = std::min(2*mySlabSize, Arena::max_block_size);
+            }
+            data = mySlab, mySlab += capacity, myLeft -= capacity;
+        }
+        ++myMemory.allocated;
+        myMemory.slack += capacity - size;
+        return (data);
+    }
+
+    void Editor::recycle (::cJSON * node)
+    {
+        if (node->string != 0) {
+            recycle(node->string);
+        }
+        if ((node->type == cJSON_String) && (node->valuestring != 0)) {
+            recycle(node->valuestring);
+        }
+        node->next = myNodes, myNodes = node;
+        myMemory.idle += sizeof(::cJSON);
+    }
+
+    void Editor::recycle (char * string)
+    {
+        const std::size_t size = std::strlen(string) + 1;
+        // Only strings carved by `block()` are known to fill their class.
+        std::map<const char*, const char*>::const_iterator slab =
+            mySlabs.upper_bound(string);
+        if ((slab == mySlabs.begin()) || ((--slab)->second <= string)) {
+            myMemory.abandoned += size; return;
+        }
+        const unsigned int size_class = ceiling(size, min_class);
+        myMemory.slack -= (std::size_t(1) << size_class) - size;
+        store(string, size_class);
+    }
+
+    void Editor::store (char * data, unsigned int size_class)
+    {
+        std::memcpy(data, &myStrings[size_class], sizeof(char*));
+        myStrings[size_class] = data;
+        myMemory.idle += std::size_t(1) << size_class;
+    }
+
+    void Editor::changed (const ::cJSON * container)
+    {
+        Record *const record = find_record(container);
+        if ((record != 0) && (record->entry != 0)) {
+            record->entry->dirty = true;
+        }
+    }
+
+    void Editor::forget (::cJSON * node)
+    {
+        // Nodes are reused, so saved text for the ones that go away must
+        // not be found again.  Nodes left to visit are chained through
+        // their `next` link, which the removed subtree no longer needs.
+        node->next = 0;
+        while (node != 0)
+        {
+            ::cJSON *const container = node;
+            node = node->next;
+            if (is_container(container))
+            {
+                drop(container);
+                if (container->child != 0)
+                {
+                    ::cJSON * last = container->child;
+                    while (last->next != 0) {
+                        last = last->next;
+                    }
+                    last->next = node, node = container->child;
+                }
+            }
+            recycle(container);
+        }
+    }
+
+    std::size_t Editor::slot (const ::cJSON * container) const
+    {
+        const std::size_t mask = myRecords.size() - 1;
+        std::size_t i = hash(&container, sizeof(container)) & mask;
+        while ((myRecords[i].container != 0) &&
+               (myRecords[i].container != container))
+        {
+            i = (i+1) & mask;
+        }
+        return (i);
+    }
+
+    Editor::Record * Editor::find_record (const ::cJSON * container)
+    {
+        // Lists tend to grow one item after another: check the last one
+        // used before searching.
+        if ((myRecent != no_record) &&
+            (myRecords[myRecent].container == container))
+        {
+            return (&myRecords[myRecent]);
+        }
+        const std::size_t i = slot(container);
+        if (myRecords[i].container == 0) {
+            return (0);
+        }
+        myRecent = i;
+        return (&myRecords[i]);
+    }
+
+    Editor::Record& Editor::record (const ::cJSON * container)
+    {
+        Record *const found = find_record(container);
+        if (found != 0) {
+            return (*found);
+        }
+        if (2*(myUsed+1) > myRecords.size()) {
+            grow();
+        }
+        const std::size_t i = slot(container);
+        const Record record = { container, 0, false, { 0, 0 } };
+        myRecords[i] = record, ++myUsed, myRecent = i;
+        return (myRecords[i]);
+    }
+
+    void Editor::drop (const ::cJSON * container)
+    {
+        std::size_t i = slot(container);
+        if (myRecords[i].container == 0) {
+            return;
+        }
+        // Keep the saved text's memory for another list or map.
+        Entry *const entry = myRecords[i].entry;
+        if (entry != 0) {
+            entry->next = myEntries, myEntries = entry;
+            --myContainers;
+        }
+        // Move later records of the run back into the hole, unless that
+        // would put them before their home slot.
+        const std::size_t mask = myRecords.size() - 1;
+        for (std::size_t j = (i+1) & mask;
+             (myRecords[j].container != 0); j = (j+1) & mask)
+        {
+            const std::size_t home =
+                hash(&myRecords[j].container, sizeof(container)) & mask;
+            if ((j > i)? ((home <= i) || (home > j))
+                       : ((home <= i) && (home > j)))
+            {
+                myRecords[i] = myRecords[j], i = j;
+            }
+        }
+        const Record empty = { 0, 0, false, { 0, 0 } };
+        myRecords[i] = empty, --myUsed, myRecent = no_record;
+    }
+
+    void Editor::grow ()
+    {
+        const Record empty = { 0, 0, false, { 0, 0 } };
+        std::vector<Record> records(2*myRecords.size(), empty);
+        records.swap(myRecords);
+        for (std::size_t i=0; (i < records.size()); ++i)
+        {
+            if (records[i].container != 0) {
+                myRecords[slot(records[i].container)] = records[i];
+            }
+        }
+        myRecent = no_record;
+    }
+
+    Editor::Tail& Editor::tail (::cJSON * container)
+    {
+        Record& record = this->record(container);
+        if (!record.counted)
+        {
+            // Count once, then keep up to date.
+            Tail tail = { 0, 0 };
+            for (::cJSON * item = container->child;
+                 (item != 0); item = item->next)
+            {
+                tail.last = item, ++tail.size;
+            }
+            record.tail = tail, record.counted = true;
+        }
+        return (record.tail);
+    }
+
+    void Editor::append (::cJSON * container, ::cJSON * value)
+    {
+        Tail& tail = this->tail(container);
+        if (tail.last == 0) {
+            container->child = value;
+        }
+        else {
+            tail.last->next = value, value->prev = tail.last;
+        }
+        tail.last = value, ++tail.size;
+    }
+
+    Editor::Entry& Editor::entry (::cJSON * container)
+    {
+        Record& record = this->record(container);
+        if (record.entry == 0)
+        {
+            Entry * entry = myEntries;
+            if (entry != 0) {
+                myEntries = entry->next;
+            }
+            else {
+                entry = new Entry();
+            }
+            entry->container = container, entry->dirty = true;
+            entry->next = 0;
+            record.entry = entry, ++myContainers;
+        }
+        return (*record.entry);
+    }
+
+    void Editor::rebuild (Entry& entry)
+    {
+        entry.text.clear(), entry.holes.clear();
+        Appender buffer(entry.text);
+        std::ostream stream(&buffer);
+        const bool map = (entry.container->type == cJSON_Object);
+        entry.text.push_back(map? '{' : '[');
+        for (::cJSON * item = entry.container->child;
+             (item != 0); item = item->next)
+        {
+            if (item != entry.container->child) {
+                entry.text.push_back(',');
+            }
+            if (map)
+            {
+                write_string(stream, item->string);
+                entry.text.push_back(':');
+            }
+            if (is_container(item)) {
+                entry.holes.push_back(std::make_pair(
+                    entry.text.size(), &this->entry(item)));
+            }
+            else {
+                stream << Any(item);
+            }
+        }
+        entry.text.push_back(map? '}' : ']');
+        entry.dirty = false;
+    }
+
+    void Editor::emit (std::ostream& stream, Entry& entry)
+    {
+        if (entry.dirty) {
+            rebuild(entry), ++myStatistics.rebuilt;
+        }
+        else {
+            ++myStatistics.reused;
+        }
+        std::size_t offset = 0;
+        for (std::size_t i=0; (i < entry.holes.size()); ++i)
+        {
+            const std::size_t next = entry.holes[i].first;
+            stream.write(entry.text.data()+offset, next-offset);
+            emit(stream, *entry.holes[i].second);
+            offset = next;
+        }
+        stream.write(entry.text.data()+offset, entry.text.size()-offset);
+    }
+
+}
@@ -0,0 +1,356 @@
+#ifndef _edit_hpp__
+#define _edit_hpp__
+
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file edit.hpp
+ * @brief Changes to parsed documents.
+ */
+
+#include "json.hpp"
+
+#include <cstddef>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace json {
+
+    /*!
+     * @brief Changes a document in place, and serializes it again at a
+     *  cost that tracks the changes rather than the document's size.
+     *
+     * New values are allocated in the document's arena, then attached to
+     * lists and maps.  All changes to the document must go through the
+     * editor, so it knows which lists and maps changed.
+     *
+     * @c write() keeps, for each list and map, the text between its child
+     * lists and maps, with holes where they go.  A change only marks the
+     * list or map it was made to as dirty: writing the document again
+     * spells the dirty ones' own members, and copies all the rest from
+     * the previous pass.
+     *
+     * The editor also keeps the last item and the number of items of each
+     * list and map it changed or was asked about, so @c push_back(),
+     * @c size() and @c back() take constant time however long the list
+     * grows.  cJSON lists only link to their first item: without this,
+     * building a list one item at a time takes quadratic time.
+     *
+     * Removed values are recycled: their nodes and strings go to free
+     * lists, strings by power-of-two size class, and later values reuse
+     * them.  The saved text of removed lists and maps is kept for others
+     * to reuse too, and the table of lists and maps never shrinks.  A
+     * document that keeps changing stops growing its arena, and stops
+     * allocating from the heap, once the free lists and the table cover
+     * the churn.
+     *
+     * @code
+     *  json::Document document(state);
+     *  json::Editor editor(document);
+     *  const json::Map counters = json::Map(document)["counters"];
+     *  editor.set(counters, "requests", editor.number(42));
+     *  editor.write(stream);
+     * @endcode
+     *
+     * @note Documents parsed by @c Document(const std::string&) are moved
+     *  to their arena with @c Document::compact() first.
+     * @warning Do not call @c Document::compact() while an editor is
+     *  attached to the document.
+     */
+    class Editor
+    {
+        /* nested types. */
+    public:
+        /*!
+         * @brief Counts of work done by @c write().
+         */
+        struct Statistics
+        {
+            /*!
+             * @brief Number of lists and maps with saved text.
+             */
+            std::size_t containers;
+
+            /*!
+             * @brief Number of times a list or map was spelled again.
+             */
+            unsigned long long rebuilt;
+
+            /*!
+             * @brief Number of times the saved text of a list or map was
+             *  used as it was.
+             */
+            unsigned long long reused;
+        };
+
+        /*!
+         * @brief Reuse of the memory of removed values.
+         *
+         * The reuse rate is @c recycled / @c allocated.  Bytes counted in
+         * @c idle, @c slack and @c abandoned are part of the document's
+         * arena but hold no value: compare their sum to the @c size
+         * reported by @c Document::statistics() to gauge fragmentation.
+         */
+        struct Memory
+        {
+            /*!
+             * @brief Number of nodes and strings created by the editor.
+             */
+            unsigned long long allocated;
+
+            /*!
+             * @brief Number of those that reused the memory of removed
+             *  ones.
+             */
+            unsigned long long recycled;
+
+            /*!
+             * @brief Number of bytes of removed nodes and strings, waiting
+             *  to be reused.
+             */
+            std::size_t idle;
+
+            /*!
+             * @brief Number of bytes lost to rounding the size of strings
+             *  up to their size class.
+             */
+            std::size_t slack;
+
+            /*!
+             * @brief Number of bytes of removed strings that cannot be
+             *  reused: those that were parsed, rather than created by the
+             *  editor, are not sized to a class.
+             */
+            std::size_t abandoned;
+        };
+
+    private:
+        struct Entry;
+
+        // Last item and number of items of a list or map.
+        struct Tail
+        {
+            ::cJSON * last;
+            std::size_t size;
+        };
+
+        // What the editor knows about a list or map.
+        struct Record
+        {
+            const ::cJSON * container;
+            Entry * entry;
+            bool counted;
+            Tail tail;
+        };
+
+        /* class data. */
+    private:
+        // Strings take 2^n bytes, 2^min_class at least.  Classes up to
+        // slab_class are carved from slabs; larger strings get their own.
+        static const unsigned int min_class = 4;
+        static const unsigned int slab_class = 16;
+        static const unsigned int classes = 8 * sizeof(std::size_t);
+
+        /* data. */
+    private:
+        Document& myDocument;
+        // Open addressing with linear probing, by container.
+        std::vector<Record> myRecords;
+        std::size_t myUsed;
+        std::size_t myRecent;
+        std::size_t myContainers;
+        Entry * myEntries;
+        Statistics myStatistics;
+        ::cJSON * myNodes;
+        char * myStrings[classes];
+        std::map<const char*, const char*> mySlabs;
+        char * mySlab;
+        std::size_t myLeft;
+        std::size_t mySlabSize;
+        Memory myMemory;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Prepare to change @a document.
+         *
+         * @throw std::bad_alloc The document could not be moved to its
+         *  arena.
+         */
+        explicit Editor (Document& document);
+
+    private:
+        Editor (const Editor&);
+
+    public:
+        /*!
+         * @brief Release the saved text.
+         */
+        ~Editor ();
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Create a detached @c null value.
+         */
+        Any null ();
+
+        /*!
+         * @brief Create a detached boolean value.
+         */
+        Any boolean (bool value);
+
+        /*!
+         * @brief Create a detached number.
+         */
+        Any number (double value);
+
+        /*!
+         * @brief Create a detached string.
+         *
+         * @throw std::invalid_argument @a value holds a NUL character.
+         */
+        Any string (const std::string& value);
+
+        /*!
+         * @brief Create a detached, empty list.
+         */
+        List list ();
+
+        /*!
+         * @brief Create a detached, empty map.
+         */
+        Map map ();
+
+        /*!
+         * @brief Make @a value the document's root value.
+         * @param value Detached value created by this editor.
+         *
+         * @note The previous root value can no longer be used.
+         */
+        void reset (const Any& value);
+
+        /*!
+         * @brief Set the member of @a map named @a key (with a case
+         *  sensitive comparison) to @a value.
+         * @param map Map in the document.
+         * @param key Name of the member.  A new member is added at the end
+         *  if there is none by that name yet.
+         * @param value Detached value created by this editor.
+         *
+         * @throw std::invalid_argument @a key holds a NUL character.
+         * @note The previous value, if any, can no longer be used.
+         */
+        void set (const Map& map, const std::string& key, const Any& value);
+
+        /*!
+         * @brief Remove the member of @a map named @a key.
+         * @return @c false if @a map has no member named @a key.
+         *
+         * @throw std::invalid_argument @a key holds a NUL character.
+         * @note The removed value can no longer be used.
+         */
+        bool erase (const Map& map, const std::string& key);
+
+        /*!
+         * @brief Append @a value to @a list.
+         * @param list List in the document.
+         * @param value Detached value created by this editor.
+         */
+        void push_back (const List& list, const Any& value);
+
+        /*!
+         * @brief Obtain the number of items in @a list.
+         *
+         * Unlike @c List::size(), this only counts the items the first
+         * time the editor sees @a list.
+         */
+        std::size_t size (const List& list);
+
+        /*!
+         * @brief Obtain the number of members in @a map.
+         *
+         * The members are only counted the first time the editor sees
+         * @a map.
+         */
+        std::size_t size (const Map& map);
+
+        /*!
+         * @brief Access the last item of @a list.
+         * @throw std::exception @a list is empty.
+         */
+        Any back (const List& list);
+
+        /*!
+         * @brief Serialize the document's root value.
+         *
+         * The text is the same as @c operator<< writes.  Lists and maps
+         * that didn't change since the last call are not spelled again.
+         */
+        void write (std::ostream& stream);
+
+        /*!
+         * @brief Report work done by @c write() so far.
+         */
+        Statistics statistics () const;
+
+        /*!
+         * @brief Report how much memory of removed values was reused.
+         */
+        Memory memory () const;
+
+    private:
+        ::cJSON * create (int type);
+        char * copy (const std::string& text);
+        char * block (std::size_t size);
+        void recycle (::cJSON * node);
+        void recycle (char * string);
+        void store (char * data, unsigned int size_class);
+        void changed (const ::cJSON * container);
+        void forget (::cJSON * node);
+        std::size_t slot (const ::cJSON * container) const;
+        Record * find_record (const ::cJSON * container);
+        Record& record (const ::cJSON * container);
+        void drop (const ::cJSON * container);
+        void grow ();
+        Tail& tail (::cJSON * container);
+        void append (::cJSON * container, ::cJSON * value);
+        Entry& entry (::cJSON * container);
+        void rebuild (Entry& entry);
+        void emit (std::ostream& stream, Entry& entry);
+
+        /* operators. */
+    private:
+        Editor& operator= (const Editor&);
+    };
+
+}
+
+#endif /* _edit_hpp__ */
@@ -0,0 +1,267 @@
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file gather.cpp
+ * @brief Serialization to a list of buffers, for gathered writes.
+ */
+
+#include "gather.hpp"
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#   define JSONXX_SSE2
+#   include <emmintrin.h>
+#endif
+
+namespace {
+
+#ifdef IOV_MAX
+    const std::size_t max_vectors = IOV_MAX;
+#else
+    const std::size_t max_vectors = 16;
+#endif
+
+    bool special (unsigned char c)
+    {
+        return ((c < 0x20) || (c == '"') || (c == '\\'));
+    }
+
+    // Length of the run of characters at `data` that need no escaping.
+    // With SSE2, test 16 bytes at a time for quotes, backslashes and
+    // control characters.
+    std::size_t plain (const char * data, std::size_t size)
+    {
+        std::size_t i = 0;
+#ifdef JSONXX_SSE2
+        const __m128i quotes = _mm_set1_epi8('"');
+        const __m128i backslashes = _mm_set1_epi8('\\');
+        const __m128i controls = _mm_set1_epi8(0x1f);
+        for (; (i+16 <= size); i += 16)
+        {
+            const __m128i chunk = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(data+i));
+            const __m128i hits = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quotes),
+                             _mm_cmpeq_epi8(chunk, backslashes)),
+                _mm_cmpeq_epi8(_mm_max_epu8(chunk, controls), controls));
+            if (_mm_movemask_epi8(hits) != 0) {
+                break;
+            }
+        }
+#endif
+        while ((i < size) && !special(data[i])) {
+            ++i;
+        }
+        return (i);
+    }
+
+}
+
+namespace json {
+
+    const std::size_t Gather::default_threshold;
+
+    Gather::Gather (std::size_t threshold)
+        : myThreshold(threshold)
+        , mySize(0)
+        , myReferenced(0)
+    {
+    }
+
+    void Gather::write (const Any& value)
+    {
+        ::cJSON *const node = value.data();
+        if (value.is_null()) {
+            copy("null", 4);
+        }
+        else if (value.is_bool()) {
+            bool(value)? copy("true", 4) : copy("false", 5);
+        }
+        else if (value.is_number())
+        {
+            char text[32];
+            copy(text, format(double(value), text));
+        }
+        else if (value.is_string()) {
+            string(node->valuestring);
+        }
+        else if (value.is_list())
+        {
+            copy("[", 1);
+            for (::cJSON * item = node->child; (item != 0); item = item->next)
+            {
+                write(Any(item));
+                if (item->next != 0) {
+                    copy(",", 1);
+                }
+            }
+            copy("]", 1);
+        }
+        else if (value.is_map())
+        {
+            copy("{", 1);
+            for (::cJSON * item = node->child; (item != 0); item = item->next)
+            {
+                string(item->string), copy(":", 1), write(Any(item));
+                if (item->next != 0) {
+                    copy(",", 1);
+                }
+            }
+            copy("}", 1);
+        }
+    }
+
+    void Gather::write (const char * data, std::size_t size)
+    {
+        copy(data, size);
+    }
+
+    const std::vector<::iovec>& Gather::vectors ()
+    {
+        // The buffer may have moved since the pieces were added.
+        myVectors.resize(myPieces.size());
+        for (std::size_t i=0; (i < myPieces.size()); ++i)
+        {
+            const Piece& piece = myPieces[i];
+            myVectors[i].iov_base = const_cast<char*>(
+                (piece.data == 0)? myBuffer.data()+piece.offset : piece.data);
+            myVectors[i].iov_len = piece.size;
+        }
+        return (myVectors);
+    }
+
+    void Gather::send (int descriptor)
+    {
+        vectors();
+        ::iovec * next = myVectors.empty()? 0 : &myVectors[0];
+        ::iovec *const last = next + myVectors.size();
+        while (next < last)
+        {
+            const int count = int(std::min<std::size_t>(
+                last-next, max_vectors));
+            const ::ssize_t size = ::writev(descriptor, next, count);
+            if (size < 0)
+            {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw (std::runtime_error(
+                    std::string("Could not write: ")+std::strerror(errno)));
+            }
+            // Skip what was written, and resume in the middle of a buffer
+            // on partial writes.
+            for (std::size_t left = size; (next < last);)
+            {
+                if (left < next->iov_len)
+                {
+                    next->iov_base = static_cast<char*>(next->iov_base)+left;
+                    next->iov_len -= left;
+                    break;
+                }
+                left -= next->iov_len, ++next;
+            }
+        }
+        clear();
+    }
+
+    void Gather::clear ()
+    {
+        myBuffer.clear();
+        myPieces.clear();
+        myVectors.clear();
+        mySize = myReferenced = 0;
+    }
+
+    void Gather::copy (const char * data, std::size_t size)
+    {
+        if (myPieces.empty() || (myPieces.back().data != 0))
+        {
+            const Piece piece = { 0, myBuffer.size(), 0 };
+            myPieces.push_back(piece);
+        }
+        myBuffer.append(data, size);
+        myPieces.back().size += size, mySize += size;
+    }
+
+    void Gather::refer (const char * data, std::size_t size)
+    {
+        const Piece piece = { data, 0, size };
+        myPieces.push_back(piece);
+        mySize += size, myReferenced += size;
+    }
+
+    void Gather::string (const char * text)
+    {
+        static const char hex[] = "0123456789abcdef";
+        copy("\"", 1);
+        const char *const last = text + std::strlen(text);
+        while (text < last)
+        {
+            const std::size_t size = plain(text, last-text);
+            if (size >= myThreshold) {
+                refer(text, size);
+            }
+            else if (size > 0) {
+                copy(text, size);
+            }
+            if ((text += size) == last) {
+                break;
+            }
+            const unsigned char c = *text++;
+            switch (c)
+            {
+                case '"': copy("\\\"", 2); break;
+                case '\\': copy("\\\\", 2); break;
+                case '\b': copy("\\b", 2); break;
+                case '\f': copy("\\f", 2); break;
+                case '\n': copy("\\n", 2); break;
+                case '\r': copy("\\r", 2); break;
+                case '\t': copy("\\t", 2); break;
+                default: {
+                    const char escape[] = {
+                        '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]
+                    };
+                    copy(escape, sizeof(escape));
+                }
+            }
+        }
+        copy("\"", 1);
+    }
+
+}
+
+#endif
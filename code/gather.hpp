@@ -0,0 +1,177 @@
+#ifndef _gather_hpp__
+#define _gather_hpp__
+
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file gather.hpp
+ * @brief Serialization to a list of buffers, for gathered writes.
+ */
+
+#include "json.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+
+#include <sys/uio.h>
+
+namespace json {
+
+    /*!
+     * @brief Serializer that produces an @c iovec list instead of a copy
+     *  of the whole text.
+     *
+     * Punctuation, numbers, short strings and escape sequences go to a
+     * small buffer, but long runs of string characters that need no
+     * escaping are referenced where they are, in the document.  Sending
+     * the output with @c writev() (or @c sendmsg()) then never copies the
+     * bulk of large strings such as embedded blobs or HTML pages.
+     *
+     * @code
+     *  json::Gather output;
+     *  output.write(document.root());
+     *  output.send(socket);
+     * @endcode
+     *
+     * @note The output refers to the document's strings, so the document
+     *  must not change nor go away until the output is sent or cleared.
+     */
+    class Gather
+    {
+        /* nested types. */
+    private:
+        struct Piece
+        {
+            // In the buffer when null, else in the document.
+            const char * data;
+            std::size_t offset;
+            std::size_t size;
+        };
+
+        /* class data. */
+    public:
+        /*!
+         * @brief Default length from which runs of string characters are
+         *  referenced rather than copied.
+         */
+        static const std::size_t default_threshold = 1024;
+
+        /* data. */
+    private:
+        std::size_t myThreshold;
+        std::string myBuffer;
+        std::vector<Piece> myPieces;
+        std::vector<::iovec> myVectors;
+        std::size_t mySize;
+        std::size_t myReferenced;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Prepare an empty output.
+         * @param threshold Length from which runs of string characters are
+         *  referenced in place.  Below some hundred bytes, an extra
+         *  @c iovec costs more than copying.
+         */
+        explicit Gather (std::size_t threshold=default_threshold);
+
+    private:
+        Gather (const Gather&);
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Append the compact serialization of @a value.
+         *
+         * The text is the same as @c operator<<(std::ostream&,const Any&)
+         * writes.
+         */
+        void write (const Any& value);
+
+        /*!
+         * @brief Append raw bytes, such as a line break, to the output.
+         */
+        void write (const char * data, std::size_t size);
+
+        /*!
+         * @brief Obtain the output as a list of buffers.
+         *
+         * @note The list is only valid until the next call to @c write()
+         *  or @c clear().  It may be longer than @c IOV_MAX.
+         */
+        const std::vector<::iovec>& vectors ();
+
+        /*!
+         * @brief Obtain the size of the output, in bytes.
+         */
+        std::size_t size () const {
+            return (mySize);
+        }
+
+        /*!
+         * @brief Obtain the number of bytes referenced in the document,
+         *  rather than copied.
+         */
+        std::size_t referenced () const {
+            return (myReferenced);
+        }
+
+        /*!
+         * @brief Write the whole output to @a descriptor with @c writev(),
+         *  then clear it.
+         *
+         * Partial writes are resumed, so @a descriptor should be in
+         * blocking mode.
+         *
+         * @throw std::runtime_error The output could not be written.
+         */
+        void send (int descriptor);
+
+        /*!
+         * @brief Forget the output, to start over.
+         */
+        void clear ();
+
+    private:
+        void copy (const char * data, std::size_t size);
+        void refer (const char * data, std::size_t size);
+        void string (const char * text);
+
+        /* operators. */
+    private:
+        Gather& operator= (const Gather&);
+    };
+
+}
+
+#endif
+
+#endif /* _gather_hpp__ */
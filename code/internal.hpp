@@ -0,0 +1,111 @@
+#ifndef _internal_hpp__
+#define _internal_hpp__
+
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file internal.hpp
+ * @brief Helpers shared by the library's sources, not part of its
+ *  interface.
+ */
+
+#include <climits>
+#include <streambuf>
+#include <string>
+
+namespace json { namespace internal {
+
+    // cJSON keeps an int copy of each number, which it gets with (int)n.
+    // That is undefined for numbers out of range: saturate them instead.
+    inline int to_int (double value)
+    {
+        if (value != value) {
+            return (0);
+        }
+        if (value >= INT_MAX) {
+            return (INT_MAX);
+        }
+        if (value <= INT_MIN) {
+            return (INT_MIN);
+        }
+        return (static_cast<int>(value));
+    }
+
+    // Stream buffer that appends to a string, without buffering of its
+    // own: writes through the stream and to the string directly can be
+    // interleaved.
+    class Appender :
+        public std::streambuf
+    {
+        /* data. */
+    private:
+        std::string * myOutput;
+
+        /* construction. */
+    public:
+        Appender ()
+            : myOutput(0)
+        {}
+
+        explicit Appender (std::string& output)
+            : myOutput(&output)
+        {}
+
+    private:
+        Appender (const Appender&);
+
+        /* methods. */
+    public:
+        void target (std::string& output) {
+            myOutput = &output;
+        }
+
+    protected:
+        virtual int_type overflow (int_type c)
+        {
+            if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                myOutput->push_back(traits_type::to_char_type(c));
+            }
+            return (traits_type::not_eof(c));
+        }
+
+        virtual std::streamsize xsputn (const char * data,
+                                        std::streamsize size)
+        {
+            myOutput->append(data, size);
+            return (size);
+        }
+
+        /* operators. */
+    private:
+        Appender& operator= (const Appender&);
+    };
+
+} }
+
+#endif /* _internal_hpp__ */
@@ -0,0 +1,394 @@
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file join.cpp
+ * @brief Hash join of two NDJSON inputs.
+ */
+
+#include "join.hpp"
+#include "thread.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+    // Probe records go to a thread in blocks of (at least) this many bytes.
+    const std::size_t block_size = 4*1024*1024;
+
+    // Size of the record starting at `line`, without its line ending.
+    std::size_t record (const char * line, const char * last,
+                        std::size_t& size)
+    {
+        const char *const end = static_cast<const char*>(
+            std::memchr(line, '\n', last-line));
+        size = ((end == 0)? last : end) - line;
+        return (size - (((size > 0) && (line[size-1] == '\r'))? 1 : 0));
+    }
+
+    // Obtain the compact JSON text of `record`'s key, if it has one.
+    bool extract (const json::Projection& keys, std::size_t path,
+                  const json::Any& record, std::ostringstream& text,
+                  std::string& key)
+    {
+        json::Any value(0);
+        if (!record.is_map() || !keys.get(path, record, value)) {
+            return (false);
+        }
+        text.str(""), text << value, key = text.str();
+        return (true);
+    }
+
+    bool has (const ::cJSON * map, const char * name)
+    {
+        for (const ::cJSON * member = map->child;
+             (member != 0); member = member->next)
+        {
+            if (std::strcmp(member->string, name) == 0) {
+                return (true);
+            }
+        }
+        return (false);
+    }
+
+    // Copy the left record up to its closing brace, then add the right
+    // record's other members.
+    void merge (std::ostream& stream, const char * data, std::size_t size,
+                const json::Any& left, const json::Any& right)
+    {
+        while ((size > 0) && (data[size-1] != '}')) {
+            --size;
+        }
+        stream.write(data, size-1);
+        bool first = (left.data()->child == 0);
+        for (::cJSON * member = right.data()->child;
+             (member != 0); member = member->next)
+        {
+            if (has(left.data(), member->string)) {
+                continue;
+            }
+            stream << (first? "" : ",");
+            json::write_string(stream, member->string)
+                << ':' << json::Any(member);
+            first = false;
+        }
+        stream << "}\n";
+    }
+
+}
+
+namespace json {
+
+    // Open addressing hash table of distinct keys, with linear probing.
+    // Records sharing a key are chained, in input order.
+    struct Join::Table
+    {
+        struct Slot
+        {
+            unsigned long long hash;
+            std::size_t key;
+            std::size_t key_size;
+            std::size_t first;
+            std::size_t last;
+        };
+
+        struct Entry
+        {
+            const char * data;
+            std::size_t size;
+            std::size_t next;
+        };
+
+        std::string keys;
+        std::vector<Entry> entries;
+        std::vector<Slot> slots;
+        std::size_t used;
+
+        Table ()
+            : used(0)
+        {
+            const Slot empty = { 0, 0, 0, 0, 0 };
+            slots.resize(1024, empty);
+        }
+
+        // Index (plus one) of the first record with `key`, or 0.
+        std::size_t find (const std::string& key,
+                          unsigned long long hash) const
+        {
+            const std::size_t mask = slots.size() - 1;
+            for (std::size_t i = hash & mask;
+                 (slots[i].first != 0); i = (i+1) & mask)
+            {
+                if ((slots[i].hash == hash) &&
+                    (slots[i].key_size == key.size()) &&
+                    (keys.compare(slots[i].key, key.size(), key) == 0))
+                {
+                    return (slots[i].first);
+                }
+            }
+            return (0);
+        }
+
+        void insert (const std::string& key, unsigned long long hash,
+                     const char * data, std::size_t size)
+        {
+            const Entry entry = { data, size, 0 };
+            entries.push_back(entry);
+            const std::size_t mask = slots.size() - 1;
+            std::size_t i = hash & mask;
+            for (; (slots[i].first != 0); i = (i+1) & mask)
+            {
+                if ((slots[i].hash == hash) &&
+                    (slots[i].key_size == key.size()) &&
+                    (keys.compare(slots[i].key, key.size(), key) == 0))
+                {
+                    entries[slots[i].last-1].next = entries.size();
+                    slots[i].last = entries.size();
+                    return;
+                }
+            }
+            const Slot slot = {
+                hash, keys.size(), key.size(), entries.size(), entries.size()
+            };
+            keys += key, slots[i] = slot;
+            if ((2 * ++used) > slots.size()) {
+                grow();
+            }
+        }
+
+        void grow ()
+        {
+            const Slot empty = { 0, 0, 0, 0, 0 };
+            std::vector<Slot> old(2*slots.size(), empty);
+            old.swap(slots);
+            const std::size_t mask = slots.size() - 1;
+            for (std::size_t j=0; (j < old.size()); ++j)
+            {
+                if (old[j].first == 0) {
+                    continue;
+                }
+                std::size_t i = old[j].hash & mask;
+                while (slots[i].first != 0) {
+                    i = (i+1) & mask;
+                }
+                slots[i] = old[j];
+            }
+        }
+    };
+
+    // A block of probing records, and what came of it.
+    struct Join::Job
+    {
+        const Join * join;
+        const Table * table;
+        bool left;
+        const char * data;
+        std::size_t size;
+        std::string output;
+        Statistics statistics;
+        std::string error;
+    };
+
+    Join::Join (const std::string& keys, bool outer,
+                const Expression * filter)
+        : myKeys(keys)
+        , myOuter(outer)
+        , myFilter(filter)
+    {
+        if ((myKeys.size() < 1) || (myKeys.size() > 2)) {
+            throw (std::runtime_error("Expecting one or two key paths."));
+        }
+        const Statistics statistics = { 0, 0, 0, 0 };
+        myStatistics = statistics;
+    }
+
+    void Join::run (const char * left, std::size_t left_size,
+                    const char * right, std::size_t right_size,
+                    std::ostream& stream, unsigned int threads)
+    {
+        threads = (threads == 0)? processors() : threads;
+
+        // Hash the smaller input (the right one, for outer joins).
+        const bool hash_left = !myOuter && (left_size < right_size);
+        const char *const data = hash_left? left : right;
+        const std::size_t size = hash_left? left_size : right_size;
+        Table table;
+        {
+            Arena arena;
+            std::ostringstream text;
+            std::string key;
+            const char *const last = data + size;
+            std::size_t skip = 0;
+            for (const char * line = data; (line < last); line += skip+1)
+            {
+                const std::size_t length = record(line, last, skip);
+                if (length == 0) {
+                    continue;
+                }
+                Parser parser(arena, line, length);
+                if (parser.parse() != Parser::complete) {
+                    ++myStatistics.invalid;
+                }
+                else if ((!hash_left || (myFilter == 0) ||
+                          myFilter->matches(Any(parser.root()))) &&
+                         extract(myKeys, hash_left? 0 : myKeys.size()-1,
+                                 Any(parser.root()), text, key))
+                {
+                    table.insert(key, hash(key.data(), key.size()),
+                                 line, length);
+                }
+                ++myStatistics.built;
+                arena.clear();
+            }
+        }
+
+        // Probe with the other input, in rounds of one block per thread,
+        // writing each round's output in order before starting the next.
+        const char *const other = hash_left? right : left;
+        const std::size_t other_size = hash_left? right_size : left_size;
+        std::size_t offset = 0;
+        while (offset < other_size)
+        {
+            std::vector<Job> jobs;
+            for (unsigned int i=0;
+                 ((i < threads) && (offset < other_size)); ++i)
+            {
+                std::size_t last = std::min(offset+block_size, other_size);
+                const char *const end = static_cast<const char*>(
+                    std::memchr(other+last, '\n', other_size-last));
+                last = (end == 0)? other_size : (end - other) + 1;
+                const Statistics statistics = { 0, 0, 0, 0 };
+                const Job job = {
+                    this, &table, !hash_left, other+offset, last-offset,
+                    std::string(), statistics, std::string()
+                };
+                jobs.push_back(job), offset = last;
+            }
+            if (jobs.size() == 1) {
+                probe(&jobs[0]);
+            }
+            else
+            {
+                std::vector<Thread*> running;
+                try {
+                    for (std::size_t i=0; (i < jobs.size()); ++i) {
+                        running.push_back(new Thread(&probe, &jobs[i]));
+                    }
+                }
+                catch (...) {
+                    for (std::size_t i=0; (i < running.size()); ++i) {
+                        delete running[i];
+                    }
+                    throw;
+                }
+                for (std::size_t i=0; (i < running.size()); ++i) {
+                    delete running[i];
+                }
+            }
+            for (std::size_t i=0; (i < jobs.size()); ++i)
+            {
+                if (!jobs[i].error.empty()) {
+                    throw (std::runtime_error(jobs[i].error));
+                }
+                stream.write(jobs[i].output.data(), jobs[i].output.size());
+                myStatistics.probed += jobs[i].statistics.probed;
+                myStatistics.written += jobs[i].statistics.written;
+                myStatistics.invalid += jobs[i].statistics.invalid;
+            }
+        }
+    }
+
+    void Join::probe (void * context)
+    {
+        Job& job = *static_cast<Job*>(context);
+        const Join& self = *job.join;
+        const Table& table = *job.table;
+        try {
+            Arena arena;
+            std::ostringstream stream;
+            std::ostringstream text;
+            std::string key;
+            const char *const last = job.data + job.size;
+            std::size_t skip = 0;
+            for (const char * line = job.data; (line < last); line += skip+1)
+            {
+                const std::size_t length = record(line, last, skip);
+                if (length == 0) {
+                    continue;
+                }
+                ++job.statistics.probed;
+                Parser parser(arena, line, length);
+                if (parser.parse() != Parser::complete) {
+                    ++job.statistics.invalid, arena.clear();
+                    continue;
+                }
+                const Any root(parser.root());
+                if (job.left && (self.myFilter != 0) &&
+                    !self.myFilter->matches(root))
+                {
+                    arena.clear();
+                    continue;
+                }
+                std::size_t match = 0;
+                if (extract(self.myKeys, job.left? 0 : self.myKeys.size()-1,
+                            root, text, key))
+                {
+                    match = table.find(key, hash(key.data(), key.size()));
+                }
+                if ((match == 0) && self.myOuter) {
+                    stream.write(line, length) << '\n';
+                    ++job.statistics.written;
+                }
+                for (; (match != 0); match = table.entries[match-1].next)
+                {
+                    // Hashed records are only parsed when they match.
+                    const Table::Entry& entry = table.entries[match-1];
+                    Parser other(arena, entry.data, entry.size);
+                    other.parse();
+                    if (job.left) {
+                        merge(stream, line, length, root, Any(other.root()));
+                    }
+                    else {
+                        merge(stream, entry.data, entry.size,
+                              Any(other.root()), root);
+                    }
+                    ++job.statistics.written;
+                }
+                arena.clear();
+            }
+            job.output = stream.str();
+        }
+        catch (const std::exception& error) {
+            job.error = error.what();
+        }
+    }
+
+}
@@ -0,0 +1,152 @@
+#ifndef _join_hpp__
+#define _join_hpp__
+
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file join.hpp
+ * @brief Hash join of two NDJSON inputs.
+ */
+
+#include "json.hpp"
+#include "query.hpp"
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+
+namespace json {
+
+    /*!
+     * @brief Join two NDJSON inputs on the values at key paths, writing one
+     *  merged map per matching pair of records.
+     *
+     * The smaller input is hashed: the table only holds each record's key
+     * (as compact JSON text) and the location of its bytes, never a parsed
+     * document.  The larger input is then split among threads that parse
+     * each record into an arena, extract its key and probe the table.
+     * Output keeps the larger input's order.
+     *
+     * Merged maps are written without re-serializing the left record: its
+     * bytes are copied up to its closing brace, followed by the members of
+     * the right record whose names it does not have.  Records that are not
+     * maps, or that lack the key, do not match.
+     *
+     * @code
+     *  json::Join join(".user_id, .id");
+     *  join.run(events, events_size, users, users_size, std::cout);
+     * @endcode
+     */
+    class Join
+    {
+        /* nested types. */
+    private:
+        struct Table;
+        struct Job;
+
+    public:
+        /*!
+         * @brief Join activity report.
+         */
+        struct Statistics
+        {
+            /*!
+             * @brief Number of records in the hashed input.
+             */
+            unsigned long long built;
+
+            /*!
+             * @brief Number of records in the probing input.
+             */
+            unsigned long long probed;
+
+            /*!
+             * @brief Number of records written.
+             */
+            unsigned long long written;
+
+            /*!
+             * @brief Number of records, in either input, that were not
+             *  valid JSON.
+             */
+            unsigned long long invalid;
+        };
+
+        /* data. */
+    private:
+        Projection myKeys;
+        bool myOuter;
+        const Expression * myFilter;
+        Statistics myStatistics;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Prepare a join.
+         * @param keys Path to the key in both inputs, such as @c ".id", or
+         *  paths to the left and right keys, such as @c ".user_id, .id".
+         * @param outer Also write left records that match nothing, as they
+         *  are.  The right input is then always the one hashed.
+         * @param filter Optional expression left records must satisfy.  It
+         *  must outlive the join.
+         *
+         * @throw std::runtime_error The paths are not valid.
+         */
+        explicit Join (const std::string& keys, bool outer=false,
+                       const Expression * filter=0);
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Join two buffers of NDJSON records.
+         * @param left Buffer holding the left records, one per line.
+         * @param left_size Size of @a left, in bytes.
+         * @param right Buffer holding the right records, one per line.
+         * @param right_size Size of @a right, in bytes.
+         * @param stream Output stream.
+         * @param threads Number of threads to probe with, or 0 for one per
+         *  processor.
+         */
+        void run (const char * left, std::size_t left_size,
+                  const char * right, std::size_t right_size,
+                  std::ostream& stream, unsigned int threads=0);
+
+        /*!
+         * @brief Report activity so far.
+         */
+        Statistics statistics () const {
+            return (myStatistics);
+        }
+
+    private:
+        static void probe (void * context);
+    };
+
+}
+
+#endif /* _join_hpp__ */
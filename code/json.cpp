@@ -31,7 +31,1465 @@
  */
 
 #include "json.hpp"
+#include "internal.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <vector>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <time.h>
+#endif
+#ifdef __linux__
+#   include <sys/mman.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#   define JSONXX_SSE2
+#   include <emmintrin.h>
+#endif
+
+// Hint that `address` will be read soon.  Traversals follow chains of
+// dependent pointers, so fetching the next sibling while the current node
+// (or its subtree) is processed hides most of the cache miss.  Define as
+// empty to disable.
+#ifndef JSONXX_PREFETCH
+#   if defined(__GNUC__)
+#       define JSONXX_PREFETCH(address) __builtin_prefetch(address)
+#   elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#       include <xmmintrin.h>
+#       define JSONXX_PREFETCH(address) \
+            _mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0)
+#   else
+#       define JSONXX_PREFETCH(address)
+#   endif
+#endif
+
+namespace {
+
+    bool is_space (char c)
+    {
+        return (static_cast<unsigned char>(c) <= 32);
+    }
+
+    bool is_digit (char c)
+    {
+        return ((c >= '0') && (c <= '9'));
+    }
+
+    int hex_digit (char c)
+    {
+        if ((c >= '0') && (c <= '9')) {
+            return (c - '0');
+        }
+        if ((c >= 'a') && (c <= 'f')) {
+            return (10 + (c - 'a'));
+        }
+        if ((c >= 'A') && (c <= 'F')) {
+            return (10 + (c - 'A'));
+        }
+        return (-1);
+    }
+
+    // Decode 4 hex digits, returns -1 on error.
+    long hex_quad (const char * data)
+    {
+        long value = 0;
+        for (int i=0; (i < 4); ++i)
+        {
+            const int digit = hex_digit(data[i]);
+            if (digit < 0) {
+                return (-1);
+            }
+            value = (value << 4) | digit;
+        }
+        return (value);
+    }
+
+    // Monotonic clock, for time-limited parsing.
+    unsigned long long monotonic_microseconds ()
+    {
+#ifdef _WIN32
+        LARGE_INTEGER frequency, counter;
+        ::QueryPerformanceFrequency(&frequency);
+        ::QueryPerformanceCounter(&counter);
+        return (counter.QuadPart / (frequency.QuadPart / 1000000));
+#else
+        ::timespec now;
+        ::clock_gettime(CLOCK_MONOTONIC, &now);
+        return ((now.tv_sec * 1000000ULL) + (now.tv_nsec / 1000));
+#endif
+    }
+
+    // Map `size` bytes (a multiple of the huge page size), aligned on the
+    // huge page size.  Returns 0 on failure.
+    void * map_huge_pages (std::size_t size, json::Arena::Pages pages)
+    {
+#ifdef __linux__
+        const std::size_t alignment = json::Arena::huge_page_size;
+        if (pages == json::Arena::reserved_huge_pages)
+        {
+            void *const data = ::mmap(0, size, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+            if (data != MAP_FAILED) {
+                return (data);
+            }
+        }
+        // Over-allocate, then trim both ends to get an aligned mapping.
+        char *const data = static_cast<char*>(::mmap(0, size+alignment,
+            PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0));
+        if (data == MAP_FAILED) {
+            return (0);
+        }
+        const std::size_t misalignment =
+            reinterpret_cast<std::size_t>(data) & (alignment-1);
+        const std::size_t head =
+            (misalignment == 0)? 0 : (alignment - misalignment);
+        if (head > 0) {
+            ::munmap(data, head);
+        }
+        if ((alignment - head) > 0) {
+            ::munmap(data + head + size, alignment - head);
+        }
+        ::madvise(data + head, size, MADV_HUGEPAGE);
+        return (data + head);
+#else
+        (void)size, (void)pages;
+        return (0);
+#endif
+    }
+
+    void unmap_huge_pages (void * data, std::size_t size)
+    {
+#ifdef __linux__
+        ::munmap(data, size);
+#else
+        (void)data, (void)size;
+#endif
+    }
+
+    struct Range
+    {
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    // Sum of "AnonHugePages" for the mappings that overlap any range.
+    std::size_t transparent_huge_page_bytes (const std::vector<Range>& ranges)
+    {
+        std::size_t total = 0;
+#ifdef __linux__
+        if (ranges.empty()) {
+            return (0);
+        }
+        std::FILE *const file = std::fopen("/proc/self/smaps", "r");
+        if (file == 0) {
+            return (0);
+        }
+        char line[256];
+        bool overlaps = false;
+        while (std::fgets(line, sizeof(line), file) != 0)
+        {
+            unsigned long begin = 0, end = 0, kilobytes = 0;
+            if (std::sscanf(line, "%lx-%lx ", &begin, &end) == 2)
+            {
+                overlaps = false;
+                for (std::size_t i=0; (i < ranges.size()); ++i)
+                {
+                    if ((begin < ranges[i].end) && (ranges[i].begin < end)) {
+                        overlaps = true; break;
+                    }
+                }
+            }
+            else if (overlaps && (std::sscanf(line,
+                     "AnonHugePages: %lu kB", &kilobytes) == 1))
+            {
+                total += kilobytes * 1024;
+            }
+        }
+        std::fclose(file);
+#else
+        (void)ranges;
+#endif
+        return (total);
+    }
+
+    // Case insensitive comparison, as in cJSON_GetObjectItem().
+    bool same_key (const char * lhs, const char * rhs)
+    {
+        if ((lhs == 0) || (rhs == 0)) {
+            return (lhs == rhs);
+        }
+        for (; (std::tolower(static_cast<unsigned char>(*lhs)) ==
+                std::tolower(static_cast<unsigned char>(*rhs))); ++lhs, ++rhs)
+        {
+            if (*lhs == '\0') {
+                return (true);
+            }
+        }
+        return (false);
+    }
+
+    // Encode code point as UTF-8, returns number of bytes written.
+    int encode_utf8 (unsigned long code, char * data)
+    {
+        if (code < 0x80) {
+            data[0] = static_cast<char>(code);
+            return (1);
+        }
+        if (code < 0x800) {
+            data[0] = static_cast<char>(0xc0 | (code >> 6));
+            data[1] = static_cast<char>(0x80 | (code & 0x3f));
+            return (2);
+        }
+        if (code < 0x10000) {
+            data[0] = static_cast<char>(0xe0 | (code >> 12));
+            data[1] = static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            data[2] = static_cast<char>(0x80 | (code & 0x3f));
+            return (3);
+        }
+        data[0] = static_cast<char>(0xf0 | (code >> 18));
+        data[1] = static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+        data[2] = static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        data[3] = static_cast<char>(0x80 | (code & 0x3f));
+        return (4);
+    }
+
+    std::size_t align (std::size_t offset, std::size_t alignment)
+    {
+        return ((offset + (alignment-1)) & ~(alignment-1));
+    }
+
+    // Pre-order, depth-first walk of the subtree rooted at a node.
+    class Walk
+    {
+        /* data. */
+    private:
+        ::cJSON *const myRoot;
+        std::vector< ::cJSON*> myStack;
+
+        /* construction. */
+    public:
+        explicit Walk (::cJSON * root)
+            : myRoot(root)
+        {
+            myStack.push_back(root);
+        }
+
+        /* methods. */
+    public:
+        ::cJSON * next ()
+        {
+            if (myStack.empty()) {
+                return (0);
+            }
+            ::cJSON *const node = myStack.back();
+            myStack.pop_back();
+            JSONXX_PREFETCH(node->next);
+            if ((node != myRoot) && (node->next != 0)) {
+                myStack.push_back(node->next);
+            }
+            if (node->child != 0) {
+                myStack.push_back(node->child);
+            }
+            return (node);
+        }
+    };
+
+    // Does the node own a copy of a string value?
+    bool has_value_string (const ::cJSON * node)
+    {
+        return ((node->valuestring != 0) &&
+                ((node->type & 0xff) == cJSON_String));
+    }
+
+    // Bytes needed by `copy_tree()` for the subtree rooted at a node.
+    std::size_t measure_tree (::cJSON * root)
+    {
+        std::size_t size = 0;
+        Walk walk(root);
+        for (::cJSON * node = walk.next(); (node != 0); node = walk.next())
+        {
+            size = align(size, sizeof(double)) + sizeof(::cJSON);
+            if (node->string != 0) {
+                size += std::strlen(node->string) + 1;
+            }
+            if (has_value_string(node)) {
+                size += std::strlen(node->valuestring) + 1;
+            }
+        }
+        return (size);
+    }
+
+    char * copy_string (json::Arena& arena, const char * string)
+    {
+        const std::size_t size = std::strlen(string) + 1;
+        char *const data = static_cast<char*>(arena.allocate(size, 1));
+        if (data != 0) {
+            std::memcpy(data, string, size);
+        }
+        return (data);
+    }
+
+    // Deep copy of the subtree rooted at a node, in depth-first order with
+    // each node's strings placed right after it.  Returns 0 if the arena
+    // runs out of room.
+    ::cJSON * copy_tree (json::Arena& arena, ::cJSON * root)
+    {
+        struct Slot
+        {
+            ::cJSON * source;
+            ::cJSON * parent;
+            ::cJSON * prior;
+        };
+        std::vector<Slot> stack;
+        Slot slot = { root, 0, 0 };
+        stack.push_back(slot);
+        ::cJSON * copy = 0;
+        while (!stack.empty())
+        {
+            slot = stack.back(), stack.pop_back();
+            JSONXX_PREFETCH(slot.source->next);
+            JSONXX_PREFETCH(slot.source->string);
+            ::cJSON *const node = static_cast< ::cJSON*>(
+                arena.allocate(sizeof(::cJSON)));
+            if (node == 0) {
+                return (0);
+            }
+            *node = *slot.source;
+            node->type &= ~cJSON_IsReference;
+            node->next = node->prev = node->child = 0;
+            if (node->string != 0)
+            {
+                node->string = copy_string(arena, node->string);
+                if (node->string == 0) {
+                    return (0);
+                }
+            }
+            if (has_value_string(node))
+            {
+                node->valuestring = copy_string(arena, node->valuestring);
+                if (node->valuestring == 0) {
+                    return (0);
+                }
+            }
+            if (slot.prior != 0) {
+                slot.prior->next = node, node->prev = slot.prior;
+            }
+            else if (slot.parent != 0) {
+                slot.parent->child = node;
+            }
+            else {
+                copy = node;
+            }
+            // Visit the children before the next sibling.
+            if ((slot.source != root) && (slot.source->next != 0)) {
+                const Slot next = { slot.source->next, slot.parent, node };
+                stack.push_back(next);
+            }
+            if (slot.source->child != 0) {
+                const Slot next = { slot.source->child, node, 0 };
+                stack.push_back(next);
+            }
+        }
+        return (copy);
+    }
+
+    int count_bits (unsigned int mask)
+    {
+        int count = 0;
+        for (; (mask != 0); mask &= mask-1) {
+            ++count;
+        }
+        return (count);
+    }
+
+    // Size of what write_string() writes.  Quotes, backslashes and control
+    // characters take 2 bytes, except controls without a short escape,
+    // which take 6.  With SSE2, count them 16 bytes at a time.
+    std::size_t measure_string (const char * text)
+    {
+        const std::size_t size = std::strlen(text);
+        std::size_t extra = 0;
+        std::size_t i = 0;
+#ifdef JSONXX_SSE2
+        const __m128i quotes = _mm_set1_epi8('"');
+        const __m128i backslashes = _mm_set1_epi8('\\');
+        const __m128i controls = _mm_set1_epi8(0x1f);
+        const __m128i backspaces = _mm_set1_epi8('\b');
+        const __m128i tabs = _mm_set1_epi8('\t');
+        const __m128i newlines = _mm_set1_epi8('\n');
+        const __m128i feeds = _mm_set1_epi8('\f');
+        const __m128i returns = _mm_set1_epi8('\r');
+        for (; (i+16 <= size); i += 16)
+        {
+            const __m128i chunk = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(text+i));
+            const __m128i control = _mm_cmpeq_epi8(
+                _mm_max_epu8(chunk, controls), controls);
+            const int escaped = _mm_movemask_epi8(_mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quotes),
+                             _mm_cmpeq_epi8(chunk, backslashes)), control));
+            if (escaped == 0) {
+                continue;
+            }
+            const __m128i short_control = _mm_or_si128(
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, backspaces),
+                                          _mm_cmpeq_epi8(chunk, tabs)),
+                             _mm_or_si128(_mm_cmpeq_epi8(chunk, newlines),
+                                          _mm_cmpeq_epi8(chunk, feeds))),
+                _mm_cmpeq_epi8(chunk, returns));
+            const int unicode = _mm_movemask_epi8(
+                _mm_andnot_si128(short_control, control));
+            extra += count_bits(escaped) + 4*count_bits(unicode);
+        }
+#endif
+        for (; (i < size); ++i)
+        {
+            const unsigned char c = text[i];
+            if ((c == '"') || (c == '\\')) {
+                extra += 1;
+            }
+            else if (c < 0x20) {
+                extra += ((c == '\b') || (c == '\t') || (c == '\n') ||
+                          (c == '\f') || (c == '\r'))? 1 : 5;
+            }
+        }
+        return (2 + size + extra);
+    }
+
+    // Decimal spelling of `integer` divided by 10 to the `places`.
+    std::size_t spell (bool negative, unsigned long long integer,
+                       int places, char * text)
+    {
+        char digits[24];
+        int count = 0;
+        do {
+            digits[count++] = char('0' + (integer % 10));
+        }
+        while ((integer /= 10) != 0);
+        while (count <= places) {
+            digits[count++] = '0';
+        }
+        std::size_t size = 0;
+        if (negative) {
+            text[size++] = '-';
+        }
+        for (; (count > 0); --count)
+        {
+            if (count == places) {
+                text[size++] = '.';
+            }
+            text[size++] = digits[count-1];
+        }
+        text[size] = '\0';
+        return (size);
+    }
+
+    std::ostream& write_number (std::ostream& stream, double value)
+    {
+        char text[32];
+        return (stream.write(text, json::format(value, text)));
+    }
+
+}
 
 namespace json {
 
+    const std::size_t Arena::min_block_size;
+    const std::size_t Arena::max_block_size;
+
+    const std::size_t Arena::huge_page_size;
+
+    struct Arena::Block
+    {
+        Block * next;
+        std::size_t size;
+        std::size_t used;
+
+        // Size of the mapping, 0 if allocated with malloc().
+        std::size_t mapped;
+        Pages pages;
+    };
+
+    Arena::Arena (Pages pages)
+        : myBase(0)
+        , myNext(0)
+        , myLast(0)
+        , myBlocks(0)
+        , myUsed(0)
+        , myReserved(0)
+        , myGrowable(true)
+        , myPages(pages)
+    {
+    }
+
+    Arena::Arena (void * storage, std::size_t size)
+        : myBase(static_cast<char*>(storage))
+        , myNext(myBase)
+        , myLast(myBase + size)
+        , myBlocks(0)
+        , myUsed(0)
+        , myReserved(0)
+        , myGrowable(false)
+        , myPages(default_pages)
+    {
+    }
+
+    Arena::~Arena ()
+    {
+        clear();
+    }
+
+    void * Arena::allocate (std::size_t size, std::size_t alignment)
+    {
+        const std::size_t misalignment =
+            reinterpret_cast<std::size_t>(myNext) & (alignment-1);
+        const std::size_t padding =
+            (misalignment == 0)? 0 : (alignment - misalignment);
+        if ((myNext == 0) ||
+            (padding > std::size_t(myLast-myNext)) ||
+            (size > std::size_t(myLast-myNext) - padding))
+        {
+            if (!grow(size + alignment)) {
+                return (0);
+            }
+            return (allocate(size, alignment));
+        }
+        char *const data = myNext + padding;
+        myNext = data + size;
+        return (data);
+    }
+
+    bool Arena::reserve (std::size_t size)
+    {
+        if ((myNext != 0) && (size <= std::size_t(myLast-myNext))) {
+            return (true);
+        }
+        return (grow(size + sizeof(double)));
+    }
+
+    // Start a new heap block, large enough for `size` bytes.
+    bool Arena::grow (std::size_t size)
+    {
+        if (!myGrowable) {
+            return (false);
+        }
+        std::size_t capacity = min_block_size;
+        if (myBlocks != 0) {
+            capacity = std::min(2*myBlocks->size, max_block_size);
+        }
+        capacity = std::max(capacity, size);
+        Block * block = 0;
+        std::size_t mapped = 0;
+        Pages pages = myPages;
+        if (pages != default_pages)
+        {
+            mapped = align(sizeof(Block) + capacity, huge_page_size);
+            block = static_cast<Block*>(map_huge_pages(mapped, pages));
+            if (block != 0) {
+                capacity = mapped - sizeof(Block);
+            }
+        }
+        if (block == 0)
+        {
+            mapped = 0, pages = default_pages;
+            block = static_cast<Block*>(
+                std::malloc(sizeof(Block) + capacity));
+            if (block == 0) {
+                return (false);
+            }
+        }
+        block->mapped = mapped, block->pages = pages;
+        if (myBlocks != 0) {
+            myBlocks->used = myNext - myBase;
+            myUsed += myBlocks->used;
+            myReserved += myBlocks->size;
+        }
+        block->next = myBlocks, block->size = capacity, block->used = 0;
+        myBlocks = block;
+        myBase = myNext = reinterpret_cast<char*>(block + 1);
+        myLast = myBase + capacity;
+        return (true);
+    }
+
+    bool Arena::owns (const void * pointer) const
+    {
+        const char *const data = static_cast<const char*>(pointer);
+        if ((data >= myBase) && (data < myNext)) {
+            return (true);
+        }
+        for (Block * block = myBlocks; (block != 0); block = block->next)
+        {
+            const char *const base = reinterpret_cast<char*>(block + 1);
+            if ((data >= base) && (data < (base + block->used))) {
+                return (true);
+            }
+        }
+        return (false);
+    }
+
+    std::size_t Arena::size () const
+    {
+        return (myUsed + (myNext - myBase));
+    }
+
+    std::size_t Arena::capacity () const
+    {
+        return (myReserved + (myLast - myBase));
+    }
+
+    Arena::Pages Arena::pages () const
+    {
+        return (myPages);
+    }
+
+    Arena::Statistics Arena::statistics () const
+    {
+        Statistics statistics;
+        statistics.blocks = 0;
+        statistics.size = size();
+        statistics.capacity = capacity();
+        statistics.huge_page_bytes = 0;
+        std::vector<Range> transparent;
+        for (Block * block = myBlocks; (block != 0); block = block->next)
+        {
+            ++statistics.blocks;
+            if (block->pages == reserved_huge_pages) {
+                statistics.huge_page_bytes += block->mapped;
+            }
+            if (block->pages == huge_pages)
+            {
+                const Range range = {
+                    reinterpret_cast<std::size_t>(block),
+                    reinterpret_cast<std::size_t>(block) + block->mapped
+                };
+                transparent.push_back(range);
+            }
+        }
+        statistics.huge_page_bytes +=
+            transparent_huge_page_bytes(transparent);
+        return (statistics);
+    }
+
+    void Arena::clear ()
+    {
+        if (!myGrowable) {
+            myNext = myBase; return;
+        }
+        while (myBlocks != 0)
+        {
+            Block *const block = myBlocks;
+            myBlocks = block->next;
+            if (block->mapped != 0) {
+                unmap_huge_pages(block, block->mapped);
+            }
+            else {
+                std::free(block);
+            }
+        }
+        myBase = myNext = myLast = 0;
+        myUsed = myReserved = 0;
+    }
+
+    const int Parser::max_depth;
+    const std::size_t Parser::time_slice;
+
+    void Arena::swap (Arena& other)
+    {
+        std::swap(myBase, other.myBase);
+        std::swap(myNext, other.myNext);
+        std::swap(myLast, other.myLast);
+        std::swap(myBlocks, other.myBlocks);
+        std::swap(myUsed, other.myUsed);
+        std::swap(myReserved, other.myReserved);
+        std::swap(myGrowable, other.myGrowable);
+        std::swap(myPages, other.myPages);
+    }
+
+    ::cJSON * List::find (::cJSON * list, int key)
+    {
+        ::cJSON * node = list->child;
+        for (; (node != 0) && (key > 0); --key) {
+            JSONXX_PREFETCH(node->next);
+            node = node->next;
+        }
+        return (node);
+    }
+
+    ::cJSON * Map::find (::cJSON * map, const char * key)
+    {
+        for (::cJSON * node = map->child; (node != 0); node = node->next)
+        {
+            // Node `i+1` was requested during iteration `i-1`, so its
+            // fields are (likely) available by now: fetch its name and
+            // node `i+2` while comparing node `i`.
+            ::cJSON *const next = node->next;
+            if (next != 0) {
+                JSONXX_PREFETCH(next->next);
+                JSONXX_PREFETCH(next->string);
+            }
+            if (same_key(node->string, key)) {
+                return (node);
+            }
+        }
+        return (0);
+    }
+
+    void Document::compact ()
+    {
+        if (myData == 0) {
+            return;
+        }
+        extract(Any(myData));
+    }
+
+    void Document::extract (const Any& value)
+    {
+        ::cJSON *const root = value.data();
+        Arena arena(myArena.pages());
+        ::cJSON * data = 0;
+        if (root != 0)
+        {
+            if (!arena.reserve(measure_tree(root))) {
+                throw (std::bad_alloc());
+            }
+            data = copy_tree(arena, root);
+            if (data == 0) {
+                throw (std::bad_alloc());
+            }
+            // A map's member has no name once it is the root.
+            data->string = 0;
+        }
+        ::cJSON *const prior = myData;
+        const bool heap = (prior != 0) && !myArena.owns(prior);
+        myArena.swap(arena), myData = data;
+        if (heap) {
+            ::cJSON_Delete(prior);
+        }
+    }
+
+    void Document::clone (Document& copy) const
+    {
+        copy.extract(Any(myData));
+    }
+
+    Parser::Parser (Arena& arena, const char * data, std::size_t size)
+        : myArena(arena)
+        , myDocument(0)
+        , myBase(data)
+        , myNext(data)
+        , myLast(data + size)
+        , myCredit(0)
+        , myState(expect_value)
+        , myResume(expect_value)
+        , myStatus(pending)
+        , myRoot(0)
+        , myNode(0)
+        , myString(0)
+        , myScan(0)
+        , myDecode(0)
+        , myOutput(0)
+        , myDepth(0)
+    {
+    }
+
+    Parser::Parser (Document& document, const char * data, std::size_t size)
+        : myArena(document.myArena)
+        , myDocument(&document)
+        , myBase(data)
+        , myNext(data)
+        , myLast(data + size)
+        , myCredit(0)
+        , myState(expect_value)
+        , myResume(expect_value)
+        , myStatus(pending)
+        , myRoot(0)
+        , myNode(0)
+        , myString(0)
+        , myScan(0)
+        , myDecode(0)
+        , myOutput(0)
+        , myDepth(0)
+    {
+    }
+
+    Parser::Status Parser::parse ()
+    {
+        run(std::size_t(-1));
+        return (myStatus);
+    }
+
+    Parser::Status Parser::step (const Budget& budget)
+    {
+        if (budget.microseconds() == 0) {
+            run((budget.bytes() == 0)? std::size_t(-1) : budget.bytes());
+            return (myStatus);
+        }
+        const unsigned long long deadline =
+            monotonic_microseconds() + budget.microseconds();
+        std::size_t bytes =
+            (budget.bytes() == 0)? std::size_t(-1) : budget.bytes();
+        while ((myState != finished) && (bytes > 0))
+        {
+            const std::size_t slice = std::min(bytes, time_slice);
+            run(slice), bytes -= slice;
+            if (monotonic_microseconds() >= deadline) {
+                break;
+            }
+        }
+        return (myStatus);
+    }
+
+    ::cJSON * Parser::root () const
+    {
+        return ((myStatus == complete)? myRoot : 0);
+    }
+
+    std::size_t Parser::offset () const
+    {
+        return (myNext - myBase);
+    }
+
+    // Process up to (roughly) `credit` bytes of input.
+    void Parser::run (std::size_t credit)
+    {
+        myCredit = credit;
+        while ((myState != finished) && (myCredit > 0))
+        {
+            const char *const next = myNext;
+            switch (myState)
+            {
+                case scan_string: {
+                    scan();
+                } break;
+                case decode_string: {
+                    decode();
+                } break;
+                default: {
+                    advance();
+                    const std::size_t used =
+                        std::max<std::size_t>(myNext-next, 1);
+                    myCredit -= std::min(myCredit, used);
+                }
+            }
+        }
+    }
+
+    // Consume one token (punctuation, key or scalar value).
+    void Parser::advance ()
+    {
+        const char *const limit =
+            myNext + std::min(myCredit, std::size_t(myLast-myNext));
+        while ((myNext < limit) && is_space(*myNext)) {
+            ++myNext;
+        }
+        if (myNext == myLast)
+        {
+            if (myState == expect_eof) {
+                finish();
+            }
+            else {
+                fail(invalid);
+            }
+            return;
+        }
+        if (myNext == limit) {
+            return;
+        }
+        switch (myState)
+        {
+            case expect_value_or_end: {
+                if (*myNext == ']') {
+                    close(); break;
+                }
+            } // fall through.
+            case expect_value: {
+                value();
+            } break;
+            case expect_key_or_end: {
+                if (*myNext == '}') {
+                    close(); break;
+                }
+            } // fall through.
+            case expect_key: {
+                ::cJSON *const node = create();
+                if (node == 0) {
+                    break;
+                }
+                attach(node), myNode = node;
+                string(node->string, expect_colon);
+            } break;
+            case expect_colon: {
+                if (*myNext != ':') {
+                    fail(invalid); break;
+                }
+                ++myNext, myState = expect_value;
+            } break;
+            case expect_next: {
+                const int type = myStack[myDepth-1]->type;
+                if (*myNext == ',') {
+                    ++myNext, myState =
+                        (type == cJSON_Array)? expect_value : expect_key;
+                }
+                else if ((*myNext == ']') && (type == cJSON_Array)) {
+                    close();
+                }
+                else if ((*myNext == '}') && (type == cJSON_Object)) {
+                    close();
+                }
+                else {
+                    fail(invalid);
+                }
+            } break;
+            default: {
+                fail(invalid);
+            }
+        }
+    }
+
+    void Parser::fail (Status status)
+    {
+        myStatus = status, myState = finished;
+    }
+
+    void Parser::finish ()
+    {
+        myStatus = complete, myState = finished;
+        if (myDocument != 0) {
+            myDocument->myData = myRoot;
+        }
+    }
+
+    ::cJSON * Parser::create ()
+    {
+        void *const data = myArena.allocate(sizeof(::cJSON));
+        if (data == 0) {
+            fail(capacity); return (0);
+        }
+        ::cJSON *const node = static_cast< ::cJSON*>(data);
+        std::memset(node, 0, sizeof(::cJSON));
+        return (node);
+    }
+
+    // Link a new node as the last child of the innermost open container.
+    void Parser::attach (::cJSON * node)
+    {
+        if (myDepth == 0) {
+            myRoot = node; return;
+        }
+        ::cJSON *const tail = myTails[myDepth-1];
+        if (tail == 0) {
+            myStack[myDepth-1]->child = node;
+        }
+        else {
+            tail->next = node, node->prev = tail;
+        }
+        myTails[myDepth-1] = node;
+    }
+
+    void Parser::open (::cJSON * node, int type)
+    {
+        if (myDepth == max_depth) {
+            fail(depth); return;
+        }
+        node->type = type, ++myNext;
+        myStack[myDepth] = node, myTails[myDepth] = 0, ++myDepth;
+        myState = (type == cJSON_Array)? expect_value_or_end
+                                       : expect_key_or_end;
+    }
+
+    void Parser::close ()
+    {
+        ++myNext, --myDepth;
+        myState = (myDepth == 0)? expect_eof : expect_next;
+    }
+
+    // Parse a value, filling in the pending map item if any.
+    void Parser::value ()
+    {
+        ::cJSON * node = myNode;
+        if (node == 0)
+        {
+            node = create();
+            if (node == 0) {
+                return;
+            }
+            attach(node);
+        }
+        myNode = 0;
+        const State next = (myDepth == 0)? expect_eof : expect_next;
+        switch (*myNext)
+        {
+            case '{': {
+                open(node, cJSON_Object);
+            } return;
+            case '[': {
+                open(node, cJSON_Array);
+            } return;
+            case '"': {
+                node->type = cJSON_String;
+                string(node->valuestring, next);
+            } return;
+            case 't': {
+                if (!literal("true", 4)) {
+                    return;
+                }
+                node->type = cJSON_True, node->valueint = 1;
+            } break;
+            case 'f': {
+                if (!literal("false", 5)) {
+                    return;
+                }
+                node->type = cJSON_False;
+            } break;
+            case 'n': {
+                if (!literal("null", 4)) {
+                    return;
+                }
+                node->type = cJSON_NULL;
+            } break;
+            default: {
+                if (!number(node)) {
+                    return;
+                }
+            }
+        }
+        myState = next;
+    }
+
+    // Start parsing a quoted string into a null-terminated arena copy.
+    // Strings are processed in two resumable passes: `scan()` finds the
+    // closing quote, then `decode()` copies and un-escapes the contents.
+    void Parser::string (char *& value, State resume)
+    {
+        if (*myNext != '"') {
+            fail(invalid); return;
+        }
+        myString = &value, myResume = resume;
+        myScan = myNext + 1, myState = scan_string;
+    }
+
+    void Parser::scan ()
+    {
+        const char *const limit =
+            myScan + std::min(myCredit, std::size_t(myLast-myScan));
+        const char * p = myScan;
+        while ((p < limit) && (*p != '"'))
+        {
+            if (*p++ == '\\') {
+                ++p;
+            }
+        }
+        myCredit -= std::min(myCredit, std::size_t(p-myScan));
+        myScan = p;
+        if (p >= myLast) {
+            fail(invalid); return;
+        }
+        if ((p == limit) || (*p != '"')) {
+            return;
+        }
+        // Escapes never decode to more bytes than they occupy.
+        char *const data = static_cast<char*>(
+            myArena.allocate((myScan - myNext), 1));
+        if (data == 0) {
+            fail(capacity); return;
+        }
+        *myString = data, myOutput = data;
+        myDecode = myNext + 1, myState = decode_string;
+    }
+
+    void Parser::decode ()
+    {
+        const char *const end = myScan;
+        const char *const limit =
+            myDecode + std::min(myCredit, std::size_t(end-myDecode));
+        const char * p = myDecode;
+        char * next = myOutput;
+        while (p < limit)
+        {
+            if (*p != '\\') {
+                *next++ = *p++; continue;
+            }
+            switch (*++p)
+            {
+                case '"': case '\\': case '/': {
+                    *next++ = *p++;
+                } break;
+                case 'b': *next++ = '\b', ++p; break;
+                case 'f': *next++ = '\f', ++p; break;
+                case 'n': *next++ = '\n', ++p; break;
+                case 'r': *next++ = '\r', ++p; break;
+                case 't': *next++ = '\t', ++p; break;
+                case 'u': {
+                    long code = ((end-p) > 4)? hex_quad(p+1) : -1;
+                    p += 5;
+                    if ((code >= 0xd800) && (code < 0xdc00))
+                    {
+                        // Surrogate pair.
+                        const long low =
+                            ((end-p) > 5) && (p[0] == '\\') && (p[1] == 'u')
+                            ? hex_quad(p+2) : -1;
+                        if ((low < 0xdc00) || (low > 0xdfff)) {
+                            code = -1;
+                        }
+                        else {
+                            code = 0x10000
+                                + ((code - 0xd800) << 10) + (low - 0xdc00);
+                            p += 6;
+                        }
+                    }
+                    if (code < 0) {
+                        myNext = p; fail(invalid); return;
+                    }
+                    next += encode_utf8(code, next);
+                } break;
+                default: {
+                    myNext = p; fail(invalid); return;
+                }
+            }
+        }
+        myCredit -= std::min(myCredit, std::size_t(p-myDecode));
+        myDecode = p, myOutput = next;
+        if (p >= end) {
+            *next = '\0';
+            myNext = end + 1, myState = myResume;
+        }
+    }
+
+    // Same arithmetic as cJSON's parse_number(), so both parsers agree.
+    bool Parser::number (::cJSON * node)
+    {
+        const char * p = myNext;
+        double sign = 1.0, value = 0.0;
+        int scale = 0, exponent = 0, exponent_sign = 1;
+        if ((p < myLast) && (*p == '-')) {
+            sign = -1.0, ++p;
+        }
+        if ((p == myLast) || !is_digit(*p)) {
+            fail(invalid); return (false);
+        }
+        if (*p == '0') {
+            ++p;
+        }
+        else {
+            while ((p < myLast) && is_digit(*p)) {
+                value = (value * 10.0) + (*p++ - '0');
+            }
+        }
+        if ((p < myLast) && (*p == '.'))
+        {
+            if (((p+1) == myLast) || !is_digit(p[1])) {
+                myNext = p; fail(invalid); return (false);
+            }
+            for (++p; (p < myLast) && is_digit(*p); ++p) {
+                value = (value * 10.0) + (*p - '0'), --scale;
+            }
+        }
+        if ((p < myLast) && ((*p == 'e') || (*p == 'E')))
+        {
+            ++p;
+            if ((p < myLast) && ((*p == '+') || (*p == '-'))) {
+                exponent_sign = (*p++ == '-')? -1 : 1;
+            }
+            if ((p == myLast) || !is_digit(*p)) {
+                myNext = p; fail(invalid); return (false);
+            }
+            while ((p < myLast) && is_digit(*p)) {
+                exponent = (exponent * 10) + (*p++ - '0');
+            }
+        }
+        value = sign * value
+            * std::pow(10.0, (scale + exponent*exponent_sign));
+        node->type = cJSON_Number;
+        node->valuedouble = value;
+        node->valueint = internal::to_int(value);
+        myNext = p;
+        return (true);
+    }
+
+    bool Parser::literal (const char * text, std::size_t size)
+    {
+        if ((std::size_t(myLast-myNext) < size) ||
+            (std::memcmp(myNext, text, size) != 0))
+        {
+            fail(invalid); return (false);
+        }
+        myNext += size;
+        return (true);
+    }
+
+    unsigned long long hash (const void * data, std::size_t size)
+    {
+        static const unsigned long long multiplier = 0x9e3779b97f4a7c15ULL;
+        const unsigned char * next = static_cast<const unsigned char*>(data);
+        const unsigned char *const last = next + size;
+        unsigned long long value = size * multiplier;
+        for (; (std::size_t(last-next) >= 8); next += 8)
+        {
+            unsigned long long word;
+            std::memcpy(&word, next, 8);
+            value = (value ^ word) * multiplier;
+            value ^= (value >> 29);
+        }
+        for (; (next < last); ++next) {
+            value = (value ^ *next) * multiplier;
+        }
+        // Final avalanche (from MurmurHash3's fmix64).
+        value ^= (value >> 33);
+        value *= 0xff51afd7ed558ccdULL;
+        value ^= (value >> 33);
+        value *= 0xc4ceb9fe1a85ec53ULL;
+        value ^= (value >> 33);
+        return (value);
+    }
+
+    // Fewest significant digits (15 to 17) that read back the same.  This
+    // is what printf("%.15g") spells for numbers with up to 15 significant
+    // digits, without the exponent when it's small; those numbers are by
+    // far the most common, so look for them without sprintf() first.  JSON
+    // has no infinities or NaNs.
+    std::size_t format (double value, char * text)
+    {
+        if ((value != value) || ((value - value) != 0.0)) {
+            std::memcpy(text, "null", 5);
+            return (4);
+        }
+        const bool negative =
+            (value < 0.0) || ((value == 0.0) && ((1.0 / value) < 0.0));
+        const double magnitude = std::fabs(value);
+        int first = 15;
+        if (magnitude < 1e15)
+        {
+            if (std::floor(magnitude) == magnitude) {
+                return (spell(negative, static_cast<unsigned long long>(
+                    magnitude), 0, text));
+            }
+            // Both operands of the division are exact, so it is rounded
+            // just like strtod() would round the decimal spelling.  If no
+            // spelling with 15 significant digits reads back the same,
+            // printf("%.15g") won't either.
+            double scale = 1.0;
+            for (int places=1; ((magnitude >= 1e-4) && (places <= 19));
+                 ++places)
+            {
+                scale *= 10.0;
+                const double scaled = std::floor((magnitude * scale) + 0.5);
+                if (scaled >= 1e15) {
+                    first = 16;
+                    break;
+                }
+                if ((scaled / scale) == magnitude) {
+                    return (spell(negative, static_cast<unsigned long long>(
+                        scaled), places, text));
+                }
+            }
+        }
+        for (int digits=first; (digits <= 17); ++digits)
+        {
+            std::sprintf(text, "%.*g", digits, value);
+            if (std::strtod(text, 0) == value) {
+                break;
+            }
+        }
+        return (std::strlen(text));
+    }
+
+    std::size_t serialized_size (const Any& value)
+    {
+        return (serialized_size(value, -1));
+    }
+
+    std::size_t serialized_size (const Any& value, int indent)
+    {
+        // Same walk as pretty(), which also spells compact text when there
+        // is no indentation.
+        const bool compact = (indent < 0);
+        std::vector< ::cJSON*> stack;
+        ::cJSON * node = value.data();
+        std::size_t size = 0;
+        while (true)
+        {
+            if ((node != value.data()) && (node->string != 0) &&
+                ((stack.back()->type & 255) == cJSON_Object))
+            {
+                size += measure_string(node->string) + (compact? 1 : 2);
+            }
+            const int type = node->type & 255;
+            if (((type == cJSON_Array) || (type == cJSON_Object)) &&
+                (node->child != 0))
+            {
+                stack.push_back(node), node = node->child;
+                size += compact? 1 : 2 + indent*stack.size();
+                continue;
+            }
+            const Any item(node);
+            if (item.is_null()) {
+                size += 4;
+            }
+            else if (item.is_bool()) {
+                size += bool(item)? 4 : 5;
+            }
+            else if (item.is_number())
+            {
+                char text[32];
+                size += format(double(item), text);
+            }
+            else if (item.is_string()) {
+                size += measure_string(node->valuestring);
+            }
+            else if (item.is_list() || item.is_map()) {
+                size += 2;
+            }
+            // Close every list and map this was the last item of.
+            while (!stack.empty() && (node->next == 0))
+            {
+                node = stack.back(), stack.pop_back();
+                size += compact? 1 : 2 + indent*stack.size();
+            }
+            if (stack.empty()) {
+                break;
+            }
+            node = node->next;
+            size += compact? 1 : 2 + indent*stack.size();
+        }
+        return (size);
+    }
+
+    std::ostream& write_string (std::ostream& stream, const char * text)
+    {
+        static const char hex[] = "0123456789abcdef";
+        stream << '"';
+        const char * run = text;
+        for (; (*text != '\0'); ++text)
+        {
+            const unsigned char c = *text;
+            if ((c >= 0x20) && (c != '"') && (c != '\\')) {
+                continue;
+            }
+            stream.write(run, text-run), run = text+1;
+            switch (c)
+            {
+                case '"': stream << "\\\""; break;
+                case '\\': stream << "\\\\"; break;
+                case '\b': stream << "\\b"; break;
+                case '\f': stream << "\\f"; break;
+                case '\n': stream << "\\n"; break;
+                case '\r': stream << "\\r"; break;
+                case '\t': stream << "\\t"; break;
+                default: {
+                    const char escape[] = {
+                        '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]
+                    };
+                    stream.write(escape, sizeof(escape));
+                }
+            }
+        }
+        stream.write(run, text-run);
+        return (stream << '"');
+    }
+
+    std::ostream& operator<< (std::ostream& stream, const List& list)
+    {
+        stream << '[';
+        ::cJSON * node = list.data()->child;
+        for (; (node != 0); node = node->next)
+        {
+            JSONXX_PREFETCH(node->next);
+            stream << Any(node);
+            if (node->next != 0) {
+                stream << ',';
+            }
+        }
+        return (stream << ']');
+    }
+
+    std::ostream& operator<< (std::ostream& stream, const Map& map)
+    {
+        stream << '{';
+        ::cJSON * node = map.data()->child;
+        for (; (node != 0); node = node->next)
+        {
+            JSONXX_PREFETCH(node->next);
+            write_string(stream, node->string) << ':' << Any(node);
+            if (node->next != 0) {
+                stream << ",";
+            }
+        }
+        return (stream << '}');
+    }
+
+    std::ostream& operator<< (std::ostream& stream, const Any& value)
+    {
+        if (value.is_null()) {
+            return (stream << "null");
+        }
+        if (value.is_bool()) {
+            return (stream << (bool(value)? "true" : "false"));
+        }
+        if (value.is_number()) {
+            return (write_number(stream, double(value)));
+        }
+        if (value.is_string()) {
+            return (write_string(stream, value.c_str()));
+        }
+        if (value.is_list()) {
+            return (stream << List(value));
+        }
+        if (value.is_map()) {
+            return (stream << Map(value));
+        }
+        return (stream);
+    }
+
+    std::ostream& pretty (std::ostream& stream, const Any& value, int indent)
+    {
+        if (indent < 0) {
+            return (stream << value);
+        }
+        // Pre-order walk, with one level of nesting per open list or map.
+        std::vector< ::cJSON*> stack;
+        ::cJSON * node = value.data();
+        while (true)
+        {
+            if ((node != value.data()) && (node->string != 0) &&
+                ((stack.back()->type & 255) == cJSON_Object))
+            {
+                write_string(stream, node->string) << ": ";
+            }
+            const int type = node->type & 255;
+            if (((type == cJSON_Array) || (type == cJSON_Object)) &&
+                (node->child != 0))
+            {
+                stream << ((type == cJSON_Array)? "[\n" : "{\n");
+                stack.push_back(node), node = node->child;
+                stream << std::string(indent*stack.size(), ' ');
+                continue;
+            }
+            stream << Any(node);
+            // Close every list and map this was the last item of.
+            while (!stack.empty() && (node->next == 0))
+            {
+                node = stack.back(), stack.pop_back();
+                stream
+                    << '\n' << std::string(indent*stack.size(), ' ')
+                    << (((node->type & 255) == cJSON_Array)? ']' : '}');
+            }
+            if (stack.empty()) {
+                break;
+            }
+            node = node->next;
+            stream << ",\n" << std::string(indent*stack.size(), ' ');
+        }
+        return (stream);
+    }
+
 }
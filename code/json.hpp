@@ -33,8 +33,11 @@
  */
 
 #include <cJSON.h>
+#include <cstddef>
+#include <exception>
 #include <iosfwd>
 #include <string>
+#include <typeinfo>
 #include <vector>
 
 namespace json {
@@ -44,6 +47,8 @@ namespace json {
      *
      * @note Instances of this class must be entirely scoped within the
      *  lifetime of the root @c Document object from which they are extracted.
+     *  To keep a value longer, copy it to a document of its own with
+     *  @c Document::extract().
      */
     class Any
     {
@@ -137,6 +142,18 @@ namespace json {
             return (myData->type == cJSON_Object);
         }
 
+        /*!
+         * @brief Access the string value without copying it.
+         * @return The underlying string, or @c 0 if the value is not a
+         *  string.
+         *
+         * @note Unlike @c operator std::string(), this never allocates nor
+         *  throws.
+         */
+        const char * c_str () const {
+            return (is_string()? myData->valuestring : 0);
+        }
+
         /* operators. */
     public:
         /*!
@@ -212,6 +229,450 @@ namespace json {
         }
     };
 
+    /*!
+     * @brief Bump allocator for document nodes and strings.
+     *
+     * Nodes and strings are carved out of large memory blocks in allocation
+     * order and are all released at once, by @c clear() or when the arena
+     * is destroyed.  The arena either uses a single block owned by the
+     * caller, or grows by allocating blocks from the heap as needed.
+     *
+     * Growable arenas can back their blocks with huge pages, which
+     * dramatically reduces TLB misses when traversing very large documents.
+     *
+     * @note An arena never throws.  When it cannot satisfy a request (the
+     *  caller's block is exhausted or the heap is), @c allocate() simply
+     *  returns @c 0.  An arena over a caller-provided block never allocates
+     *  from the heap.
+     */
+    class Arena
+    {
+        /* nested types. */
+    public:
+        /*!
+         * @brief Kind of memory pages backing heap blocks.
+         */
+        enum Pages
+        {
+            /*!
+             * @brief Blocks come from @c malloc().
+             */
+            default_pages,
+
+            /*!
+             * @brief Blocks are anonymous mappings aligned on
+             *  @c huge_page_size and flagged with @c MADV_HUGEPAGE, so the
+             *  kernel backs them with transparent huge pages when it can.
+             */
+            huge_pages,
+
+            /*!
+             * @brief Blocks are mapped with @c MAP_HUGETLB, from the
+             *  system's pool of reserved huge pages.  Falls back to
+             *  @c huge_pages when the pool is empty.
+             */
+            reserved_huge_pages
+        };
+
+        /*!
+         * @brief Memory usage report.
+         *
+         * @see statistics()
+         */
+        struct Statistics
+        {
+            /*!
+             * @brief Number of heap blocks.
+             */
+            std::size_t blocks;
+
+            /*!
+             * @brief Number of bytes allocated.
+             */
+            std::size_t size;
+
+            /*!
+             * @brief Total size of the blocks.
+             */
+            std::size_t capacity;
+
+            /*!
+             * @brief Number of bytes actually backed by huge pages.
+             */
+            std::size_t huge_page_bytes;
+        };
+
+    private:
+        struct Block;
+
+        /* class data. */
+    public:
+        /*!
+         * @brief Size of the first heap block of growable arenas.
+         *
+         * Each subsequent block is twice as large as the previous one, up
+         * to @c max_block_size.
+         */
+        static const std::size_t min_block_size = 4*1024;
+
+        /*!
+         * @brief Size above which heap blocks stop growing.
+         */
+        static const std::size_t max_block_size = 1024*1024;
+
+        /*!
+         * @brief Size (and alignment) of blocks backed by huge pages.
+         */
+        static const std::size_t huge_page_size = 2*1024*1024;
+
+        /* data. */
+    private:
+        char * myBase;
+        char * myNext;
+        char * myLast;
+        Block * myBlocks;
+        std::size_t myUsed;
+        std::size_t myReserved;
+        bool myGrowable;
+        Pages myPages;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Create an empty arena that allocates blocks from the heap.
+         * @param pages Kind of memory pages to request for the blocks.
+         *
+         * @note Huge pages are only requested on Linux, other platforms
+         *  always use @c default_pages.
+         */
+        explicit Arena (Pages pages=default_pages);
+
+        /*!
+         * @brief Use @a size bytes at @a storage for allocations.
+         * @param storage Memory block owned by the caller.
+         * @param size Size of @a storage, in bytes.
+         */
+        Arena (void * storage, std::size_t size);
+
+    private:
+        Arena (const Arena&);
+
+    public:
+        /*!
+         * @brief Release all blocks allocated from the heap.
+         */
+        ~Arena ();
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Reserve @a size bytes.
+         * @param size Number of bytes to reserve.
+         * @param alignment Required alignment (a power of 2).
+         * @return A pointer to the reserved bytes, or @c 0 if the arena
+         *  doesn't have enough room left.
+         */
+        void * allocate (std::size_t size,
+                         std::size_t alignment=sizeof(double));
+
+        /*!
+         * @brief Ensure the next @a size bytes of allocations are
+         *  contiguous.
+         * @param size Number of bytes about to be allocated.
+         * @return @c false if the arena cannot provide that much room in a
+         *  single block.
+         *
+         * @note Growable arenas start a new block of exactly the required
+         *  size when the current one is too small.
+         */
+        bool reserve (std::size_t size);
+
+        /*!
+         * @brief Checks if @a pointer was allocated from this arena.
+         */
+        bool owns (const void * pointer) const;
+
+        /*!
+         * @brief Obtain the number of bytes allocated so far.
+         */
+        std::size_t size () const;
+
+        /*!
+         * @brief Obtain the total size of the underlying blocks.
+         */
+        std::size_t capacity () const;
+
+        /*!
+         * @brief Obtain the kind of memory pages requested for heap blocks.
+         */
+        Pages pages () const;
+
+        /*!
+         * @brief Report memory usage, including huge page coverage.
+         *
+         * @note On Linux, this reads @c /proc/self/smaps to find out how much
+         *  of the blocks the kernel actually backed with transparent huge
+         *  pages, so don't call it in a tight loop.
+         */
+        Statistics statistics () const;
+
+        /*!
+         * @brief Release all allocations at once.
+         *
+         * @note Heap blocks are returned to the heap.
+         */
+        void clear ();
+
+        /*!
+         * @brief Exchange contents with @a other.
+         */
+        void swap (Arena& other);
+
+    private:
+        bool grow (std::size_t size);
+
+        /* operators. */
+    private:
+        Arena& operator= (const Arena&);
+    };
+
+    class Document;
+    class Editor;
+
+    /*!
+     * @brief Non-recursive, resumable parser that builds a document inside
+     *  an @c Arena.
+     *
+     * Unlike @c Document(const std::string&), which delegates to
+     * @c cJSON_Parse(), this parser keeps its state in a fixed-size explicit
+     * stack, so it uses bounded (and small) call stack space, never calls
+     * @c malloc() on its own and can be suspended at any point.  The nodes
+     * it produces are regular @c cJSON structures, so they can be wrapped in
+     * @c Any, @c List and @c Map objects as usual.
+     *
+     * Use @c parse() to process the entire input in one go, or call
+     * @c step() repeatedly to interleave parsing of a large input with other
+     * work:
+     *
+     * @code
+     *  json::Document document;
+     *  json::Parser parser(document, data, size);
+     *  while (parser.step(json::Parser::Budget(64*1024)) ==
+     *         json::Parser::pending)
+     *  {
+     *      // service other I/O...
+     *  }
+     * @endcode
+     *
+     * @note Nodes allocated in an arena must never be passed to
+     *  @c cJSON_Delete().
+     */
+    class Parser
+    {
+        /* nested types. */
+    public:
+        /*!
+         * @brief Outcome of a parse.
+         */
+        enum Status
+        {
+            /*!
+             * @brief A complete value was parsed.
+             */
+            complete,
+
+            /*!
+             * @brief The budget ran out, call @c step() again to resume.
+             */
+            pending,
+
+            /*!
+             * @brief The input is not valid JSON.
+             */
+            invalid,
+
+            /*!
+             * @brief The arena ran out of room.
+             */
+            capacity,
+
+            /*!
+             * @brief Lists and maps are nested deeper than @c max_depth.
+             */
+            depth
+        };
+
+        /*!
+         * @brief Limits on the work done by a single call to @c step().
+         *
+         * A zero limit means "unlimited".  When both limits are set, the
+         * step ends as soon as either one is reached.
+         */
+        class Budget
+        {
+            /* data. */
+        private:
+            std::size_t myBytes;
+            unsigned long myMicroseconds;
+
+            /* construction. */
+        public:
+            /*!
+             * @brief Limit the work done by @c step().
+             * @param bytes Maximum number of input bytes to process.
+             * @param microseconds Maximum processing time.  The clock is
+             *  checked every @c time_slice bytes of input.
+             */
+            explicit Budget (std::size_t bytes,
+                             unsigned long microseconds=0)
+                : myBytes(bytes), myMicroseconds(microseconds)
+            {}
+
+            /* methods. */
+        public:
+            /*!
+             * @brief Obtain the maximum number of input bytes to process.
+             */
+            std::size_t bytes () const {
+                return (myBytes);
+            }
+
+            /*!
+             * @brief Obtain the maximum processing time.
+             */
+            unsigned long microseconds () const {
+                return (myMicroseconds);
+            }
+        };
+
+        /*!
+         * @brief Maximum nesting level of lists and maps.
+         */
+        static const int max_depth = 128;
+
+        /*!
+         * @brief Number of bytes processed between clock checks when the
+         *  budget has a time limit.
+         */
+        static const std::size_t time_slice = 16*1024;
+
+    private:
+        enum State
+        {
+            expect_value,
+            expect_value_or_end,
+            expect_key,
+            expect_key_or_end,
+            expect_colon,
+            expect_next,
+            expect_eof,
+            scan_string,
+            decode_string,
+            finished
+        };
+
+        /* data. */
+    private:
+        Arena& myArena;
+        Document * myDocument;
+        const char * myBase;
+        const char * myNext;
+        const char * myLast;
+        std::size_t myCredit;
+        State myState;
+        State myResume;
+        Status myStatus;
+        ::cJSON * myRoot;
+        ::cJSON * myNode;
+        char ** myString;
+        const char * myScan;
+        const char * myDecode;
+        char * myOutput;
+        int myDepth;
+        ::cJSON * myStack[max_depth];
+        ::cJSON * myTails[max_depth];
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Prepare to parse @a size bytes of JSON text at @a data.
+         * @param arena Arena in which nodes and strings are allocated.
+         * @param data Serialized JSON document (need not be null-terminated).
+         * @param size Size of @a data, in bytes.
+         *
+         * @note @a data is not copied and must outlive the parser.
+         */
+        Parser (Arena& arena, const char * data, std::size_t size);
+
+        /*!
+         * @brief Prepare to parse @a size bytes of JSON text at @a data into
+         *  @a document.
+         * @param document Empty document, which receives the root object
+         *  once parsing completes.
+         * @param data Serialized JSON document (need not be null-terminated).
+         * @param size Size of @a data, in bytes.
+         *
+         * @pre @a document was created with @c Document().
+         * @note @a data is not copied and must outlive the parser.
+         */
+        Parser (Document& document, const char * data, std::size_t size);
+
+    private:
+        Parser (const Parser&);
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Parse the entire (remaining) input.
+         * @return @c complete on success, else the reason for failure.
+         */
+        Status parse ();
+
+        /*!
+         * @brief Parse part of the input, then return.
+         * @param budget Limits on the amount of work to do.
+         * @return @c pending if the budget ran out before the end of the
+         *  input, @c complete on success, else the reason for failure.
+         *
+         * @note Calling @c step() after it returned something other than
+         *  @c pending has no effect and returns the same value.
+         */
+        Status step (const Budget& budget);
+
+        /*!
+         * @brief Access the parsed value.
+         * @return The root node, or @c 0 unless parsing completed.
+         */
+        ::cJSON * root () const;
+
+        /*!
+         * @brief Obtain the current position in the input.
+         * @return The number of bytes consumed so far.  On failure, this is
+         *  the position where the error was detected.
+         */
+        std::size_t offset () const;
+
+    private:
+        void run (std::size_t credit);
+        void advance ();
+        void fail (Status status);
+        void finish ();
+        ::cJSON * create ();
+        void attach (::cJSON * node);
+        void open (::cJSON * node, int type);
+        void close ();
+        void value ();
+        void string (char *& value, State resume);
+        void scan ();
+        void decode ();
+        bool number (::cJSON * node);
+        bool literal (const char * text, std::size_t size);
+
+        /* operators. */
+    private:
+        Parser& operator= (const Parser&);
+    };
+
     /*!
      * @brief Parser, placeholder for document root object.
      *
@@ -240,10 +701,31 @@ namespace json {
 
         /* data. */
     private:
-        ::cJSON *const myData;
+        Arena myArena;
+        ::cJSON * myData;
 
         /* construction. */
     public:
+        /*!
+         * @brief Create an empty document, to be filled by a @c Parser.
+         *
+         * @see Parser(Document&, const char*, std::size_t)
+         */
+        Document ()
+            : myData(0)
+        {}
+
+        /*!
+         * @brief Create an empty document, to be filled by a @c Parser, with
+         *  its nodes in memory backed by @a pages.
+         * @param pages Kind of memory pages for the document's nodes.
+         *
+         * @see Parser(Document&, const char*, std::size_t)
+         */
+        explicit Document (Arena::Pages pages)
+            : myArena(pages), myData(0)
+        {}
+
         /*!
          * @brief Parse the JSON document in @a text.
          * @param text Serialized JSON document.
@@ -259,8 +741,12 @@ namespace json {
         /*!
          * @brief Release the memory held by the underlying data structure.
          */
-        ~Document () {
-            ::cJSON_Delete(myData);
+        ~Document ()
+        {
+            // Nodes allocated by a parser go away with the arena.
+            if ((myData != 0) && !myArena.owns(myData)) {
+                ::cJSON_Delete(myData);
+            }
         }
 
         /* methods. */
@@ -276,6 +762,90 @@ namespace json {
             return (myData);
         }
 
+        /*!
+         * @brief Relayout the document in a single contiguous block.
+         *
+         * Nodes are copied in depth-first order, each one immediately
+         * followed by its name and string value, and the previous nodes are
+         * released.  Call this on long-lived documents (especially after
+         * mutation) so that traversals walk memory sequentially instead of
+         * chasing pointers all over the heap.
+         *
+         * The new block uses the same kind of memory pages as the document
+         * was created with.
+         *
+         * @throw std::bad_alloc Not enough memory for the new block.  The
+         *  document is left untouched.
+         *
+         * @warning Invalidates all @c Any, @c List and @c Map objects
+         *  extracted from the document.
+         */
+        void compact ();
+
+        /*!
+         * @brief Replace the document's content by a copy of @a value.
+         * @param value Value in any document, including this one.
+         *
+         * The copy is laid out like @c compact() does, in a new arena sized
+         * in advance: a single pass over @a value that copies each node and
+         * its strings into one contiguous block.  The copy doesn't refer to
+         * @a value's document, which may go away before this one.
+         *
+         * @code
+         *  json::Document request(text);
+         *  json::Document payload;
+         *  payload.extract(json::Map(request)["payload"]);
+         * @endcode
+         *
+         * @throw std::bad_alloc Not enough memory for the copy.  The
+         *  document is left untouched.
+         *
+         * @warning Invalidates all @c Any, @c List and @c Map objects
+         *  extracted from this document.
+         */
+        void extract (const Any& value);
+
+        /*!
+         * @brief Make @a copy a deep copy of this document.
+         * @param copy Document whose content is replaced.
+         *
+         * @see extract()
+         *
+         * @throw std::bad_alloc Not enough memory for the copy.  @a copy is
+         *  left untouched.
+         */
+        void clone (Document& copy) const;
+
+        /*!
+         * @brief Report memory usage of nodes owned by the document's arena.
+         *
+         * @note Nodes parsed by @c Document(const std::string&) are owned by
+         *  cJSON and are not accounted for until @c compact() is called.
+         *
+         * @see Arena::statistics()
+         */
+        Arena::Statistics statistics () const {
+            return (myArena.statistics());
+        }
+
+        /*!
+         * @brief Access the root object.
+         *
+         * @pre is_empty() == false
+         */
+        Any root () const {
+            return (Any(myData));
+        }
+
+        /*!
+         * @brief Checks if the document holds a root object.
+         * @return @c false if the document was created with @c Document()
+         *  and no parser completed into it yet, else @c true.
+         */
+        bool is_empty () const {
+            return (myData == 0);
+        }
+
         /*!
          * @brief Checks if the root object is a list.
          *
@@ -283,7 +853,7 @@ namespace json {
          * @see List(Document&)
          */
         bool is_list () const {
-            return (myData->type == cJSON_Array);
+            return ((myData != 0) && (myData->type == cJSON_Array));
         }
 
         /*!
@@ -293,12 +863,17 @@ namespace json {
          * @see Map(Document&)
          */
         bool is_map () const {
-            return (myData->type == cJSON_Object);
+            return ((myData != 0) && (myData->type == cJSON_Object));
         }
 
         /* operators. */
     private:
         Document& operator= (const Document&);
+
+        /* friends. */
+    private:
+        friend class Editor;
+        friend class Parser;
     };
 
     /*!
@@ -309,6 +884,17 @@ namespace json {
      */
     class List
     {
+        /* class methods. */
+    private:
+        /*!
+         * @internal
+         * @brief Locate the item at position @a key in @a list.
+         * @return The item, or @c 0 if @a list is too short.
+         *
+         * @note Same as @c cJSON_GetArrayItem(), with prefetching.
+         */
+        static ::cJSON * find (::cJSON * list, int key);
+
         /* data. */
     private:
         ::cJSON * myData;
@@ -336,14 +922,17 @@ namespace json {
          * @param document Document who'se root object we're interested in.
          *
          * @pre The document's root object is a list.
-         * @throw std::bad_cast @a document's root object is not a list.
+         * @throw std::bad_cast @a document's root object is not a list,
+         *  or it has none.
          *
          * @see Map(Document&)
          */
         explicit List (Document& document)
             : myData(document.data())
         {
-            if (myData->type != cJSON_Array) {
+            // An empty document (or a step-wise parse that is not over)
+            // has no root yet.
+            if ((myData == 0) || (myData->type != cJSON_Array)) {
                 throw (std::bad_cast());
             }
         }
@@ -382,6 +971,25 @@ namespace json {
             return (::cJSON_GetArraySize(myData));
         }
 
+        /*!
+         * @brief Access a field by position, without throwing.
+         * @param key Position of the field to extract.
+         * @param value Receives the field value, if any.
+         * @return @c true if a field exists at position @a key, else
+         *  @c false (and @a value is left untouched).
+         *
+         * @see operator[](int)
+         */
+        bool get (int key, Any& value) const
+        {
+            ::cJSON *const item = find(myData, key);
+            if (item == 0) {
+                return (false);
+            }
+            value = Any(item);
+            return (true);
+        }
+
         /* operators. */
     public:
         /*!
@@ -399,7 +1007,7 @@ namespace json {
          */
         Any operator[] (int key) const
         {
-            ::cJSON *const item = ::cJSON_GetArrayItem(myData, key);
+            ::cJSON *const item = find(myData, key);
             if (item == 0) {
                 throw (std::exception());
             }
@@ -415,6 +1023,18 @@ namespace json {
      */
     class Map
     {
+        /* class methods. */
+    private:
+        /*!
+         * @internal
+         * @brief Locate the item named @a key in @a map.
+         * @return The item, or @c 0 if no item is named @a key.
+         *
+         * @note Same as @c cJSON_GetObjectItem() (including its case
+         *  insensitive comparison), with prefetching.
+         */
+        static ::cJSON * find (::cJSON * map, const char * key);
+
         /* data. */
     private:
         ::cJSON * myData;
@@ -442,14 +1062,17 @@ namespace json {
          * @param document Document who'se root object we're interested in.
          *
          * @pre The document's root object is a map.
-         * @throw std::bad_cast @a document's root object is not a map.
+         * @throw std::bad_cast @a document's root object is not a map,
+         *  or it has none.
          *
          * @see Map(Document&)
          */
         explicit Map (Document& document)
             : myData(document.data())
         {
-            if (myData->type != cJSON_Object) {
+            // An empty document (or a step-wise parse that is not over)
+            // has no root yet.
+            if ((myData == 0) || (myData->type != cJSON_Object)) {
                 throw (std::bad_cast());
             }
         }
@@ -487,6 +1110,26 @@ namespace json {
             return (Any(myData));
         }
 
+        /*!
+         * @brief Access a field by name, without throwing.
+         * @param key Name of the field to extract.
+         * @param value Receives the field value, if any.
+         * @return @c true if a field is named @a key, else @c false (and
+         *  @a value is left untouched).
+         *
+         * @note Unlike @c operator[](const std::string&), this never
+         *  allocates nor throws.
+         */
+        bool get (const char * key, Any& value) const
+        {
+            ::cJSON *const item = find(myData, key);
+            if (item == 0) {
+                return (false);
+            }
+            value = Any(item);
+            return (true);
+        }
+
         /*!
          * @brief Access a field by name.
          * @param key Name of the field to extract.
@@ -495,7 +1138,7 @@ namespace json {
          */
         Any operator[] (const std::string& key) const
         {
-            ::cJSON *const item = ::cJSON_GetObjectItem(myData, key.c_str());
+            ::cJSON *const item = find(myData, key.c_str());
             if (item == 0) {
                 throw (std::exception());
             }
@@ -503,8 +1146,236 @@ namespace json {
         }
     };
 
-    // Forward declared.
-    std::ostream& operator<< (std::ostream& stream, const Any& value);
+    /*!
+     * @brief Document stored entirely in a fixed-capacity memory block.
+     *
+     * The block lives inside the object itself, so the document can be
+     * placed on the stack or in a pre-allocated structure.  Parsing never
+     * allocates from the heap and never throws: when the block is too small
+     * for the input, @c parse() reports @c Parser::capacity instead.
+     *
+     * Combine with @c Map::get(), @c List::get() and @c Any::c_str() to
+     * keep the entire access path free of heap allocations and exceptions.
+     *
+     * @note Instances of this class must outlive the lifetime of @c Any, @c
+     *  List and @c Map objects extracted from it.  Re-parsing invalidates
+     *  them.
+     *
+     * @see StaticDocument<0> to use caller-provided storage.
+     */
+    template<std::size_t Bytes>
+    class StaticDocument
+    {
+        /* data. */
+    private:
+        union {
+            char bytes[Bytes];
+            double alignment;
+        } myStorage;
+        Arena myArena;
+        ::cJSON * myData;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Create an empty document.
+         */
+        StaticDocument ()
+            : myArena(myStorage.bytes, Bytes), myData(0)
+        {}
+
+    private:
+        StaticDocument (const StaticDocument&);
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Parse the JSON document in @a text, replacing any previous
+         *  contents.
+         * @param text Serialized JSON document.
+         * @param size Size of @a text, in bytes.
+         * @return @c Parser::complete on success, else the reason for
+         *  failure (in which case the document is left empty).
+         */
+        Parser::Status parse (const char * text, std::size_t size)
+        {
+            myArena.clear(), myData = 0;
+            Parser parser(myArena, text, size);
+            const Parser::Status status = parser.parse();
+            if (status == Parser::complete) {
+                myData = parser.root();
+            }
+            return (status);
+        }
+
+        /*!
+         * @internal
+         * @brief Access the underlying implementation.
+         * @return Handle to the JSON data structure, or @c 0 if the document
+         *  is empty.
+         */
+        ::cJSON * data () const {
+            return (myData);
+        }
+
+        /*!
+         * @brief Access the root object.
+         *
+         * @pre The last call to @c parse() returned @c Parser::complete.
+         */
+        Any root () const {
+            return (Any(myData));
+        }
+
+        /*!
+         * @brief Obtain the number of bytes used by the current contents.
+         */
+        std::size_t size () const {
+            return (myArena.size());
+        }
+
+        /*!
+         * @brief Obtain the maximum number of bytes usable by the contents.
+         */
+        std::size_t capacity () const {
+            return (myArena.capacity());
+        }
+
+        /* operators. */
+    private:
+        StaticDocument& operator= (const StaticDocument&);
+    };
+
+    /*!
+     * @brief Document stored entirely in a caller-provided memory block.
+     *
+     * Behaves exactly like @c StaticDocument, except that the memory block
+     * is owned by the caller (e.g. a buffer pre-allocated at startup).
+     */
+    template<>
+    class StaticDocument<0>
+    {
+        /* data. */
+    private:
+        Arena myArena;
+        ::cJSON * myData;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Create an empty document using @a size bytes at @a storage.
+         * @param storage Memory block owned by the caller.  It must outlive
+         *  the document.
+         * @param size Size of @a storage, in bytes.
+         */
+        StaticDocument (void * storage, std::size_t size)
+            : myArena(storage, size), myData(0)
+        {}
+
+    private:
+        StaticDocument (const StaticDocument&);
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Parse the JSON document in @a text, replacing any previous
+         *  contents.
+         * @param text Serialized JSON document.
+         * @param size Size of @a text, in bytes.
+         * @return @c Parser::complete on success, else the reason for
+         *  failure (in which case the document is left empty).
+         */
+        Parser::Status parse (const char * text, std::size_t size)
+        {
+            myArena.clear(), myData = 0;
+            Parser parser(myArena, text, size);
+            const Parser::Status status = parser.parse();
+            if (status == Parser::complete) {
+                myData = parser.root();
+            }
+            return (status);
+        }
+
+        /*!
+         * @internal
+         * @brief Access the underlying implementation.
+         * @return Handle to the JSON data structure, or @c 0 if the document
+         *  is empty.
+         */
+        ::cJSON * data () const {
+            return (myData);
+        }
+
+        /*!
+         * @brief Access the root object.
+         *
+         * @pre The last call to @c parse() returned @c Parser::complete.
+         */
+        Any root () const {
+            return (Any(myData));
+        }
+
+        /*!
+         * @brief Obtain the number of bytes used by the current contents.
+         */
+        std::size_t size () const {
+            return (myArena.size());
+        }
+
+        /*!
+         * @brief Obtain the maximum number of bytes usable by the contents.
+         */
+        std::size_t capacity () const {
+            return (myArena.capacity());
+        }
+
+        /* operators. */
+    private:
+        StaticDocument& operator= (const StaticDocument&);
+    };
+
+    /*!
+     * @brief Compute a fast, non-cryptographic hash of raw bytes.
+     * @param data Bytes to hash.
+     * @param size Number of bytes at @a data.
+     * @return A 64-bit hash value.
+     *
+     * @note Processes 8 bytes at a time; suitable for hash tables keyed by
+     *  payloads of any size, not for security purposes.
+     */
+    unsigned long long hash (const void * data, std::size_t size);
+
+    /*!
+     * @brief Spell a number the way the serializer does.
+     * @param value The number.
+     * @param text Buffer of at least 32 bytes.  The spelling is written
+     *  there, followed by a null character.
+     * @return The spelling's length.
+     *
+     * Uses as few significant digits as read back the same value; integers
+     * are spelled without a fraction or exponent.  JSON has no infinities
+     * or NaNs, so they are spelled @c null.
+     */
+    std::size_t format (double value, char * text);
+
+    /*!
+     * @brief Compute the size of @a value's compact serialization.
+     * @param value The value to measure.
+     * @return The exact number of bytes @c operator<< writes for @a value.
+     *
+     * Much faster than serializing, so text can be written to a buffer
+     * allocated once, or after a @c Content-Length header.
+     */
+    std::size_t serialized_size (const Any& value);
+
+    /*!
+     * @brief Compute the size of @a value's indented serialization.
+     * @param value The value to measure.
+     * @param indent Number of spaces per level of nesting.  A negative
+     *  number measures the compact serialization instead.
+     * @return The exact number of bytes @c pretty() writes for @a value.
+     */
+    std::size_t serialized_size (const Any& value, int indent);
 
     /*!
      * @brief Serialize @a list.
@@ -512,17 +1383,7 @@ namespace json {
      * @param list The value to serialize.
      * @return @a stream
      */
-    std::ostream& operator<< (std::ostream& stream, const List& list)
-    {
-        stream << '[';
-        for (int i=0; (i < list.size()-1); ++i) {
-            stream << list[i] << ',';
-        }
-        if (list.size() > 0) {
-            stream << list[list.size()-1];
-        }
-        return (stream << ']');
-    }
+    std::ostream& operator<< (std::ostream& stream, const List& list);
 
     /*!
      * @brief Serialize @a map.
@@ -530,20 +1391,7 @@ namespace json {
      * @param map The value to serialize.
      * @return @a stream
      */
-    std::ostream& operator<< (std::ostream& stream, const Map& map)
-    {
-        stream << '{';
-        ::cJSON * node = map.data()->child;
-        for (; (node != 0); node = node->next)
-        {
-            stream
-                << "\"" << node->string << "\":" << Any(node);
-            if (node->next != 0) {
-                stream << ",";
-            }
-        }
-        return (stream << '}');
-    }
+    std::ostream& operator<< (std::ostream& stream, const Map& map);
 
     /*!
      * @brief Serialize @a value.
@@ -551,35 +1399,31 @@ namespace json {
      * @param value The value to serialize.
      * @return @a stream
      *
-     * @bug Boolean values output depends on @c std::boolalpha and locale
-     *  settings.  They should always be serialized as @c "true" and @c
-     *  "false".
-     * @bug Double quotes are not escaped in strings.
+     * Output is valid, compact JSON: strings are escaped, booleans are
+     * written as @c true and @c false, and numbers with as few digits as
+     * read back the same value (non-finite numbers become @c null).
      */
-    std::ostream& operator<< (std::ostream& stream, const Any& value)
-    {
-        if (value.is_null()) {
-            return (stream << "null");
-        }
-        if (value.is_bool()) {
-            // TODO: boolalpha?
-            return (stream << bool(value));
-        }
-        if (value.is_number()) {
-            return (stream << double(value));
-        }
-        if (value.is_string()) {
-            // TODO: escape double quotes.
-            return (stream << '"' << std::string(value) << '"');
-        }
-        if (value.is_list()) {
-            return (stream << List(value));
-        }
-        if (value.is_map()) {
-            return (stream << Map(value));
-        }
-        return (stream);
-    }
+    std::ostream& operator<< (std::ostream& stream, const Any& value);
+
+    /*!
+     * @brief Serialize @a value with one list item or map entry per line.
+     * @param stream The output stream.
+     * @param value The value to serialize.
+     * @param indent Number of spaces per level of nesting.  A negative
+     *  number writes the compact serialization instead.
+     * @return @a stream
+     */
+    std::ostream& pretty (std::ostream& stream, const Any& value,
+                          int indent=2);
+
+    /*!
+     * @brief Serialize @a text as a JSON string.
+     * @param stream The output stream.
+     * @param text NUL-terminated text, written with the escapes JSON
+     *  requires.
+     * @return @a stream
+     */
+    std::ostream& write_string (std::ostream& stream, const char * text);
 
 }
 
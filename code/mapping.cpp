@@ -0,0 +1,155 @@
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @internal
+ * @file mapping.cpp
+ * @brief Read-only memory mapped files.
+ */
+
+#include "mapping.hpp"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+namespace json {
+
+#ifdef _WIN32
+
+    Mapping::Mapping (const std::string& path)
+        : myData(0)
+        , mySize(0)
+        , myFile(INVALID_HANDLE_VALUE)
+        , myView(0)
+    {
+        myFile = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+            0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+        if (myFile == INVALID_HANDLE_VALUE) {
+            throw (std::runtime_error("Could not open '" + path + "'."));
+        }
+        LARGE_INTEGER size;
+        if (!::GetFileSizeEx(myFile, &size)) {
+            ::CloseHandle(myFile);
+            throw (std::runtime_error("Could not stat '" + path + "'."));
+        }
+        mySize = static_cast<std::size_t>(size.QuadPart);
+        if (mySize == 0) {
+            return;
+        }
+        myView = ::CreateFileMappingA(myFile, 0, PAGE_READONLY, 0, 0, 0);
+        if (myView != 0) {
+            myData = static_cast<const char*>(
+                ::MapViewOfFile(myView, FILE_MAP_READ, 0, 0, 0));
+        }
+        if (myData == 0)
+        {
+            if (myView != 0) {
+                ::CloseHandle(myView);
+            }
+            ::CloseHandle(myFile);
+            throw (std::runtime_error("Could not map '" + path + "'."));
+        }
+    }
+
+    Mapping::~Mapping ()
+    {
+        if (myData != 0) {
+            ::UnmapViewOfFile(myData);
+            ::CloseHandle(myView);
+        }
+        ::CloseHandle(myFile);
+    }
+
+    void Mapping::sequential () const
+    {
+    }
+
+    void Mapping::random () const
+    {
+    }
+
+#else
+
+    Mapping::Mapping (const std::string& path)
+        : myData(0)
+        , mySize(0)
+    {
+        const int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0) {
+            throw (std::runtime_error("Could not open '" + path + "'."));
+        }
+        struct ::stat status;
+        if (::fstat(file, &status) != 0) {
+            ::close(file);
+            throw (std::runtime_error("Could not stat '" + path + "'."));
+        }
+        mySize = static_cast<std::size_t>(status.st_size);
+        if (mySize > 0)
+        {
+            void *const data =
+                ::mmap(0, mySize, PROT_READ, MAP_SHARED, file, 0);
+            if (data == MAP_FAILED) {
+                ::close(file);
+                throw (std::runtime_error("Could not map '" + path + "'."));
+            }
+            myData = static_cast<const char*>(data);
+        }
+        // The mapping keeps its own reference to the file.
+        ::close(file);
+    }
+
+    Mapping::~Mapping ()
+    {
+        if (myData != 0) {
+            ::munmap(const_cast<char*>(myData), mySize);
+        }
+    }
+
+    void Mapping::sequential () const
+    {
+        if (myData != 0) {
+            ::madvise(const_cast<char*>(myData), mySize, MADV_SEQUENTIAL);
+        }
+    }
+
+    void Mapping::random () const
+    {
+        if (myData != 0) {
+            ::madvise(const_cast<char*>(myData), mySize, MADV_RANDOM);
+        }
+    }
+
+#endif
+
+}
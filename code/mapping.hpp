@@ -0,0 +1,110 @@
+#ifndef _mapping_hpp__
+#define _mapping_hpp__
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file mapping.hpp
+ * @brief Read-only memory mapped files.
+ */
+
+#include <cstddef>
+#include <string>
+
+namespace json {
+
+    /*!
+     * @brief Read-only view of an entire file, mapped in memory.
+     *
+     * Large inputs (NDJSON logs, exports) can be scanned and parsed in place
+     * without copying them into a buffer first.
+     */
+    class Mapping
+    {
+        /* data. */
+    private:
+        const char * myData;
+        std::size_t mySize;
+#ifdef _WIN32
+        void * myFile;
+        void * myView;
+#endif
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Map the file at @a path.
+         * @param path Path to the file.
+         *
+         * @throw std::runtime_error The file cannot be opened or mapped.
+         */
+        explicit Mapping (const std::string& path);
+
+    private:
+        Mapping (const Mapping&);
+
+    public:
+        /*!
+         * @brief Unmap the file.
+         */
+        ~Mapping ();
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Access the file's contents.
+         * @return A pointer to the first byte, or @c 0 if the file is empty.
+         */
+        const char * data () const {
+            return (myData);
+        }
+
+        /*!
+         * @brief Obtain the file's size (at the time it was mapped).
+         */
+        std::size_t size () const {
+            return (mySize);
+        }
+
+        /*!
+         * @brief Tell the system the file will be read front to back.
+         */
+        void sequential () const;
+
+        /*!
+         * @brief Tell the system the file will be read in random order.
+         */
+        void random () const;
+
+        /* operators. */
+    private:
+        Mapping& operator= (const Mapping&);
+    };
+
+}
+
+#endif /* _mapping_hpp__ */
@@ -0,0 +1,744 @@
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @internal
+ * @file ndjson.cpp
+ * @brief Random access into newline-delimited JSON files.
+ */
+
+#include "ndjson.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#   define JSONXX_SSE2
+#   include <emmintrin.h>
+#   ifdef _MSC_VER
+#       include <intrin.h>
+#   endif
+#endif
+
+namespace {
+
+    const char magic[8] = { 'J','S','O','N','X','X','L','I' };
+
+    const char field_magic[8] = { 'J','S','O','N','X','X','F','I' };
+
+    const unsigned long long version = 1;
+
+    // Closes a stdio stream on scope exit.
+    class Stream
+    {
+        /* data. */
+    private:
+        std::FILE * myStream;
+
+        /* construction. */
+    public:
+        Stream (const std::string& path, const char * mode)
+            : myStream(std::fopen(path.c_str(), mode))
+        {}
+
+    private:
+        Stream (const Stream&);
+
+    public:
+        ~Stream ()
+        {
+            if (myStream != 0) {
+                std::fclose(myStream);
+            }
+        }
+
+        /* methods. */
+    public:
+        std::FILE * get () const {
+            return (myStream);
+        }
+
+        /* operators. */
+    private:
+        Stream& operator= (const Stream&);
+    };
+
+    // Encode a scalar value so that equal JSON values (and only those) have
+    // equal keys: a type tag, then the string or shortest number text.
+    bool canonical (const ::cJSON * node, std::string& key)
+    {
+        key.clear();
+        switch (node->type & 255)
+        {
+            case cJSON_False: {
+                key = "f";
+            } break;
+            case cJSON_True: {
+                key = "t";
+            } break;
+            case cJSON_NULL: {
+                key = "z";
+            } break;
+            case cJSON_Number: {
+                char text[32];
+                std::sprintf(text, "n%.17g", node->valuedouble);
+                key = text;
+            } break;
+            case cJSON_String: {
+                key = 's';
+                key += node->valuestring;
+            } break;
+            default: {
+                return (false);
+            }
+        }
+        return (true);
+    }
+
+    // Canonical form of a key supplied as JSON text.
+    std::string canonical (const std::string& text)
+    {
+        json::Arena arena;
+        json::Parser parser(arena, text.data(), text.size());
+        std::string key;
+        if ((parser.parse() != json::Parser::complete) ||
+            !canonical(parser.root(), key))
+        {
+            throw (std::exception());
+        }
+        return (key);
+    }
+
+#ifdef JSONXX_SSE2
+    unsigned int lowest_bit (unsigned int mask)
+    {
+#   ifdef _MSC_VER
+        unsigned long index = 0;
+        ::_BitScanForward(&index, mask);
+        return (index);
+#   else
+        return (__builtin_ctz(mask));
+#   endif
+    }
+#endif
+
+    // JSON text of a string, if it can be spelled without escapes.
+    bool quote (const std::string& text, std::string& quoted)
+    {
+        for (std::string::size_type i=0; (i < text.size()); ++i)
+        {
+            const unsigned char c = text[i];
+            if ((c < 0x20) || (c == '"') || (c == '\\')) {
+                return (false);
+            }
+        }
+        quoted = '"' + text + '"';
+        return (true);
+    }
+
+    // Position of the byte to look for first in `needle`: structural bytes
+    // and common letters show up all over NDJSON, so prefer anything else.
+    std::size_t anchor (const std::string& needle)
+    {
+        static const char structural[] = "\" {}[]:,";
+        static const char common[] = "etaoinsrlu0123456789";
+        std::size_t best = 0;
+        int best_score = 3;
+        for (std::string::size_type i=0; (i < needle.size()); ++i)
+        {
+            const int score =
+                (std::strchr(structural, needle[i]) != 0)? 2 :
+                (std::strchr(common, needle[i]) != 0)? 1 : 0;
+            if (score < best_score) {
+                best = i, best_score = score;
+            }
+        }
+        return (best);
+    }
+
+    // Find `needle` in `data`.  With SSE2, test 16 positions at a time for
+    // the needle's first and last bytes, and compare the rest only where
+    // both match.  Otherwise, look for its rarest byte with memchr().
+    const char * search (const char * data, std::size_t size,
+                         const std::string& needle, std::size_t anchor)
+    {
+        const std::size_t length = needle.size();
+        if (length > size) {
+            return (0);
+        }
+        std::size_t i = 0;
+#ifdef JSONXX_SSE2
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last = _mm_set1_epi8(needle[length-1]);
+        for (; (i+length-1+16 <= size); i += 16)
+        {
+            const __m128i head = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(data+i));
+            const __m128i tail = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(data+i+length-1));
+            unsigned int mask = _mm_movemask_epi8(_mm_and_si128(
+                _mm_cmpeq_epi8(first, head), _mm_cmpeq_epi8(last, tail)));
+            for (; (mask != 0); mask &= mask-1)
+            {
+                const char *const hit = data + i + lowest_bit(mask);
+                if (std::memcmp(hit, needle.data(), length) == 0) {
+                    return (hit);
+                }
+            }
+        }
+#endif
+        const char * next = data + i + anchor;
+        const char *const stop = data + (size - length) + anchor + 1;
+        while (next < stop)
+        {
+            const char *const hit = static_cast<const char*>(
+                std::memchr(next, needle[anchor], stop - next));
+            if (hit == 0) {
+                break;
+            }
+            if (std::memcmp(hit-anchor, needle.data(), length) == 0) {
+                return (hit - anchor);
+            }
+            next = hit + 1;
+        }
+        return (0);
+    }
+
+    // Orders index entries by key hash, for binary searches.
+    struct ByHash
+    {
+        typedef json::FieldIndex::Entry Entry;
+
+        bool operator() (const Entry& lhs, const Entry& rhs) const {
+            return (lhs.hash < rhs.hash);
+        }
+
+        bool operator() (const Entry& lhs, unsigned long long rhs) const {
+            return (lhs.hash < rhs);
+        }
+
+        bool operator() (unsigned long long lhs, const Entry& rhs) const {
+            return (lhs < rhs.hash);
+        }
+    };
+
+}
+
+namespace json {
+
+    ::cJSON * resolve (::cJSON * node, const std::string& pointer)
+    {
+        std::string::size_type next = 0;
+        std::string token;
+        while ((node != 0) && (next < pointer.size()))
+        {
+            if (pointer[next++] != '/') {
+                return (0);
+            }
+            const std::string::size_type last = std::min(
+                pointer.find('/', next), pointer.size());
+            token.clear();
+            for (; (next < last); ++next)
+            {
+                if ((pointer[next] == '~') && (next+1 < last)) {
+                    token += (pointer[++next] == '0')? '~' : '/';
+                }
+                else {
+                    token += pointer[next];
+                }
+            }
+            const int type = node->type & 255;
+            if (type == cJSON_Object)
+            {
+                node = node->child;
+                while ((node != 0) && (token != node->string)) {
+                    node = node->next;
+                }
+            }
+            else if (type == cJSON_Array)
+            {
+                char * end = 0;
+                long index = std::strtol(token.c_str(), &end, 10);
+                if (token.empty() || (*end != '\0') || (index < 0)) {
+                    return (0);
+                }
+                for (node = node->child; ((node != 0) && (index > 0));
+                     --index)
+                {
+                    node = node->next;
+                }
+            }
+            else {
+                return (0);
+            }
+        }
+        return (node);
+    }
+
+    const std::size_t LineIndex::tail_size;
+
+    LineIndex::LineIndex (const std::string& path)
+        : myPath(path)
+        , mySidecar(path + ".idx")
+        , myData(new Mapping(path))
+        , myIndexed(0)
+        , myTail(0)
+    {
+        try {
+            refresh(!load());
+        }
+        catch (...) {
+            delete myData; throw;
+        }
+    }
+
+    LineIndex::LineIndex (const std::string& path, const std::string& sidecar)
+        : myPath(path)
+        , mySidecar(sidecar)
+        , myData(new Mapping(path))
+        , myIndexed(0)
+        , myTail(0)
+    {
+        try {
+            refresh(!load());
+        }
+        catch (...) {
+            delete myData; throw;
+        }
+    }
+
+    LineIndex::~LineIndex ()
+    {
+        delete myData;
+    }
+
+    const char * LineIndex::record
+        (std::size_t ordinal, std::size_t& size) const
+    {
+        return (line(myOffsets[ordinal], size));
+    }
+
+    const char * LineIndex::line
+        (unsigned long long offset, std::size_t& size) const
+    {
+        const char *const base = myData->data();
+        const char *const first = base + offset;
+        const char * last = static_cast<const char*>(
+            std::memchr(first, '\n', (base + myIndexed) - first));
+        if ((last > first) && (last[-1] == '\r')) {
+            --last;
+        }
+        size = last - first;
+        return (first);
+    }
+
+    Parser::Status LineIndex::parse
+        (std::size_t ordinal, Document& document) const
+    {
+        std::size_t size = 0;
+        const char *const data = record(ordinal, size);
+        Parser parser(document, data, size);
+        return (parser.parse());
+    }
+
+    std::size_t LineIndex::update ()
+    {
+        Mapping *const data = new Mapping(myPath);
+        delete myData, myData = data;
+        return (refresh(false));
+    }
+
+    // Read the sidecar, if there is a usable one.
+    bool LineIndex::load ()
+    {
+        Stream stream(mySidecar, "rb");
+        if (stream.get() == 0) {
+            return (false);
+        }
+        Header header;
+        if ((std::fread(&header, sizeof(header), 1, stream.get()) != 1) ||
+            (std::memcmp(header.magic, magic, sizeof(magic)) != 0) ||
+            (header.version != version))
+        {
+            return (false);
+        }
+        myOffsets.resize(static_cast<std::size_t>(header.records));
+        if (!myOffsets.empty() &&
+            (std::fread(&myOffsets[0], sizeof(myOffsets[0]),
+                        myOffsets.size(), stream.get()) != myOffsets.size()))
+        {
+            myOffsets.clear();
+            return (false);
+        }
+        myIndexed = header.indexed;
+        myTail = header.tail;
+        return (true);
+    }
+
+    // Index whatever the mapping holds past the indexed region, or all of
+    // it if the file no longer starts with the indexed bytes.
+    std::size_t LineIndex::refresh (bool rewrite)
+    {
+        if ((myIndexed > myData->size()) || (tail() != myTail)) {
+            myOffsets.clear(), myIndexed = 0, rewrite = true;
+        }
+        const std::size_t first = myOffsets.size();
+        const unsigned long long indexed = myIndexed;
+        scan(myIndexed);
+        if (rewrite) {
+            save(0);
+        }
+        else if (myIndexed != indexed) {
+            save(first);
+        }
+        return (myOffsets.size() - first);
+    }
+
+    // Record the start of every non-empty, newline-terminated line.
+    void LineIndex::scan (unsigned long long start)
+    {
+        const char *const base = myData->data();
+        const char *const last = base + myData->size();
+        const char * line = base + start;
+        myData->sequential();
+        while (line < last)
+        {
+            // memchr() is vectorized by every C library worth using.
+            const char *const end = static_cast<const char*>(
+                std::memchr(line, '\n', last - line));
+            if (end == 0) {
+                break;
+            }
+            if ((end > line) && !((end == line+1) && (*line == '\r'))) {
+                myOffsets.push_back(line - base);
+            }
+            line = end + 1;
+        }
+        myData->random();
+        myIndexed = line - base;
+        myTail = tail();
+    }
+
+    // Write offsets from `first` onwards, then the header.  Writing the
+    // header last means an interrupted update leaves the old index valid.
+    void LineIndex::save (std::size_t first) const
+    {
+        Stream stream(mySidecar, (first == 0)? "wb" : "r+b");
+        if (stream.get() == 0) {
+            throw (std::runtime_error("Could not open '"+mySidecar+"'."));
+        }
+        Header header;
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.records = myOffsets.size();
+        header.indexed = myIndexed;
+        header.tail = myTail;
+        const long position = static_cast<long>(
+            sizeof(header) + first*sizeof(myOffsets[0]));
+        const std::size_t count = myOffsets.size() - first;
+        if ((std::fseek(stream.get(), position, SEEK_SET) != 0) ||
+            ((count > 0) &&
+             (std::fwrite(&myOffsets[first], sizeof(myOffsets[0]),
+                          count, stream.get()) != count)) ||
+            (std::fflush(stream.get()) != 0) ||
+            (std::fseek(stream.get(), 0, SEEK_SET) != 0) ||
+            (std::fwrite(&header, sizeof(header), 1, stream.get()) != 1) ||
+            (std::fflush(stream.get()) != 0))
+        {
+            throw (std::runtime_error("Could not write '"+mySidecar+"'."));
+        }
+    }
+
+    // Hash the last bytes of the indexed region.
+    unsigned long long LineIndex::tail () const
+    {
+        const std::size_t size = static_cast<std::size_t>(
+            (myIndexed < tail_size)? myIndexed : tail_size);
+        return (hash(myData->data() + (myIndexed - size), size));
+    }
+
+    void FieldIndex::build (const LineIndex& records,
+                            const std::string& pointer,
+                            const std::string& path)
+    {
+        std::vector<Entry> entries;
+        entries.reserve(records.size());
+        Arena arena;
+        std::string key;
+        for (std::size_t i=0; (i < records.size()); ++i)
+        {
+            std::size_t size = 0;
+            const char *const data = records.record(i, size);
+            Parser parser(arena, data, size);
+            ::cJSON * node = 0;
+            if ((parser.parse() == Parser::complete) &&
+                ((node = resolve(parser.root(), pointer)) != 0) &&
+                canonical(node, key))
+            {
+                const Entry entry = {
+                    hash(key.data(), key.size()), records.offset(i)
+                };
+                entries.push_back(entry);
+            }
+            arena.clear();
+        }
+        // Records were visited in file order: keep it among equal hashes.
+        std::stable_sort(entries.begin(), entries.end(), ByHash());
+
+        Header header;
+        std::memcpy(header.magic, field_magic, sizeof(field_magic));
+        header.version = version;
+        header.entries = entries.size();
+        header.indexed = records.indexed();
+        header.pointer = pointer.size();
+        const char padding[8] = { 0 };
+        Stream stream(path, "wb");
+        if ((stream.get() == 0) ||
+            (std::fwrite(&header, sizeof(header), 1, stream.get()) != 1) ||
+            (std::fwrite(pointer.data(), 1, pointer.size(), stream.get())
+             != pointer.size()) ||
+            (std::fwrite(padding, 1, (8 - pointer.size()%8) % 8,
+                         stream.get()) != (8 - pointer.size()%8) % 8) ||
+            (!entries.empty() &&
+             (std::fwrite(&entries[0], sizeof(Entry), entries.size(),
+                          stream.get()) != entries.size())) ||
+            (std::fflush(stream.get()) != 0))
+        {
+            throw (std::runtime_error("Could not write '" + path + "'."));
+        }
+    }
+
+    FieldIndex::FieldIndex (const std::string& path)
+        : myFile(path)
+        , myEntries(0)
+        , mySize(0)
+        , myIndexed(0)
+    {
+        const Header *const header =
+            reinterpret_cast<const Header*>(myFile.data());
+        if ((myFile.size() < sizeof(Header)) ||
+            (std::memcmp(header->magic, field_magic, 8) != 0) ||
+            (header->version != version))
+        {
+            throw (std::runtime_error("'" + path + "' is not an index."));
+        }
+        const std::size_t padded =
+            static_cast<std::size_t>((header->pointer + 7) / 8 * 8);
+        const std::size_t entries = static_cast<std::size_t>(header->entries);
+        if (myFile.size() != sizeof(Header) + padded + entries*sizeof(Entry))
+        {
+            throw (std::runtime_error("'" + path + "' is truncated."));
+        }
+        const char *const pointer = myFile.data() + sizeof(Header);
+        myPointer.assign(pointer, static_cast<std::size_t>(header->pointer));
+        myEntries = reinterpret_cast<const Entry*>(pointer + padded);
+        mySize = entries;
+        myIndexed = header->indexed;
+        myFile.random();
+    }
+
+    std::size_t FieldIndex::find (const std::string& key,
+        std::vector<unsigned long long>& offsets) const
+    {
+        const std::string canonical_key = canonical(key);
+        const std::pair<const Entry*, const Entry*> range = std::equal_range(
+            myEntries, myEntries + mySize,
+            hash(canonical_key.data(), canonical_key.size()), ByHash());
+        offsets.clear();
+        for (const Entry * entry = range.first;
+             (entry != range.second); ++entry)
+        {
+            offsets.push_back(entry->offset);
+        }
+        return (offsets.size());
+    }
+
+    bool FieldIndex::fetch (const LineIndex& records,
+                            unsigned long long offset,
+                            const std::string& key, Document& document) const
+    {
+        std::size_t size = 0;
+        const char *const data = records.line(offset, size);
+        Parser parser(document, data, size);
+        if (parser.parse() != Parser::complete) {
+            return (false);
+        }
+        const ::cJSON *const node =
+            resolve(document.root().data(), myPointer);
+        std::string actual;
+        return ((node != 0) && canonical(node, actual) &&
+                (actual == canonical(key)));
+    }
+
+    Selector::Selector (const std::string& pointer, const std::string& value)
+        : myPointer(pointer)
+        , myKey(canonical(value))
+    {
+        // Object keys along the pointer.  Numeric tokens may be list
+        // indices, which do not appear in the text.
+        std::vector<std::string> texts;
+        std::string::size_type next = 0;
+        while (next < pointer.size())
+        {
+            const std::string::size_type last = std::min(
+                pointer.find('/', next+1), pointer.size());
+            std::string token;
+            for (++next; (next < last); ++next)
+            {
+                if ((pointer[next] == '~') && (next+1 < last)) {
+                    token += (pointer[++next] == '0')? '~' : '/';
+                }
+                else {
+                    token += pointer[next];
+                }
+            }
+            std::string quoted;
+            if ((token.find_first_not_of("0123456789") != std::string::npos)
+                && quote(token, quoted))
+            {
+                texts.push_back(quoted);
+            }
+        }
+
+        // The value, unless it is a number: those have many spellings.
+        std::string literal;
+        switch (myKey[0])
+        {
+            case 't': {
+                literal = "true";
+            } break;
+            case 'f': {
+                literal = "false";
+            } break;
+            case 'z': {
+                literal = "null";
+            } break;
+            case 's': {
+                quote(myKey.substr(1), literal);
+            } break;
+        }
+
+        // Most selective first, since next() skips ahead to the first
+        // needle: a string value, then key names (deepest first), then the
+        // common literals.
+        std::reverse(texts.begin(), texts.end());
+        if (!literal.empty())
+        {
+            if (myKey[0] == 's') {
+                texts.insert(texts.begin(), literal);
+            }
+            else {
+                texts.push_back(literal);
+            }
+        }
+        for (std::size_t i=0; (i < texts.size()); ++i)
+        {
+            const Needle needle = { texts[i], anchor(texts[i]) };
+            myNeedles.push_back(needle);
+        }
+    }
+
+    bool Selector::candidate (const char * data, std::size_t size) const
+    {
+        for (std::size_t i=0; (i < myNeedles.size()); ++i)
+        {
+            if (search(data, size, myNeedles[i].text,
+                       myNeedles[i].anchor) == 0)
+            {
+                return (std::memchr(data, '\\', size) != 0);
+            }
+        }
+        return (true);
+    }
+
+    const char * Selector::next (const char * data, std::size_t size,
+        std::size_t& offset, std::size_t& length) const
+    {
+        const char *const last = data + size;
+        while (offset < size)
+        {
+            // Skip to the first occurrence of the most selective needle or
+            // backslash, whichever comes first, and take the whole record.
+            const char * line = data + offset;
+            const char * hit = line;
+            if (!myNeedles.empty())
+            {
+                hit = search(line, last-line,
+                             myNeedles[0].text, myNeedles[0].anchor);
+                hit = (hit == 0)? last : hit;
+                const char *const escape = static_cast<const char*>(
+                    std::memchr(line, '\\', hit-line));
+                if (escape != 0) {
+                    hit = escape;
+                }
+                if (hit == last) {
+                    offset = size; break;
+                }
+                line = hit;
+                while ((line > data + offset) && (line[-1] != '\n')) {
+                    --line;
+                }
+            }
+            const char * end = static_cast<const char*>(
+                std::memchr(hit, '\n', last-hit));
+            end = (end == 0)? last : end;
+            offset = std::min<std::size_t>((end - data) + 1, size);
+            length = end - line;
+            if ((length > 0) && (line[length-1] == '\r')) {
+                --length;
+            }
+            if ((length > 0) && candidate(line, length)) {
+                return (line);
+            }
+        }
+        length = 0;
+        return (0);
+    }
+
+    bool Selector::matches (const Any& record) const
+    {
+        const ::cJSON *const node = resolve(record.data(), myPointer);
+        std::string key;
+        return ((node != 0) && canonical(node, key) && (key == myKey));
+    }
+
+    bool Selector::matches
+        (const char * data, std::size_t size, Arena& arena) const
+    {
+        if (!candidate(data, size)) {
+            return (false);
+        }
+        Parser parser(arena, data, size);
+        return ((parser.parse() == Parser::complete) &&
+                matches(Any(parser.root())));
+    }
+
+}
@@ -0,0 +1,452 @@
+#ifndef _ndjson_hpp__
+#define _ndjson_hpp__
+
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file ndjson.hpp
+ * @brief Random access into newline-delimited JSON files.
+ */
+
+#include "json.hpp"
+#include "mapping.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace json {
+
+    /*!
+     * @internal
+     * @brief Follow a JSON Pointer (RFC 6901), such as @c "/user/id", from
+     *  @a node.
+     * @return The value, or @c 0 if it does not exist.
+     */
+    ::cJSON * resolve (::cJSON * node, const std::string& pointer);
+
+    /*!
+     * @brief Offsets of the records in an NDJSON file, kept in a sidecar.
+     *
+     * The first time a file is opened, a single pass over its bytes locates
+     * the start of every non-empty line and the offsets are written to the
+     * sidecar (by default, the file's path followed by @c ".idx").  Later
+     * opens load the sidecar instead of scanning the file and, when the file
+     * only grew since it was indexed, scan just the appended bytes.
+     *
+     * A trailing line without a newline is not indexed: it may be a record
+     * that is still being written.  Call @c update() to pick it up later.
+     *
+     * @code
+     *  json::LineIndex index("events.ndjson");
+     *  json::Document document;
+     *  if (index.parse(index.size()-1, document) == json::Parser::complete) {
+     *      std::cout << json::Map(document.root()) << std::endl;
+     *  }
+     * @endcode
+     */
+    class LineIndex
+    {
+        /* nested types. */
+    public:
+        /*!
+         * @brief Sidecar file layout, followed by one offset per record.
+         *
+         * All fields are in the host's byte order.
+         */
+        struct Header
+        {
+            char magic[8];
+            unsigned long long version;
+            unsigned long long records;
+            unsigned long long indexed;
+            unsigned long long tail;
+        };
+
+        /* class data. */
+    public:
+        /*!
+         * @brief Number of bytes before the end of the indexed region whose
+         *  hash is checked to detect files rewritten since they were indexed.
+         */
+        static const std::size_t tail_size = 4096;
+
+        /* data. */
+    private:
+        std::string myPath;
+        std::string mySidecar;
+        Mapping * myData;
+        std::vector<unsigned long long> myOffsets;
+        unsigned long long myIndexed;
+        unsigned long long myTail;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Open the NDJSON file at @a path and load or build its index
+         *  in @c path+".idx".
+         * @param path Path to the NDJSON file.
+         *
+         * @throw std::runtime_error A file cannot be read or written.
+         */
+        explicit LineIndex (const std::string& path);
+
+        /*!
+         * @brief Open the NDJSON file at @a path and load or build its index
+         *  in @a sidecar.
+         * @param path Path to the NDJSON file.
+         * @param sidecar Path to the index file.
+         *
+         * @throw std::runtime_error A file cannot be read or written.
+         */
+        LineIndex (const std::string& path, const std::string& sidecar);
+
+    private:
+        LineIndex (const LineIndex&);
+
+    public:
+        ~LineIndex ();
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Obtain the number of indexed records.
+         */
+        std::size_t size () const {
+            return (myOffsets.size());
+        }
+
+        /*!
+         * @brief Obtain the number of bytes covered by the index.
+         */
+        unsigned long long indexed () const {
+            return (myIndexed);
+        }
+
+        /*!
+         * @brief Locate a record in the mapped file.
+         * @param ordinal Zero-based position of the record in the file.
+         * @param size Receives the size of the record, without the newline.
+         * @return A pointer to the first byte of the record.
+         *
+         * @pre @a ordinal is less than @c size().
+         */
+        const char * record (std::size_t ordinal, std::size_t& size) const;
+
+        /*!
+         * @brief Obtain the position of a record in the file.
+         * @param ordinal Zero-based position of the record in the file.
+         * @return The offset of the record's first byte.
+         *
+         * @pre @a ordinal is less than @c size().
+         */
+        unsigned long long offset (std::size_t ordinal) const {
+            return (myOffsets[ordinal]);
+        }
+
+        /*!
+         * @brief Locate the record starting at a given position in the file.
+         * @param offset Offset of the record's first byte.
+         * @param size Receives the size of the record, without the newline.
+         * @return A pointer to the first byte of the record.
+         *
+         * @pre @a offset was obtained from @c offset().
+         */
+        const char * line
+            (unsigned long long offset, std::size_t& size) const;
+
+        /*!
+         * @brief Parse a single record.
+         * @param ordinal Zero-based position of the record in the file.
+         * @param document Empty document, which receives the record.
+         * @return @c Parser::complete on success, else the reason for
+         *  failure.
+         *
+         * @pre @a ordinal is less than @c size().
+         * @pre @a document was created with @c Document().
+         */
+        Parser::Status parse (std::size_t ordinal, Document& document) const;
+
+        /*!
+         * @brief Index records appended to the file since it was indexed.
+         * @return The number of new records.
+         *
+         * If the file was truncated or rewritten instead, it is indexed again
+         * from scratch.
+         *
+         * @throw std::runtime_error A file cannot be read or written.
+         */
+        std::size_t update ();
+
+    private:
+        bool load ();
+        std::size_t refresh (bool rewrite);
+        void scan (unsigned long long start);
+        void save (std::size_t first) const;
+        unsigned long long tail () const;
+
+        /* operators. */
+    private:
+        LineIndex& operator= (const LineIndex&);
+    };
+
+    /*!
+     * @brief On-disk index of NDJSON records by the value of one field.
+     *
+     * The index file holds the field's JSON Pointer (RFC 6901) followed by a
+     * sorted array of (key hash, record offset) pairs and is used straight
+     * from a read-only mapping.  A lookup is a binary search in the mapping;
+     * only records whose key hashes match are parsed, to confirm the match.
+     *
+     * Strings, numbers, booleans and null are indexed; records where the
+     * field is missing, is a list or map, or which fail to parse are not.
+     *
+     * @code
+     *  json::LineIndex records("events.ndjson");
+     *  json::FieldIndex::build(records, "/user/id", "events.user-id.idx");
+     *  json::FieldIndex index("events.user-id.idx");
+     *  std::vector<unsigned long long> offsets;
+     *  index.find("\"alice\"", offsets);
+     *  for (std::size_t i=0; (i < offsets.size()); ++i) {
+     *      json::Document document;
+     *      if (index.fetch(records, offsets[i], "\"alice\"", document)) {
+     *          std::cout << json::Map(document) << std::endl;
+     *      }
+     *  }
+     * @endcode
+     */
+    class FieldIndex
+    {
+        /* nested types. */
+    public:
+        /*!
+         * @brief Index file layout, followed by the JSON Pointer (padded to a
+         *  multiple of 8 bytes) and the entries.
+         *
+         * All fields are in the host's byte order.
+         */
+        struct Header
+        {
+            char magic[8];
+            unsigned long long version;
+            unsigned long long entries;
+            unsigned long long indexed;
+            unsigned long long pointer;
+        };
+
+        /*!
+         * @brief Position of a record holding a key with a given hash.
+         */
+        struct Entry
+        {
+            unsigned long long hash;
+            unsigned long long offset;
+        };
+
+        /* class methods. */
+    public:
+        /*!
+         * @brief Index the records in @a records by the value at @a pointer.
+         * @param records Records to index.
+         * @param pointer JSON Pointer to the field, such as @c "/user/id".
+         * @param path Path to the index file, which is replaced.
+         *
+         * @throw std::runtime_error The index cannot be written.
+         */
+        static void build (const LineIndex& records,
+                           const std::string& pointer,
+                           const std::string& path);
+
+        /* data. */
+    private:
+        Mapping myFile;
+        std::string myPointer;
+        const Entry * myEntries;
+        std::size_t mySize;
+        unsigned long long myIndexed;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Open the index file at @a path.
+         * @param path Path to a file written by @c build().
+         *
+         * @throw std::runtime_error The file cannot be mapped or is not an
+         *  index file.
+         */
+        explicit FieldIndex (const std::string& path);
+
+    private:
+        FieldIndex (const FieldIndex&);
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Obtain the JSON Pointer to the indexed field.
+         */
+        const std::string& pointer () const {
+            return (myPointer);
+        }
+
+        /*!
+         * @brief Obtain the number of indexed records.
+         */
+        std::size_t size () const {
+            return (mySize);
+        }
+
+        /*!
+         * @brief Obtain the number of bytes of the NDJSON file covered by
+         *  the index, when it was built.
+         */
+        unsigned long long indexed () const {
+            return (myIndexed);
+        }
+
+        /*!
+         * @brief Find records which may hold a given key.
+         * @param key Serialized JSON value, such as @c "\"alice\"" or
+         *  @c "42".
+         * @param offsets Receives the offsets of candidate records, in file
+         *  order.
+         * @return The number of candidates.
+         *
+         * @throw std::exception @a key is not a scalar JSON value.
+         */
+        std::size_t find (const std::string& key,
+                          std::vector<unsigned long long>& offsets) const;
+
+        /*!
+         * @brief Parse a candidate record and confirm it holds a given key.
+         * @param records Records from which the index was built.
+         * @param offset Offset of the record, as obtained from @c find().
+         * @param key Serialized JSON value, as passed to @c find().
+         * @param document Empty document, which receives the record.
+         * @return @c true if the record parsed and its field equals @a key.
+         *
+         * @throw std::exception @a key is not a scalar JSON value.
+         */
+        bool fetch (const LineIndex& records, unsigned long long offset,
+                    const std::string& key, Document& document) const;
+
+        /* operators. */
+    private:
+        FieldIndex& operator= (const FieldIndex&);
+    };
+
+    /*!
+     * @brief Selects NDJSON records whose field at a JSON Pointer equals a
+     *  given value.
+     *
+     * Most records in a typical selection do not match, and most of those
+     * can be rejected without parsing them: a matching record must contain
+     * the field's (non-numeric) key names and, unless the value is a number,
+     * the value's serialized bytes.  @c candidate() and @c next() search for
+     * those bytes (16 positions at a time, with SSE2) at close to memory
+     * bandwidth; only candidates need to be parsed and checked with
+     * @c matches().  On a buffer holding many records, @c next() is faster
+     * than @c candidate() on each line: it skips over whole runs of records
+     * in a single search.
+     *
+     * The prefilter never rejects a matching record: a record containing a
+     * backslash (whose strings may be spelled with escapes) is always a
+     * candidate.
+     */
+    class Selector
+    {
+        /* nested types. */
+    private:
+        struct Needle
+        {
+            std::string text;
+            std::size_t anchor;
+        };
+
+        /* data. */
+    private:
+        std::string myPointer;
+        std::string myKey;
+        std::vector<Needle> myNeedles;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Select records where the field at @a pointer equals
+         *  @a value.
+         * @param pointer JSON Pointer to the field, such as @c "/status".
+         * @param value Serialized scalar JSON value, such as @c "\"error\"".
+         *
+         * @throw std::exception @a value is not a scalar JSON value.
+         */
+        Selector (const std::string& pointer, const std::string& value);
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Check, without parsing it, if a record may match.
+         * @param data Serialized record.
+         * @param size Size of @a data, in bytes.
+         * @return @c false if the record certainly does not match.
+         */
+        bool candidate (const char * data, std::size_t size) const;
+
+        /*!
+         * @brief Find the next candidate in a buffer of NDJSON records.
+         * @param data Buffer holding whole records, one per line.
+         * @param size Size of @a data, in bytes.
+         * @param offset Offset in @a data of the line where to start the
+         *  search.  Receives the offset of the line following the
+         *  candidate, or @a size if there is none.
+         * @param length Receives the size of the candidate, without the
+         *  newline.
+         * @return A pointer to the candidate, or @c 0 if there are no more.
+         */
+        const char * next (const char * data, std::size_t size,
+                           std::size_t& offset, std::size_t& length) const;
+
+        /*!
+         * @brief Check if a parsed record matches.
+         * @param record Root of the record.
+         */
+        bool matches (const Any& record) const;
+
+        /*!
+         * @brief Check if a serialized record matches, parsing it only if it
+         *  is a candidate.
+         * @param data Serialized record.
+         * @param size Size of @a data, in bytes.
+         * @param arena Arena in which the record is parsed.  The caller may
+         *  clear it after the call.
+         */
+        bool matches (const char * data, std::size_t size,
+                      Arena& arena) const;
+    };
+
+}
+
+#endif /* _ndjson_hpp__ */
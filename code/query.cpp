@@ -0,0 +1,599 @@
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @internal
+ * @file query.cpp
+ * @brief Compiled filter and projection expressions.
+ */
+
+#include "query.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+    // Fails compilation, pointing at the offending input.
+    void syntax_error (const char * next, const char * what)
+    {
+        std::ostringstream message;
+        message << "Syntax error: " << what;
+        if (*next == '\0') {
+            message << " at end of input.";
+        }
+        else {
+            message << " at '" << next << "'.";
+        }
+        throw (std::runtime_error(message.str()));
+    }
+
+    void skip_spaces (const char *& next)
+    {
+        while ((*next == ' ') || (*next == '\t') ||
+               (*next == '\r') || (*next == '\n'))
+        {
+            ++next;
+        }
+    }
+
+    // Consume `token` (after spaces), if it is next.
+    bool accept (const char *& next, const char * token)
+    {
+        skip_spaces(next);
+        const std::size_t size = std::strlen(token);
+        if (std::strncmp(next, token, size) != 0) {
+            return (false);
+        }
+        next += size;
+        return (true);
+    }
+
+    bool is_name (char c, bool first)
+    {
+        return (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+                (c == '_') || (!first && (c >= '0') && (c <= '9')));
+    }
+
+    void encode_utf8 (unsigned long code, std::string& text)
+    {
+        if (code < 0x80) {
+            text += char(code);
+        }
+        else if (code < 0x800) {
+            text += char(0xc0 | (code >> 6));
+            text += char(0x80 | (code & 0x3f));
+        }
+        else if (code < 0x10000) {
+            text += char(0xe0 | (code >> 12));
+            text += char(0x80 | ((code >> 6) & 0x3f));
+            text += char(0x80 | (code & 0x3f));
+        }
+        else {
+            text += char(0xf0 | (code >> 18));
+            text += char(0x80 | ((code >> 12) & 0x3f));
+            text += char(0x80 | ((code >> 6) & 0x3f));
+            text += char(0x80 | (code & 0x3f));
+        }
+    }
+
+    // Code unit of the "\uXXXX" escape whose 'u' is at `next`.
+    unsigned long code_unit (const char * next)
+    {
+        char digits[5] = { 0 };
+        for (int i=0; (i < 4); ++i)
+        {
+            // strchr() would find the terminator too.
+            if ((next[i+1] == '\0') ||
+                (std::strchr("0123456789abcdefABCDEF", next[i+1]) == 0))
+            {
+                syntax_error(next, "bad escape");
+            }
+            digits[i] = next[i+1];
+        }
+        return (std::strtoul(digits, 0, 16));
+    }
+
+    // JSON string literal, starting at the opening quote.
+    std::string string_literal (const char *& next)
+    {
+        std::string text;
+        for (++next; (*next != '"'); ++next)
+        {
+            if (*next == '\0') {
+                syntax_error(next, "unterminated string");
+            }
+            if (*next != '\\') {
+                text += *next; continue;
+            }
+            switch (*++next)
+            {
+                case 'b': text += '\b'; break;
+                case 'f': text += '\f'; break;
+                case 'n': text += '\n'; break;
+                case 'r': text += '\r'; break;
+                case 't': text += '\t'; break;
+                case 'u': {
+                    // Characters beyond the BMP are escaped as a pair of
+                    // surrogates, which mean nothing on their own.
+                    unsigned long code = code_unit(next);
+                    if ((code >= 0xdc00) && (code <= 0xdfff)) {
+                        syntax_error(next, "lone surrogate");
+                    }
+                    if ((code >= 0xd800) && (code <= 0xdbff))
+                    {
+                        unsigned long low = 0;
+                        if ((next[5] != '\\') || (next[6] != 'u') ||
+                            ((low = code_unit(next+6)) < 0xdc00) ||
+                            (low > 0xdfff))
+                        {
+                            syntax_error(next, "lone surrogate");
+                        }
+                        code = 0x10000 + ((code-0xd800) << 10) +
+                            (low-0xdc00);
+                        next += 6;
+                    }
+                    encode_utf8(code, text);
+                    next += 4;
+                } break;
+                case '\0': {
+                    syntax_error(next, "unterminated string");
+                } break;
+                case '"':
+                case '\\':
+                case '/': {
+                    text += *next;
+                } break;
+                default: {
+                    syntax_error(next, "bad escape");
+                }
+            }
+        }
+        ++next;
+        return (text);
+    }
+
+    // Path, starting at the leading dot.
+    json::Path path_literal (const char *& next)
+    {
+        json::Path path;
+        ++next;
+        if (is_name(*next, true)) {
+            --next;
+        }
+        while (true)
+        {
+            if ((*next == '.') && is_name(next[1], true))
+            {
+                const char *const first = ++next;
+                while (is_name(*next, false)) {
+                    ++next;
+                }
+                path.push_back(std::string(first, next));
+            }
+            else if (*next == '[')
+            {
+                ++next, skip_spaces(next);
+                if (*next == '"') {
+                    path.push_back(string_literal(next));
+                }
+                else
+                {
+                    char * end = 0;
+                    const long index = std::strtol(next, &end, 10);
+                    if ((end == next) || (index < 0)) {
+                        syntax_error(next, "expecting a list index or key");
+                    }
+                    path.push_back(int(index)), next = end;
+                }
+                if (!accept(next, "]")) {
+                    syntax_error(next, "expecting ']'");
+                }
+            }
+            else {
+                break;
+            }
+        }
+        return (path);
+    }
+
+    // Runtime value: a node from the document, a literal, or nothing.
+    struct Value
+    {
+        int type;
+        double number;
+        const char * text;
+        const ::cJSON * node;
+    };
+
+    const int missing = -1;
+
+    const int unordered = 2;
+
+    bool truth (const Value& value)
+    {
+        return ((value.type != missing) && (value.type != cJSON_False) &&
+                (value.type != cJSON_NULL));
+    }
+
+    // -1, 0 or 1 for less, equal or greater, else `unordered`.
+    int compare (const Value& lhs, const Value& rhs)
+    {
+        if ((lhs.type == missing) || (lhs.type != rhs.type)) {
+            return (unordered);
+        }
+        switch (lhs.type)
+        {
+            case cJSON_Number: {
+                return ((lhs.number < rhs.number)? -1 :
+                        (lhs.number > rhs.number)?  1 :
+                        (lhs.number == rhs.number)? 0 : unordered);
+            }
+            case cJSON_String: {
+                const int order = std::strcmp(lhs.text, rhs.text);
+                return ((order < 0)? -1 : (order > 0)? 1 : 0);
+            }
+            case cJSON_False:
+            case cJSON_True:
+            case cJSON_NULL: {
+                return (0);
+            }
+        }
+        return ((lhs.node == rhs.node)? 0 : unordered);
+    }
+
+}
+
+namespace json {
+
+    void Path::push_back (const std::string& key)
+    {
+        const Step step = { key, -1 };
+        mySteps.push_back(step);
+    }
+
+    void Path::push_back (int index)
+    {
+        const Step step = { std::string(), index };
+        mySteps.push_back(step);
+    }
+
+    std::string Path::name () const
+    {
+        if (mySteps.empty()) {
+            return ("value");
+        }
+        if (mySteps.back().index < 0) {
+            return (mySteps.back().key);
+        }
+        std::ostringstream name;
+        name << mySteps.back().index;
+        return (name.str());
+    }
+
+    ::cJSON * Path::resolve (::cJSON * node, std::size_t first) const
+    {
+        std::vector<Step>::const_iterator step = mySteps.begin() + first;
+        for (; ((node != 0) && (step != mySteps.end())); ++step)
+        {
+            if (step->index < 0)
+            {
+                if ((node->type & 255) != cJSON_Object) {
+                    return (0);
+                }
+                const char *const key = step->key.c_str();
+                for (node = node->child; (node != 0); node = node->next)
+                {
+                    if ((node->string[0] == key[0]) &&
+                        (std::strcmp(node->string, key) == 0))
+                    {
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                if ((node->type & 255) != cJSON_Array) {
+                    return (0);
+                }
+                node = node->child;
+                for (int i=0; ((node != 0) && (i < step->index)); ++i) {
+                    node = node->next;
+                }
+            }
+        }
+        return (node);
+    }
+
+    const std::size_t Expression::max_depth;
+
+    Expression::Expression (const std::string& text)
+    {
+        const char * next = text.c_str();
+        disjunction(next, 0);
+        skip_spaces(next);
+        if (*next != '\0') {
+            syntax_error(next, "unexpected input");
+        }
+    }
+
+    bool Expression::matches (const Any& record) const
+    {
+        Value stack[max_depth+1];
+        Value * top = stack - 1;
+        const std::size_t size = myCode.size();
+        for (std::size_t i=0; (i < size); ++i)
+        {
+            const Instruction& instruction = myCode[i];
+            switch (instruction.opcode)
+            {
+                case load_path: {
+                    const ::cJSON *const node =
+                        myPaths[instruction.operand].resolve(record.data());
+                    ++top;
+                    top->type = (node == 0)? missing : (node->type & 255);
+                    top->number = (node == 0)? 0.0 : node->valuedouble;
+                    top->text = (node == 0)? 0 : node->valuestring;
+                    top->node = node;
+                } break;
+                case load_constant: {
+                    const Constant& constant =
+                        myConstants[instruction.operand];
+                    ++top;
+                    top->type = constant.type;
+                    top->number = constant.number;
+                    top->text = constant.text.c_str();
+                    top->node = 0;
+                } break;
+                case equal:
+                case not_equal:
+                case less:
+                case less_equal:
+                case greater:
+                case greater_equal: {
+                    const int order = compare(top[-1], top[0]);
+                    bool result = false;
+                    switch (instruction.opcode)
+                    {
+                        case equal: result = (order == 0); break;
+                        case not_equal: result = (order != 0); break;
+                        case less: result = (order < 0); break;
+                        case less_equal: result = (order <= 0); break;
+                        case greater: result = (order == 1); break;
+                        default: result = ((order == 0) || (order == 1));
+                    }
+                    --top;
+                    top->type = result? cJSON_True : cJSON_False;
+                } break;
+                case negate: {
+                    top->type = truth(*top)? cJSON_False : cJSON_True;
+                } break;
+                case test: {
+                    top->type = truth(*top)? cJSON_True : cJSON_False;
+                } break;
+                case jump_if_false:
+                case jump_if_true: {
+                    const bool value = truth(*top);
+                    if (value == (instruction.opcode == jump_if_true)) {
+                        top->type = value? cJSON_True : cJSON_False;
+                        i = instruction.operand - 1;
+                    }
+                    else {
+                        --top;
+                    }
+                } break;
+            }
+        }
+        return (truth(*top));
+    }
+
+    // disjunction: conjunction ('||' conjunction)*
+    void Expression::disjunction (const char *& next, std::size_t depth)
+    {
+        conjunction(next, depth);
+        std::vector<std::size_t> jumps;
+        while (accept(next, "||"))
+        {
+            jumps.push_back(emit(jump_if_true));
+            conjunction(next, depth);
+            emit(test);
+        }
+        for (std::size_t i=0; (i < jumps.size()); ++i) {
+            myCode[jumps[i]].operand = myCode.size();
+        }
+    }
+
+    // conjunction: negation ('&&' negation)*
+    void Expression::conjunction (const char *& next, std::size_t depth)
+    {
+        negation(next, depth);
+        std::vector<std::size_t> jumps;
+        while (accept(next, "&&"))
+        {
+            jumps.push_back(emit(jump_if_false));
+            negation(next, depth);
+            emit(test);
+        }
+        for (std::size_t i=0; (i < jumps.size()); ++i) {
+            myCode[jumps[i]].operand = myCode.size();
+        }
+    }
+
+    // negation: '!' negation | comparison
+    void Expression::negation (const char *& next, std::size_t depth)
+    {
+        skip_spaces(next);
+        if ((next[0] == '!') && (next[1] != '='))
+        {
+            ++next;
+            if (depth == max_depth) {
+                syntax_error(next, "too deeply nested");
+            }
+            negation(next, depth+1);
+            emit(negate);
+        }
+        else {
+            comparison(next, depth);
+        }
+    }
+
+    // comparison: operand (operator operand)?
+    void Expression::comparison (const char *& next, std::size_t depth)
+    {
+        static const struct {
+            const char * token;
+            Opcode opcode;
+        } operators[] = {
+            { "==", equal },
+            { "!=", not_equal },
+            { "<=", less_equal },
+            { ">=", greater_equal },
+            { "<", less },
+            { ">", greater },
+        };
+        static const int n = sizeof(operators) / sizeof(operators[0]);
+        operand(next, depth);
+        for (int i=0; (i < n); ++i)
+        {
+            if (accept(next, operators[i].token)) {
+                operand(next, depth+1);
+                emit(operators[i].opcode);
+                break;
+            }
+        }
+    }
+
+    // operand: path | literal | '(' disjunction ')'
+    void Expression::operand (const char *& next, std::size_t depth)
+    {
+        if (depth == max_depth) {
+            syntax_error(next, "too deeply nested");
+        }
+        skip_spaces(next);
+        if (*next == '.')
+        {
+            myPaths.push_back(path_literal(next));
+            emit(load_path, myPaths.size()-1);
+            return;
+        }
+        if (*next == '(')
+        {
+            ++next;
+            disjunction(next, depth+1);
+            if (!accept(next, ")")) {
+                syntax_error(next, "expecting ')'");
+            }
+            return;
+        }
+        Constant constant;
+        constant.number = 0.0;
+        if (*next == '"') {
+            constant.type = cJSON_String;
+            constant.text = string_literal(next);
+        }
+        else if (accept(next, "true")) {
+            constant.type = cJSON_True;
+        }
+        else if (accept(next, "false")) {
+            constant.type = cJSON_False;
+        }
+        else if (accept(next, "null")) {
+            constant.type = cJSON_NULL;
+        }
+        else
+        {
+            char * end = 0;
+            constant.type = cJSON_Number;
+            constant.number = std::strtod(next, &end);
+            if (end == next) {
+                syntax_error(next, "expecting a path or a value");
+            }
+            next = end;
+        }
+        myConstants.push_back(constant);
+        emit(load_constant, myConstants.size()-1);
+    }
+
+    std::size_t Expression::emit (Opcode opcode, std::size_t operand)
+    {
+        const Instruction instruction = { opcode, operand };
+        myCode.push_back(instruction);
+        return (myCode.size() - 1);
+    }
+
+    Projection::Projection (const std::string& text)
+    {
+        const char * next = text.c_str();
+        do {
+            skip_spaces(next);
+            if (*next != '.') {
+                syntax_error(next, "expecting a path");
+            }
+            myPaths.push_back(path_literal(next));
+        }
+        while (accept(next, ","));
+        skip_spaces(next);
+        if (*next != '\0') {
+            syntax_error(next, "unexpected input");
+        }
+    }
+
+    bool Projection::get
+        (std::size_t i, const Any& record, Any& value) const
+    {
+        ::cJSON *const node = myPaths[i].resolve(record.data());
+        if (node == 0) {
+            return (false);
+        }
+        value = Any(node);
+        return (true);
+    }
+
+    void Projection::write (std::ostream& stream, const Any& record) const
+    {
+        // Names may hold anything a bracketed key does: escape them.
+        stream << '{';
+        for (std::size_t i=0; (i < myPaths.size()); ++i)
+        {
+            ::cJSON *const node = myPaths[i].resolve(record.data());
+            const std::string name = myPaths[i].name();
+            stream << ((i == 0)? "" : ",");
+            write_string(stream, name.c_str()) << ':';
+            if (node == 0) {
+                stream << "null";
+            }
+            else {
+                stream << Any(node);
+            }
+        }
+        stream << '}';
+    }
+
+}
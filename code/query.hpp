@@ -0,0 +1,291 @@
+#ifndef _query_hpp__
+#define _query_hpp__
+
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file query.hpp
+ * @brief Compiled filter and projection expressions.
+ */
+
+#include "json.hpp"
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace json {
+
+    /*!
+     * @internal
+     * @brief Location of a value in a document, such as @c .user.ids[0].
+     */
+    class Path
+    {
+        /* nested types. */
+    public:
+        struct Step
+        {
+            std::string key;
+            int index;
+        };
+
+        /* data. */
+    private:
+        std::vector<Step> mySteps;
+
+        /* construction. */
+    public:
+        Path ()
+        {}
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Append a map lookup to the path.
+         */
+        void push_back (const std::string& key);
+
+        /*!
+         * @brief Append a list lookup to the path.
+         */
+        void push_back (int index);
+
+        /*!
+         * @brief Obtain a name for the value, from the path's last step.
+         */
+        std::string name () const;
+
+        /*!
+         * @brief Obtain the number of lookups in the path.
+         */
+        std::size_t size () const {
+            return (mySteps.size());
+        }
+
+        /*!
+         * @brief Obtain the lookup at position @a i.
+         */
+        const Step& step (std::size_t i) const {
+            return (mySteps[i]);
+        }
+
+        /*!
+         * @brief Locate the value in @a root.
+         * @param root Value to start from.
+         * @param first Number of lookups to skip, when @a root is the
+         *  result of the first ones.
+         * @return The value, or @c 0 if it does not exist.
+         */
+        ::cJSON * resolve (::cJSON * root, std::size_t first=0) const;
+    };
+
+    /*!
+     * @brief Boolean expression over a document, compiled once and then
+     *  evaluated against any number of documents.
+     *
+     * The syntax is a small subset of jq's:
+     *  - paths: @c . (the root), @c .status, @c .user.id, @c .tags[0] and
+     *    @c .["odd key"];
+     *  - literals: strings, numbers, @c true, @c false and @c null;
+     *  - comparisons: @c ==, @c !=, @c <, @c <=, @c > and @c >=;
+     *  - logic: @c !, @c && and @c ||, with parentheses.
+     *
+     * A path that does not resolve is @e missing: it is false, and compares
+     * unequal to everything.  @c false, @c null and missing values are false;
+     * anything else is true.  Numbers compare numerically and strings
+     * byte-wise; values of different types are never ordered.
+     *
+     * Expressions compile to bytecode for a small stack machine, with keys
+     * and literals decoded ahead of time, so evaluation allocates nothing and
+     * @c && and @c || skip their right-hand side when they can.  Evaluation
+     * does not modify the expression, so threads can share one.
+     *
+     * @code
+     *  const json::Expression filter(".status == \"error\" && .ms > 250");
+     *  if (filter.matches(document.root())) {
+     *      ...
+     *  }
+     * @endcode
+     */
+    class Expression
+    {
+        /* nested types. */
+    private:
+        /*!
+         * @internal
+         * @brief Stack machine instruction.
+         */
+        enum Opcode
+        {
+            load_path,
+            load_constant,
+            equal,
+            not_equal,
+            less,
+            less_equal,
+            greater,
+            greater_equal,
+            negate,
+            test,
+            jump_if_false,
+            jump_if_true
+        };
+
+        /*!
+         * @internal
+         */
+        struct Instruction
+        {
+            Opcode opcode;
+            std::size_t operand;
+        };
+
+        /*!
+         * @internal
+         * @brief Literal value, with the same type codes as @c cJSON.
+         */
+        struct Constant
+        {
+            int type;
+            double number;
+            std::string text;
+        };
+
+        /* class data. */
+    public:
+        /*!
+         * @brief Deepest supported nesting of sub-expressions.
+         */
+        static const std::size_t max_depth = 64;
+
+        /* data. */
+    private:
+        std::vector<Instruction> myCode;
+        std::vector<Path> myPaths;
+        std::vector<Constant> myConstants;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Compile @a text.
+         * @param text Source code of the expression.
+         *
+         * @throw std::runtime_error @a text is not a valid expression.
+         */
+        explicit Expression (const std::string& text);
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Evaluate the expression against a document.
+         * @param record Root of the document.
+         * @return @c true if the expression is true for @a record.
+         */
+        bool matches (const Any& record) const;
+
+    private:
+        void disjunction (const char *& next, std::size_t depth);
+        void conjunction (const char *& next, std::size_t depth);
+        void negation (const char *& next, std::size_t depth);
+        void comparison (const char *& next, std::size_t depth);
+        void operand (const char *& next, std::size_t depth);
+        std::size_t emit (Opcode opcode, std::size_t operand=0);
+    };
+
+    /*!
+     * @brief List of values to extract from documents, such as
+     *  @c ".id, .user.name, .tags[0]".
+     *
+     * Each value is named after its path's last key (or index).
+     */
+    class Projection
+    {
+        /* data. */
+    private:
+        std::vector<Path> myPaths;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Compile @a text, a comma-separated list of paths.
+         * @param text Source code of the projection.
+         *
+         * @throw std::runtime_error @a text is not a valid projection.
+         */
+        explicit Projection (const std::string& text);
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Obtain the number of values in the projection.
+         */
+        std::size_t size () const {
+            return (myPaths.size());
+        }
+
+        /*!
+         * @brief Obtain the name of a value in the projection.
+         * @param i Position of the value in the projection.
+         */
+        std::string name (std::size_t i) const {
+            return (myPaths[i].name());
+        }
+
+        /*!
+         * @internal
+         * @brief Obtain the path to a value in the projection.
+         * @param i Position of the value in the projection.
+         */
+        const Path& path (std::size_t i) const {
+            return (myPaths[i]);
+        }
+
+        /*!
+         * @brief Extract a value from a document.
+         * @param i Position of the value in the projection.
+         * @param record Root of the document.
+         * @param value Receives the value, if it exists.
+         * @return @c true if the value exists.
+         */
+        bool get (std::size_t i, const Any& record, Any& value) const;
+
+        /*!
+         * @brief Write the projected values as a map.
+         * @param stream Output stream.
+         * @param record Root of the document.
+         *
+         * Values that do not exist are written as @c null.
+         */
+        void write (std::ostream& stream, const Any& record) const;
+    };
+
+}
+
+#endif /* _query_hpp__ */
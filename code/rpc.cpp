@@ -0,0 +1,953 @@
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file rpc.cpp
+ * @brief JSON-RPC 2.0 server.
+ */
+
+#include "rpc.hpp"
+#include "internal.hpp"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <ostream>
+#include <set>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+    using json::internal::Appender;
+
+    ::cJSON make_null ()
+    {
+        ::cJSON node;
+        std::memset(&node, 0, sizeof(node));
+        node.type = cJSON_NULL;
+        return (node);
+    }
+
+    // Parameters of requests that have none.
+    ::cJSON null_params = make_null();
+
+    // Map member named exactly `name`, if any.
+    ::cJSON * member (::cJSON * map, const char * name)
+    {
+        for (::cJSON * item = map->child; (item != 0); item = item->next)
+        {
+            if ((item->string != 0) && (std::strcmp(item->string, name) == 0))
+            {
+                return (item);
+            }
+        }
+        return (0);
+    }
+
+    bool is_id (const ::cJSON * id)
+    {
+        return ((id->type == cJSON_String) ||
+                (id->type == cJSON_Number) ||
+                (id->type == cJSON_NULL));
+    }
+
+    void write_error (std::ostream& stream, std::string& output, int code,
+                      const char * message, const char * data, ::cJSON * id)
+    {
+        output.append("{\"jsonrpc\":\"2.0\",\"error\":{\"code\":");
+        stream << code;
+        output.append(",\"message\":");
+        json::write_string(stream, message);
+        if (data != 0) {
+            output.append(",\"data\":");
+            json::write_string(stream, data);
+        }
+        output.append("},\"id\":");
+        if (id != 0) {
+            stream << json::Any(id);
+        }
+        else {
+            output.append("null");
+        }
+        output.push_back('}');
+    }
+
+    bool is_blank (const char * data, std::size_t size)
+    {
+        for (std::size_t i=0; (i < size); ++i)
+        {
+            if ((data[i] != ' ') && (data[i] != '\t') && (data[i] != '\r')) {
+                return (false);
+            }
+        }
+        return (true);
+    }
+
+    const std::size_t scratch_size = 256*1024;
+
+    // Responses are appended to the last buffer while it is this small,
+    // so pipelined requests make for few, large writes.
+    const std::size_t output_size = 64*1024;
+
+    const int max_events = 64;
+
+    const int max_parts = 64;
+
+}
+
+namespace json {
+
+    const std::size_t RpcServer::max_message;
+    const std::size_t RpcServer::parallel_batch;
+
+    struct RpcServer::Connection
+    {
+        int descriptor;
+        std::string input;
+
+        // Pending responses, the first one of which is partly sent.
+        std::deque<std::string> output;
+        std::size_t sent;
+
+        // The peer is done sending, close once all responses are sent.
+        bool closing;
+
+        explicit Connection (int descriptor)
+            : descriptor(descriptor), sent(0), closing(false)
+        {}
+
+        ~Connection ()
+        {
+            ::close(descriptor);
+        }
+
+        // Buffer for the next response.
+        std::string& buffer ()
+        {
+            if (output.empty() || (output.back().size() >= output_size)) {
+                output.push_back(std::string());
+            }
+            return (output.back());
+        }
+
+        // Send as much as the socket takes.  False on errors.
+        bool flush ()
+        {
+            while (!output.empty())
+            {
+                ::iovec parts[max_parts];
+                int count = 0;
+                for (std::deque<std::string>::iterator part = output.begin();
+                     ((part != output.end()) && (count < max_parts));
+                     ++part, ++count)
+                {
+                    const std::size_t skip = (count == 0)? sent : 0;
+                    parts[count].iov_base = &(*part)[0] + skip;
+                    parts[count].iov_len = part->size() - skip;
+                }
+                // Like writev(), but without raising SIGPIPE.
+                ::msghdr message;
+                std::memset(&message, 0, sizeof(message));
+                message.msg_iov = parts;
+                message.msg_iovlen = count;
+                const ::ssize_t size =
+                    ::sendmsg(descriptor, &message, MSG_NOSIGNAL);
+                if (size < 0)
+                {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+                }
+                for (std::size_t left = size; !output.empty();)
+                {
+                    const std::size_t rest = output.front().size() - sent;
+                    if (left < rest) {
+                        sent += left; break;
+                    }
+                    left -= rest, sent = 0, output.pop_front();
+                }
+            }
+            return (true);
+        }
+
+    private:
+        Connection (const Connection&);
+        Connection& operator= (const Connection&);
+    };
+
+    struct RpcServer::Loop
+    {
+        RpcServer& server;
+        int listener;
+        int poll;
+        std::set<Connection*> connections;
+
+        // Messages are parsed here, then in a heap arena if they don't
+        // fit.
+        std::vector<char> scratch;
+        Arena arena;
+
+        Appender buffer;
+        std::ostream stream;
+
+        Statistics statistics;
+        std::string error;
+
+        Loop (RpcServer& server, int listener)
+            : server(server)
+            , listener(listener)
+            , poll(::epoll_create1(EPOLL_CLOEXEC))
+            , scratch(scratch_size)
+            , arena(&scratch[0], scratch.size())
+            , stream(&buffer)
+        {
+            if (poll < 0) {
+                throw (std::runtime_error("Could not create event loop."));
+            }
+            const Statistics empty = { 0, 0, 0, 0, 0 };
+            statistics = empty;
+
+            ::epoll_event event;
+            std::memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN | EPOLLET;
+            event.data.ptr = 0;
+            if (::epoll_ctl(poll, EPOLL_CTL_ADD, listener, &event) != 0) {
+                ::close(poll);
+                throw (std::runtime_error("Could not watch listener."));
+            }
+            event.events = EPOLLIN;
+            event.data.ptr = &server.myWakeup;
+            if (::epoll_ctl(poll, EPOLL_CTL_ADD,
+                            server.myWakeup, &event) != 0)
+            {
+                ::close(poll);
+                throw (std::runtime_error("Could not watch event."));
+            }
+        }
+
+        ~Loop ()
+        {
+            for (std::set<Connection*>::iterator connection =
+                     connections.begin();
+                 (connection != connections.end()); ++connection)
+            {
+                delete *connection;
+            }
+            ::close(poll);
+        }
+
+        void accept ()
+        {
+            for (;;)
+            {
+                const int descriptor = ::accept4(
+                    listener, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (descriptor < 0)
+                {
+                    if ((errno == EINTR) || (errno == ECONNABORTED)) {
+                        continue;
+                    }
+                    // Out of descriptors, or no more pending connections.
+                    return;
+                }
+                const int enable = 1;
+                ::setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY,
+                             &enable, sizeof(enable));
+                Connection *const connection = new Connection(descriptor);
+                ::epoll_event event;
+                std::memset(&event, 0, sizeof(event));
+                event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                event.data.ptr = connection;
+                if (::epoll_ctl(poll, EPOLL_CTL_ADD,
+                                descriptor, &event) != 0)
+                {
+                    delete connection; continue;
+                }
+                connections.insert(connection);
+                ++statistics.connections;
+            }
+        }
+
+        void close (Connection * connection)
+        {
+            connections.erase(connection);
+            delete connection;
+        }
+
+    private:
+        Loop (const Loop&);
+        Loop& operator= (const Loop&);
+    };
+
+    struct RpcServer::Job
+    {
+        const RpcServer * server;
+        ::cJSON * first;
+        std::size_t count;
+        std::string output;
+        Statistics statistics;
+        std::string error;
+        bool done;
+    };
+
+    // Threads that run parts of large batches, for all loops.  Loops run
+    // queued parts too while they wait for theirs, so batches go through
+    // even when no worker could be started.
+    struct RpcServer::Pool
+    {
+        Mutex mutex;
+        Condition changed;
+        std::deque<Job*> queue;
+        bool stopping;
+        std::vector<Thread*> workers;
+
+        explicit Pool (std::size_t size)
+            : stopping(false)
+        {
+            workers.reserve(size);
+            try {
+                for (std::size_t i=0; (i < size); ++i) {
+                    workers.push_back(new Thread(&work, this));
+                }
+            }
+            catch (...) {
+                // Make do with fewer threads.
+            }
+        }
+
+        ~Pool ()
+        {
+            {
+                const Lock _(mutex);
+                stopping = true;
+                changed.broadcast();
+            }
+            for (std::size_t i=0; (i < workers.size()); ++i) {
+                delete workers[i];
+            }
+        }
+
+        // Queue all parts, or none of them.
+        void submit (Job * first, Job * last)
+        {
+            const Lock _(mutex);
+            const std::size_t size = queue.size();
+            try {
+                for (; (first != last); ++first) {
+                    queue.push_back(first);
+                }
+            }
+            catch (...) {
+                queue.resize(size); throw;
+            }
+            changed.broadcast();
+        }
+
+        // Run queued parts until those in [first, last) are done, or until
+        // the pool stops if there are none.
+        void drain (Job * first, Job * last)
+        {
+            for (;;)
+            {
+                Job * job = 0;
+                {
+                    const Lock _(mutex);
+                    while (queue.empty() && !stopping &&
+                           !finished(first, last))
+                    {
+                        changed.wait(mutex);
+                    }
+                    if (finished(first, last) || queue.empty()) {
+                        return;
+                    }
+                    job = queue.front(), queue.pop_front();
+                }
+                dispatch(job);
+                {
+                    const Lock _(mutex);
+                    job->done = true;
+                    changed.broadcast();
+                }
+            }
+        }
+
+        bool finished (const Job * first, const Job * last) const
+        {
+            bool done = (first != last);
+            for (; (done && (first != last)); ++first) {
+                done = first->done;
+            }
+            return (done);
+        }
+
+        static void work (void * context)
+        {
+            static_cast<Pool*>(context)->drain(0, 0);
+        }
+
+    private:
+        Pool (const Pool&);
+        Pool& operator= (const Pool&);
+    };
+
+    RpcServer::RpcServer (const std::string& address, unsigned short port,
+                          unsigned int threads)
+        : myPort(port)
+        , myWakeup(-1)
+        , myPool(0)
+    {
+        const Statistics statistics = { 0, 0, 0, 0, 0 };
+        myStatistics = statistics;
+
+        ::sockaddr_in endpoint;
+        std::memset(&endpoint, 0, sizeof(endpoint));
+        endpoint.sin_family = AF_INET;
+        if (::inet_pton(AF_INET, address.c_str(), &endpoint.sin_addr) != 1)
+        {
+            throw (std::runtime_error("Invalid address '"+address+"'."));
+        }
+        threads = (threads == 0)? processors() : threads;
+        try {
+            myWakeup = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (myWakeup < 0) {
+                throw (std::runtime_error("Could not create event."));
+            }
+            // Each loop gets its own listener, and the kernel spreads new
+            // connections over them.
+            for (unsigned int i=0; (i < threads); ++i)
+            {
+                const int listener = ::socket(
+                    AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if (listener < 0) {
+                    throw (std::runtime_error("Could not create socket."));
+                }
+                myListeners.push_back(listener);
+                const int enable = 1;
+                ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR,
+                             &enable, sizeof(enable));
+                if (::setsockopt(listener, SOL_SOCKET, SO_REUSEPORT,
+                                 &enable, sizeof(enable)) != 0)
+                {
+                    throw (std::runtime_error("Could not share port."));
+                }
+                endpoint.sin_port = htons(myPort);
+                if ((::bind(listener, reinterpret_cast<::sockaddr*>(
+                                &endpoint), sizeof(endpoint)) != 0) ||
+                    (::listen(listener, SOMAXCONN) != 0))
+                {
+                    throw (std::runtime_error("Could not listen on "+
+                                              address+"."));
+                }
+                // The others bind to the port picked for the first one.
+                if (myPort == 0)
+                {
+                    ::socklen_t size = sizeof(endpoint);
+                    ::getsockname(listener, reinterpret_cast<::sockaddr*>(
+                                      &endpoint), &size);
+                    myPort = ntohs(endpoint.sin_port);
+                }
+            }
+        }
+        catch (...)
+        {
+            for (std::size_t i=0; (i < myListeners.size()); ++i) {
+                ::close(myListeners[i]);
+            }
+            if (myWakeup >= 0) {
+                ::close(myWakeup);
+            }
+            throw;
+        }
+    }
+
+    RpcServer::~RpcServer ()
+    {
+        for (std::size_t i=0; (i < myListeners.size()); ++i) {
+            ::close(myListeners[i]);
+        }
+        ::close(myWakeup);
+    }
+
+    void RpcServer::bind (const std::string& name, Method method,
+                          void * context)
+    {
+        const Handler handler = { method, context };
+        myMethods[name] = handler;
+    }
+
+    void RpcServer::run ()
+    {
+        // One loop thread runs each batch's first part.
+        Pool pool(myListeners.size()-1);
+        myPool = &pool;
+        std::vector<Loop*> loops;
+        std::vector<Thread*> running;
+        try {
+            for (std::size_t i=0; (i < myListeners.size()); ++i) {
+                loops.push_back(new Loop(*this, myListeners[i]));
+            }
+            for (std::size_t i=1; (i < loops.size()); ++i) {
+                running.push_back(new Thread(&serve, loops[i]));
+            }
+        }
+        catch (...)
+        {
+            stop();
+            for (std::size_t i=0; (i < running.size()); ++i) {
+                delete running[i];
+            }
+            for (std::size_t i=0; (i < loops.size()); ++i) {
+                delete loops[i];
+            }
+            ::eventfd_t value = 0;
+            ::eventfd_read(myWakeup, &value);
+            myPool = 0;
+            throw;
+        }
+        serve(loops[0]);
+        for (std::size_t i=0; (i < running.size()); ++i) {
+            delete running[i];
+        }
+
+        // Ready to run again.
+        myPool = 0;
+        ::eventfd_t value = 0;
+        ::eventfd_read(myWakeup, &value);
+
+        std::string error;
+        {
+            const Lock _(myMutex);
+            for (std::size_t i=0; (i < loops.size()); ++i)
+            {
+                const Statistics& statistics = loops[i]->statistics;
+                myStatistics.connections += statistics.connections;
+                myStatistics.messages += statistics.messages;
+                myStatistics.requests += statistics.requests;
+                myStatistics.batches += statistics.batches;
+                myStatistics.errors += statistics.errors;
+                if (error.empty()) {
+                    error = loops[i]->error;
+                }
+                delete loops[i];
+            }
+        }
+        if (!error.empty()) {
+            throw (std::runtime_error(error));
+        }
+    }
+
+    void RpcServer::stop ()
+    {
+        ::eventfd_write(myWakeup, 1);
+    }
+
+    RpcServer::Statistics RpcServer::statistics () const
+    {
+        const Lock _(myMutex);
+        return (myStatistics);
+    }
+
+    void RpcServer::serve (void * context)
+    {
+        Loop& loop = *static_cast<Loop*>(context);
+        RpcServer& self = loop.server;
+        try {
+            ::epoll_event events[max_events];
+            for (bool running = true; running;)
+            {
+                const int count =
+                    ::epoll_wait(loop.poll, events, max_events, -1);
+                if ((count < 0) && (errno != EINTR)) {
+                    throw (std::runtime_error("Could not wait for events."));
+                }
+                for (int i=0; (i < count); ++i)
+                {
+                    void *const tag = events[i].data.ptr;
+                    if (tag == &self.myWakeup) {
+                        running = false; continue;
+                    }
+                    if (tag == 0) {
+                        loop.accept(); continue;
+                    }
+                    Connection *const connection =
+                        static_cast<Connection*>(tag);
+                    const ::uint32_t flags = events[i].events;
+                    bool open = ((flags & (EPOLLERR | EPOLLHUP)) == 0);
+                    if (open && ((flags & (EPOLLIN | EPOLLRDHUP)) != 0)) {
+                        open = self.handle(loop, *connection);
+                    }
+                    else if (open) {
+                        open = connection->flush() &&
+                            !(connection->closing &&
+                              connection->output.empty());
+                    }
+                    if (!open) {
+                        loop.close(connection);
+                    }
+                }
+            }
+        }
+        catch (const std::exception& error) {
+            loop.error = error.what();
+        }
+        catch (...) {
+            loop.error = "Unknown error in event loop.";
+        }
+        // The server is only useful with all of its loops.
+        if (!loop.error.empty()) {
+            self.stop();
+        }
+    }
+
+    bool RpcServer::handle (Loop& loop, Connection& connection)
+    {
+        char data[64*1024];
+        while (!connection.closing)
+        {
+            const ::ssize_t size =
+                ::read(connection.descriptor, data, sizeof(data));
+            if (size == 0) {
+                connection.closing = true; break;
+            }
+            if (size < 0)
+            {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                    break;
+                }
+                return (false);
+            }
+            // Serve whole lines, and keep the last, partial one for later.
+            const char * next = data;
+            const char *const last = data + size;
+            if (!connection.input.empty())
+            {
+                const char *const end = static_cast<const char*>(
+                    std::memchr(next, '\n', last-next));
+                if (end == 0) {
+                    connection.input.append(next, last);
+                    if (connection.input.size() > max_message) {
+                        return (false);
+                    }
+                    continue;
+                }
+                connection.input.append(next, end);
+                process(loop, connection,
+                        connection.input.data(), connection.input.size());
+                connection.input.clear();
+                next = end + 1;
+            }
+            for (const char * end; (next < last); next = end+1)
+            {
+                end = static_cast<const char*>(
+                    std::memchr(next, '\n', last-next));
+                if (end == 0) {
+                    break;
+                }
+                process(loop, connection, next, end-next);
+            }
+            connection.input.append(next, last);
+            if (connection.input.size() > max_message) {
+                return (false);
+            }
+        }
+        if (connection.closing && !connection.input.empty()) {
+            process(loop, connection,
+                    connection.input.data(), connection.input.size());
+            connection.input.clear();
+        }
+        return (connection.flush() &&
+                !(connection.closing && connection.output.empty()));
+    }
+
+    void RpcServer::process (Loop& loop, Connection& connection,
+                             const char * data, std::size_t size)
+    {
+        if (is_blank(data, size)) {
+            return;
+        }
+        ++loop.statistics.messages;
+
+        loop.arena.clear();
+        Arena heap;
+        Parser parser(loop.arena, data, size);
+        Parser::Status status = parser.parse();
+        ::cJSON * root = parser.root();
+        if (status == Parser::capacity)
+        {
+            Parser retry(heap, data, size);
+            status = retry.parse(), root = retry.root();
+        }
+
+        std::string& output = connection.buffer();
+        const std::size_t mark = output.size();
+        loop.buffer.target(output), loop.stream.clear();
+        if (status != Parser::complete)
+        {
+            ++loop.statistics.errors;
+            write_error(loop.stream, output,
+                        parse_error, "Parse error", 0, 0);
+        }
+        else if (root->type != cJSON_Array) {
+            respond(root, loop.stream, output, loop.statistics);
+        }
+        else if (root->child == 0)
+        {
+            ++loop.statistics.batches, ++loop.statistics.errors;
+            write_error(loop.stream, output,
+                        invalid_request, "Invalid Request", 0, 0);
+        }
+        else
+        {
+            ++loop.statistics.batches;
+            std::size_t count = 0;
+            for (::cJSON * item = root->child; (item != 0); item = item->next)
+            {
+                ++count;
+            }
+
+            // Split large batches in runs of requests, one per thread.
+            std::vector<Job> jobs(std::max<std::size_t>(1, std::min(
+                myListeners.size(),
+                (count < parallel_batch)? 1 : count*2/parallel_batch)));
+            ::cJSON * item = root->child;
+            for (std::size_t i=0; (i < jobs.size()); ++i)
+            {
+                const Statistics statistics = { 0, 0, 0, 0, 0 };
+                jobs[i].server = this;
+                jobs[i].first = item;
+                jobs[i].count = count/jobs.size() +
+                    ((i < count%jobs.size())? 1 : 0);
+                jobs[i].statistics = statistics;
+                jobs[i].done = false;
+                for (std::size_t j=0; (j < jobs[i].count); ++j) {
+                    item = item->next;
+                }
+            }
+            if (jobs.size() == 1) {
+                jobs[0].output.swap(output);
+                dispatch(&jobs[0]);
+                jobs[0].output.swap(output);
+            }
+            else
+            {
+                Job *const first = &jobs[0];
+                Job *const last = first + jobs.size();
+                bool queued = true;
+                try {
+                    myPool->submit(first+1, last);
+                }
+                catch (...) {
+                    queued = false;
+                }
+                if (queued) {
+                    dispatch(first), first->done = true;
+                    myPool->drain(first, last);
+                }
+                else
+                {
+                    // Serve the batch all the same, in this thread.
+                    for (Job * job = first; (job != last); ++job) {
+                        dispatch(job);
+                    }
+                }
+            }
+
+            for (std::size_t i=0; (i < jobs.size()); ++i)
+            {
+                if (!jobs[i].error.empty()) {
+                    throw (std::runtime_error(jobs[i].error));
+                }
+                loop.statistics.requests += jobs[i].statistics.requests;
+                loop.statistics.errors += jobs[i].statistics.errors;
+            }
+
+            // Hand the runs of responses over as they are, between
+            // brackets and commas: they're gathered when sent.
+            if (jobs.size() == 1)
+            {
+                if (output.size() > mark) {
+                    output.insert(mark, 1, '['), output.push_back(']');
+                }
+            }
+            else
+            {
+                bool empty = true;
+                for (std::size_t i=0; (i < jobs.size()); ++i)
+                {
+                    if (jobs[i].output.empty()) {
+                        continue;
+                    }
+                    connection.buffer().push_back(empty? '[' : ',');
+                    connection.output.push_back(std::string());
+                    connection.output.back().swap(jobs[i].output);
+                    empty = false;
+                }
+                if (!empty) {
+                    connection.buffer().append("]\n");
+                }
+                return;
+            }
+        }
+        if (output.size() > mark) {
+            output.push_back('\n');
+        }
+    }
+
+    void RpcServer::dispatch (void * context)
+    {
+        Job& job = *static_cast<Job*>(context);
+        try {
+            Appender buffer;
+            std::ostream stream(&buffer);
+            buffer.target(job.output);
+            const std::size_t start = job.output.size();
+            ::cJSON * item = job.first;
+            for (std::size_t i=0; (i < job.count); ++i, item = item->next)
+            {
+                const std::size_t mark = job.output.size();
+                if (mark > start) {
+                    job.output.push_back(',');
+                }
+                stream.clear();
+                job.server->respond(item, stream, job.output, job.statistics);
+                if (job.output.size() == mark+1) {
+                    job.output.resize(mark);
+                }
+            }
+        }
+        catch (const std::exception& error) {
+            job.error = error.what();
+        }
+        catch (...) {
+            job.error = "Unknown error in batch.";
+        }
+    }
+
+    void RpcServer::respond (::cJSON * request, std::ostream& stream,
+                             std::string& output,
+                             Statistics& statistics) const
+    {
+        ++statistics.requests;
+        if (request->type != cJSON_Object)
+        {
+            ++statistics.errors;
+            write_error(stream, output,
+                        invalid_request, "Invalid Request", 0, 0);
+            return;
+        }
+        ::cJSON *const version = member(request, "jsonrpc");
+        ::cJSON *const method = member(request, "method");
+        ::cJSON * params = member(request, "params");
+        ::cJSON *const id = member(request, "id");
+        if ((id != 0) && !is_id(id))
+        {
+            ++statistics.errors;
+            write_error(stream, output,
+                        invalid_request, "Invalid Request", 0, 0);
+            return;
+        }
+        if ((version == 0) || (version->type != cJSON_String) ||
+            (std::strcmp(version->valuestring, "2.0") != 0) ||
+            (method == 0) || (method->type != cJSON_String) ||
+            ((params != 0) && (params->type != cJSON_Array) &&
+             (params->type != cJSON_Object)))
+        {
+            ++statistics.errors;
+            write_error(stream, output,
+                        invalid_request, "Invalid Request", 0, id);
+            return;
+        }
+        params = (params == 0)? &null_params : params;
+
+        const std::map<std::string, Handler>::const_iterator handler =
+            myMethods.find(method->valuestring);
+        if (handler == myMethods.end())
+        {
+            ++statistics.errors;
+            if (id != 0) {
+                write_error(stream, output, method_not_found,
+                            "Method not found", 0, id);
+            }
+            return;
+        }
+
+        // Notifications get no response, not even on errors.
+        const std::size_t mark = output.size();
+        if (id != 0) {
+            output.append("{\"jsonrpc\":\"2.0\",\"result\":");
+        }
+        const std::size_t start = output.size();
+        try {
+            handler->second.method(
+                Any(params), stream, handler->second.context);
+        }
+        catch (const Error& error)
+        {
+            output.resize(mark), stream.clear(), ++statistics.errors;
+            if (id != 0) {
+                write_error(stream, output,
+                            error.code(), error.what(), 0, id);
+            }
+            return;
+        }
+        catch (const std::exception& error)
+        {
+            output.resize(mark), stream.clear(), ++statistics.errors;
+            if (id != 0) {
+                write_error(stream, output, internal_error,
+                            "Internal error", error.what(), id);
+            }
+            return;
+        }
+        if (id == 0) {
+            output.resize(mark); return;
+        }
+        if (output.size() == start) {
+            output.append("null");
+        }
+        output.append(",\"id\":");
+        stream << Any(id);
+        output.push_back('}');
+    }
+
+}
+
+#endif
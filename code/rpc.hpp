@@ -0,0 +1,294 @@
+#ifndef _rpc_hpp__
+#define _rpc_hpp__
+
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file rpc.hpp
+ * @brief JSON-RPC 2.0 server.
+ */
+
+#include "json.hpp"
+#include "thread.hpp"
+
+#include <cstddef>
+#include <iosfwd>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+
+namespace json {
+
+    /*!
+     * @brief JSON-RPC 2.0 server over TCP, with one message (a request or
+     *  a batch of requests) per line.
+     *
+     * Each thread runs its own edge-triggered @c epoll loop on its own
+     * listening socket, all bound to the same port with @c SO_REUSEPORT,
+     * so the kernel spreads connections over the threads and they share
+     * nothing but the method table.  Requests are parsed with @c Parser,
+     * into a scratch arena that is reused from one message to the next.
+     * Responses are serialized straight into per-connection buffers and
+     * sent with scatter-gather writes.
+     *
+     * Batches of at least @c parallel_batch requests are split over a pool
+     * of threads started with the loops, and the responses are sent in
+     * request order.  The loop runs parts of the batch too while it waits
+     * for the whole of it, so methods should not block.
+     *
+     * @code
+     *  void add (const json::Any& params, std::ostream& result, void *)
+     *  {
+     *      const json::List operands(params);
+     *      result << (double(operands[0]) + double(operands[1]));
+     *  }
+     *
+     *  json::RpcServer server("127.0.0.1", 8080);
+     *  server.bind("add", &add);
+     *  server.run();
+     * @endcode
+     */
+    class RpcServer
+    {
+        /* nested types. */
+    public:
+        /*!
+         * @brief Method implementation.
+         * @param params The request's parameters (a list or a map), or
+         *  @c null when the request has none.
+         * @param result Stream to which the method serializes its result.
+         *  Nothing written means a @c null result.
+         * @param context Pointer given to @c bind().
+         *
+         * @throw RpcServer::Error The request fails with that error.
+         * @throw std::exception The request fails with an "internal error"
+         *  response, which includes @c what().
+         *
+         * @note Methods are called from several threads at once.
+         */
+        typedef void(*Method)(const Any& params, std::ostream& result,
+                              void * context);
+
+        /*!
+         * @brief Error response raised by a method.
+         */
+        class Error :
+            public std::runtime_error
+        {
+            /* data. */
+        private:
+            int myCode;
+
+            /* construction. */
+        public:
+            /*!
+             * @param code JSON-RPC error code (e.g. @c invalid_params).
+             * @param message Short description of the error.
+             */
+            Error (int code, const std::string& message)
+                : std::runtime_error(message), myCode(code)
+            {}
+
+            /* methods. */
+        public:
+            /*!
+             * @brief Obtain the JSON-RPC error code.
+             */
+            int code () const {
+                return (myCode);
+            }
+        };
+
+        /*!
+         * @brief Error codes defined by the JSON-RPC 2.0 specification.
+         */
+        enum Code
+        {
+            parse_error = -32700,
+            invalid_request = -32600,
+            method_not_found = -32601,
+            invalid_params = -32602,
+            internal_error = -32603
+        };
+
+        /*!
+         * @brief Counts of work done by the server.
+         */
+        struct Statistics
+        {
+            /*!
+             * @brief Number of connections accepted.
+             */
+            unsigned long long connections;
+
+            /*!
+             * @brief Number of messages received (requests and batches).
+             */
+            unsigned long long messages;
+
+            /*!
+             * @brief Number of requests, including those in batches.
+             */
+            unsigned long long requests;
+
+            /*!
+             * @brief Number of batches.
+             */
+            unsigned long long batches;
+
+            /*!
+             * @brief Number of error responses, including errors in
+             *  notifications, which get no response.
+             */
+            unsigned long long errors;
+        };
+
+        /*!
+         * @brief Size of the largest message accepted.  Connections that
+         *  send longer lines are closed.
+         */
+        static const std::size_t max_message = 16*1024*1024;
+
+        /*!
+         * @brief Number of requests in a batch above which it is split
+         *  over several threads.
+         */
+        static const std::size_t parallel_batch = 64;
+
+    private:
+        struct Handler
+        {
+            Method method;
+            void * context;
+        };
+
+        struct Loop;
+        struct Connection;
+        struct Job;
+        struct Pool;
+
+        /* data. */
+    private:
+        std::vector<int> myListeners;
+        unsigned short myPort;
+        int myWakeup;
+        std::map<std::string, Handler> myMethods;
+        Pool * myPool;
+        mutable Mutex myMutex;
+        Statistics myStatistics;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Start listening for connections.
+         * @param address IPv4 address of the interface to listen on.
+         * @param port Port to listen on, @c 0 for any free port.
+         * @param threads Number of event loops, @c 0 for one per
+         *  processor.
+         *
+         * @throw std::runtime_error The sockets cannot be bound.
+         */
+        RpcServer (const std::string& address, unsigned short port,
+                   unsigned int threads=0);
+
+    private:
+        RpcServer (const RpcServer&);
+
+    public:
+        /*!
+         * @brief Close the listening sockets.
+         */
+        ~RpcServer ();
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Obtain the port the server listens on.
+         */
+        unsigned short port () const {
+            return (myPort);
+        }
+
+        /*!
+         * @brief Register @a method under @a name.
+         * @param name Method name used in requests.
+         * @param method Method implementation.
+         * @param context Pointer passed to @a method on each call.
+         *
+         * @pre The server is not running.
+         */
+        void bind (const std::string& name, Method method, void * context=0);
+
+        /*!
+         * @brief Serve requests until @c stop() is called.
+         *
+         * The calling thread runs one of the event loops.  Connections
+         * still open when the loops stop are closed, and the server can
+         * then be run again.
+         *
+         * @throw std::runtime_error The event loops could not be started.
+         */
+        void run ();
+
+        /*!
+         * @brief Make @c run() return.
+         *
+         * @note This is safe to call from any thread and from signal
+         *  handlers.
+         */
+        void stop ();
+
+        /*!
+         * @brief Report work done by the server's loops, up to the last
+         *  time @c run() returned.
+         */
+        Statistics statistics () const;
+
+    private:
+        static void serve (void * context);
+        static void dispatch (void * context);
+
+        bool handle (Loop& loop, Connection& connection);
+        void process (Loop& loop, Connection& connection,
+                      const char * data, std::size_t size);
+        void respond (::cJSON * request, std::ostream& stream,
+                      std::string& output, Statistics& statistics) const;
+
+        /* operators. */
+    private:
+        RpcServer& operator= (const RpcServer&);
+    };
+
+}
+
+#endif
+
+#endif /* _rpc_hpp__ */
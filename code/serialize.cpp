@@ -0,0 +1,291 @@
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file serialize.cpp
+ * @brief Serialization of large documents on several threads.
+ */
+
+#include "serialize.hpp"
+#include "thread.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // Lists and maps with at least this many items are cut in runs.
+    const std::size_t min_items = 64;
+
+    // Largest number of items in a run.
+    const std::size_t max_run = 4096;
+
+    // Lists and maps with fewer items are walked into this deep at most.
+    const int max_depth = 3;
+
+    // Number of runs per thread in memory at once.
+    const std::size_t window = 4;
+
+    // Text before a run of items, and the items.
+    struct Job
+    {
+        std::string text;
+
+        // Either `count` items starting at `first`, or just `first`.
+        ::cJSON * first;
+        std::size_t count;
+        bool items;
+
+        std::stringbuf * output;
+        bool done;
+    };
+
+    struct Plan
+    {
+        std::vector<Job> jobs;
+        std::ostringstream text;
+        std::size_t threads;
+    };
+
+    bool is_container (const ::cJSON * node)
+    {
+        return ((node->type == cJSON_Array) || (node->type == cJSON_Object));
+    }
+
+    void write_key (std::ostream& stream, const char * key)
+    {
+        json::write_string(stream, key) << ':';
+    }
+
+    void add_job (Plan& plan, ::cJSON * first, std::size_t count, bool items)
+    {
+        const Job job = { plan.text.str(), first, count, items, 0, false };
+        plan.jobs.push_back(job);
+        plan.text.str("");
+    }
+
+    // Cut `node` in jobs, with the text between them.
+    void split (Plan& plan, ::cJSON * node, int depth)
+    {
+        if (!is_container(node)) {
+            plan.text << json::Any(node); return;
+        }
+        std::size_t count = 0;
+        for (::cJSON * item = node->child; (item != 0); item = item->next) {
+            ++count;
+        }
+        const bool map = (node->type == cJSON_Object);
+        if ((count < min_items) && (depth == max_depth)) {
+            add_job(plan, node, 1, false); return;
+        }
+        plan.text << (map? '{' : '[');
+        ::cJSON * item = node->child;
+        if (count < min_items)
+        {
+            for (; (item != 0); item = item->next)
+            {
+                if (item != node->child) {
+                    plan.text << ',';
+                }
+                if (map) {
+                    write_key(plan.text, item->string);
+                }
+                split(plan, item, depth+1);
+            }
+        }
+        else
+        {
+            // Make about `window` runs per thread.
+            const std::size_t run = std::max<std::size_t>(1, std::min(
+                max_run, count/(plan.threads*window)));
+            for (std::size_t i=0; (i < count); i += run)
+            {
+                if (i > 0) {
+                    plan.text << ',';
+                }
+                const std::size_t size = std::min(run, count-i);
+                add_job(plan, item, size, true);
+                for (std::size_t j=0; (j < size); ++j) {
+                    item = item->next;
+                }
+            }
+        }
+        plan.text << (map? '}' : ']');
+    }
+
+    // Serialize `job` like operator<< does.
+    void run (Job& job)
+    {
+        std::ostream stream(job.output);
+        if (!job.items) {
+            stream << json::Any(job.first); return;
+        }
+        ::cJSON * item = job.first;
+        for (std::size_t i=0; (i < job.count); ++i, item = item->next)
+        {
+            if (i > 0) {
+                stream << ',';
+            }
+            if (item->string != 0) {
+                write_key(stream, item->string);
+            }
+            stream << json::Any(item);
+        }
+    }
+
+    struct Shared
+    {
+        std::vector<Job> * jobs;
+        std::size_t next;
+        std::size_t written;
+        std::size_t window;
+        std::string error;
+        json::Mutex mutex;
+        json::Condition changed;
+    };
+
+    void work (void * context)
+    {
+        Shared& shared = *static_cast<Shared*>(context);
+        std::vector<Job>& jobs = *shared.jobs;
+        while (true)
+        {
+            std::size_t index = 0;
+            {
+                const json::Lock _(shared.mutex);
+                while ((shared.next < jobs.size()) &&
+                       (shared.next >= shared.written + shared.window))
+                {
+                    shared.changed.wait(shared.mutex);
+                }
+                if (shared.next == jobs.size()) {
+                    return;
+                }
+                index = shared.next++;
+            }
+            std::string error;
+            try {
+                run(jobs[index]);
+            }
+            catch (const std::exception& failure) {
+                error = failure.what();
+            }
+            catch (...) {
+                error = "Unknown error.";
+            }
+            {
+                const json::Lock _(shared.mutex);
+                jobs[index].done = true;
+                if (!error.empty()) {
+                    shared.error = error, shared.next = jobs.size();
+                }
+                shared.changed.broadcast();
+            }
+        }
+    }
+
+}
+
+namespace json {
+
+    std::ostream& serialize (std::ostream& stream, const Any& value,
+                             unsigned int threads)
+    {
+        threads = (threads == 0)? processors() : threads;
+        Plan plan;
+        plan.threads = threads;
+        if (threads > 1) {
+            split(plan, value.data(), 0);
+        }
+        if (plan.jobs.size() < 2) {
+            return (stream << value);
+        }
+
+        std::vector<Job>& jobs = plan.jobs;
+        Shared shared;
+        shared.jobs = &jobs;
+        shared.next = shared.written = 0;
+        shared.window = threads*window;
+        std::vector<Thread*> running;
+        try {
+            for (std::size_t i=0; (i < jobs.size()); ++i) {
+                jobs[i].output = new std::stringbuf();
+            }
+            for (unsigned int i=0; (i < threads); ++i) {
+                running.push_back(new Thread(&work, &shared));
+            }
+
+            // Write the runs in order, as they are done.
+            for (std::size_t i=0; (i < jobs.size()); ++i)
+            {
+                stream << jobs[i].text;
+                {
+                    const Lock _(shared.mutex);
+                    while (!jobs[i].done) {
+                        shared.changed.wait(shared.mutex);
+                    }
+                    if (!shared.error.empty()) {
+                        throw (std::runtime_error(shared.error));
+                    }
+                }
+                // Runs are never empty.
+                stream << jobs[i].output;
+                delete jobs[i].output, jobs[i].output = 0;
+                {
+                    const Lock _(shared.mutex);
+                    shared.written = i+1;
+                    shared.changed.broadcast();
+                }
+            }
+            stream << plan.text.str();
+        }
+        catch (...)
+        {
+            {
+                const Lock _(shared.mutex);
+                shared.next = jobs.size();
+                shared.changed.broadcast();
+            }
+            for (std::size_t i=0; (i < running.size()); ++i) {
+                delete running[i];
+            }
+            for (std::size_t i=0; (i < jobs.size()); ++i) {
+                delete jobs[i].output;
+            }
+            throw;
+        }
+        for (std::size_t i=0; (i < running.size()); ++i) {
+            delete running[i];
+        }
+        return (stream);
+    }
+
+}
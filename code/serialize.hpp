@@ -0,0 +1,65 @@
+#ifndef _serialize_hpp__
+#define _serialize_hpp__
+
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file serialize.hpp
+ * @brief Serialization of large documents on several threads.
+ */
+
+#include "json.hpp"
+
+#include <iosfwd>
+
+namespace json {
+
+    /*!
+     * @brief Serialize @a value on several threads.
+     * @param stream The output stream.
+     * @param value The value to serialize.
+     * @param threads Number of threads, @c 0 for one per processor.
+     * @return @a stream
+     *
+     * Lists and maps with many items are cut into runs of items, which
+     * are serialized into separate buffers at the same time and written
+     * in order, while the following ones are serialized.  Lists and maps
+     * with few items are walked into, so a large list below a small map
+     * is cut too.  Only a few runs are kept in memory at once.
+     *
+     * The text is exactly what @c operator<< writes, which is also used
+     * for small values and when @a threads is 1.
+     *
+     * @throw std::exception A thread could not be started.
+     */
+    std::ostream& serialize (std::ostream& stream, const Any& value,
+                             unsigned int threads=0);
+
+}
+
+#endif /* _serialize_hpp__ */
@@ -0,0 +1,392 @@
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file shared.cpp
+ * @brief Documents shared between processes through shared memory.
+ */
+
+#include "shared.hpp"
+
+#ifndef _WIN32
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+    const char magic[8] = { 'J','S','O','N','X','X','S','D' };
+
+    const unsigned long long version = 1;
+
+    // A new, anonymous segment: a memfd, or a POSIX shared memory object
+    // that is unlinked right away so the descriptor is all that refers to
+    // it.
+    int create_segment ()
+    {
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+        const int descriptor =
+            ::memfd_create("jsonxx", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (descriptor >= 0) {
+            return (descriptor);
+        }
+#endif
+        char name[64];
+        for (int attempt=0; (attempt < 16); ++attempt)
+        {
+            std::sprintf(name, "/jsonxx-%ld-%lx-%d", long(::getpid()),
+                         static_cast<unsigned long>(
+                             reinterpret_cast<std::size_t>(name)), attempt);
+            const int descriptor =
+                ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (descriptor >= 0) {
+                ::shm_unlink(name);
+                return (descriptor);
+            }
+            if (errno != EEXIST) {
+                break;
+            }
+        }
+        throw (std::runtime_error("Could not create shared memory."));
+    }
+
+    // Move a link from the creating process' mapping at `from` to ours at
+    // `to`, checking that it points within the segment.
+    template<typename T>
+    bool adjust (T *& pointer, std::size_t from, std::size_t size,
+                 std::size_t to)
+    {
+        if (pointer == 0) {
+            return (true);
+        }
+        const std::size_t offset =
+            reinterpret_cast<std::size_t>(pointer) - from;
+        if ((size < sizeof(T)) || (offset > (size - sizeof(T)))) {
+            return (false);
+        }
+        if (from != to) {
+            pointer = reinterpret_cast<T*>(to + offset);
+        }
+        return (true);
+    }
+
+}
+
+namespace json {
+
+    struct SharedDocument::Header
+    {
+        char magic[8];
+        unsigned long long version;
+
+        // Address of the segment in the creating process.
+        unsigned long long base;
+
+        // Offset of the root node.
+        unsigned long long root;
+
+        // Number of bytes used, header included.
+        unsigned long long size;
+    };
+
+    SharedDocument::SharedDocument (const char * data, std::size_t size)
+        : myDescriptor(create_segment())
+        , myBase(0)
+        , mySize(0)
+        , myRoot(0)
+        , myRelocated(false)
+    {
+        try {
+            // Parsed text never takes more than 64 bytes per byte (one node
+            // per digit of "[0,0,...]").  Untouched pages of the segment
+            // cost nothing, and the unused ones are given back below.
+            const std::size_t capacity = sizeof(Header) + 64*(size+1);
+            if (::ftruncate(myDescriptor, capacity) != 0) {
+                throw (std::runtime_error("Could not size shared memory."));
+            }
+            void *const base = ::mmap(0, capacity, PROT_READ|PROT_WRITE,
+                                      MAP_SHARED, myDescriptor, 0);
+            if (base == MAP_FAILED) {
+                throw (std::runtime_error("Could not map shared memory."));
+            }
+            myBase = static_cast<char*>(base), mySize = capacity;
+
+            Arena arena(myBase+sizeof(Header), capacity-sizeof(Header));
+            Parser parser(arena, data, size);
+            if (parser.parse() != Parser::complete) {
+                throw (std::runtime_error("Invalid JSON."));
+            }
+            myRoot = parser.root();
+
+            Header header;
+            std::memcpy(header.magic, magic, sizeof(magic));
+            header.version = version;
+            header.base = reinterpret_cast<std::size_t>(myBase);
+            header.root = reinterpret_cast<char*>(myRoot) - myBase;
+            header.size = sizeof(Header) + arena.size();
+            std::memcpy(myBase, &header, sizeof(header));
+            const std::size_t page = ::sysconf(_SC_PAGESIZE);
+            const std::size_t mapped =
+                ((header.size + page - 1) / page) * page;
+            if (mapped < capacity) {
+                ::munmap(myBase+mapped, capacity-mapped);
+            }
+            mySize = header.size;
+            if (::ftruncate(myDescriptor, mySize) != 0) {
+                throw (std::runtime_error("Could not seal shared memory."));
+            }
+            // The links point here, so map it read-only at the same
+            // address.  Any shared mapping of a writable descriptor would
+            // keep the segment from being sealed against writes, but a
+            // private one never written to sees the same pages.
+            if (::mmap(myBase, mySize, PROT_READ, MAP_PRIVATE|MAP_FIXED,
+                       myDescriptor, 0) != myBase)
+            {
+                throw (std::runtime_error("Could not seal shared memory."));
+            }
+#ifdef F_SEAL_WRITE
+            // Readers then can't be cut short by a truncation, nor see
+            // nodes change under them.  The shm_open() fallback can't be
+            // sealed at all.
+            if ((::fcntl(myDescriptor, F_ADD_SEALS, F_SEAL_SHRINK|
+                         F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL) != 0) &&
+                (errno != EINVAL))
+            {
+                throw (std::runtime_error("Could not seal shared memory."));
+            }
+#endif
+        }
+        catch (...)
+        {
+            if (myBase != 0) {
+                ::munmap(myBase, mySize);
+            }
+            ::close(myDescriptor);
+            throw;
+        }
+    }
+
+    SharedDocument::SharedDocument (int descriptor)
+        : myDescriptor(descriptor)
+        , myBase(0)
+        , mySize(0)
+        , myRoot(0)
+        , myRelocated(false)
+    {
+        try {
+            struct ::stat status;
+            Header header;
+            if ((::fstat(myDescriptor, &status) != 0) ||
+                (std::size_t(status.st_size) < sizeof(Header)) ||
+                (::pread(myDescriptor, &header, sizeof(header), 0)
+                 != ssize_t(sizeof(header))) ||
+                (std::memcmp(header.magic, magic, sizeof(magic)) != 0) ||
+                (header.version != version) ||
+                (header.size > std::size_t(status.st_size)) ||
+                (header.root < sizeof(Header)) ||
+                (header.root+sizeof(::cJSON) > header.size))
+            {
+                throw (std::runtime_error("Not a shared document."));
+            }
+            mySize = header.size;
+
+            // Segments that can be sealed must be, else any process
+            // holding one could still change it.  The others get their
+            // links checked wherever they are mapped.
+            bool sealed = false;
+#ifdef F_SEAL_WRITE
+            const int seals = ::fcntl(myDescriptor, F_GET_SEALS);
+            if ((seals < 0) && (errno != EINVAL)) {
+                throw (std::runtime_error("Could not open shared memory."));
+            }
+            sealed = (seals >= 0);
+            if (sealed && (((seals & F_SEAL_WRITE) == 0) ||
+                           ((seals & F_SEAL_SHRINK) == 0)))
+            {
+                throw (std::runtime_error("Shared document is not sealed."));
+            }
+#endif
+
+            // Where the links point to, if the address is free.  Nothing
+            // writes to it, so a private mapping sees the shared pages.
+            char *const wanted = reinterpret_cast<char*>(header.base);
+            int flags = MAP_PRIVATE;
+#ifdef MAP_FIXED_NOREPLACE
+            flags |= MAP_FIXED_NOREPLACE;
+#endif
+            void * base = ::mmap(wanted, mySize, PROT_READ,
+                                 flags, myDescriptor, 0);
+            if ((base != MAP_FAILED) && (base != wanted)) {
+                ::munmap(base, mySize), base = MAP_FAILED;
+            }
+            if (base != MAP_FAILED)
+            {
+                myBase = wanted;
+                if (!sealed) {
+                    myRoot = reinterpret_cast< ::cJSON*>(
+                        myBase + header.root);
+                    relocate(wanted);
+                }
+            }
+            else
+            {
+                base = ::mmap(0, mySize, PROT_READ|PROT_WRITE,
+                              MAP_PRIVATE, myDescriptor, 0);
+                if (base == MAP_FAILED) {
+                    throw (std::runtime_error(
+                        "Could not map shared memory."));
+                }
+                myBase = static_cast<char*>(base);
+                myRoot = reinterpret_cast< ::cJSON*>(myBase + header.root);
+                relocate(wanted);
+                ::mprotect(myBase, mySize, PROT_READ);
+                myRelocated = true;
+            }
+            myRoot = reinterpret_cast< ::cJSON*>(myBase + header.root);
+        }
+        catch (...)
+        {
+            if (myBase != 0) {
+                ::munmap(myBase, mySize);
+            }
+            ::close(myDescriptor);
+            throw;
+        }
+    }
+
+    SharedDocument::~SharedDocument ()
+    {
+        ::munmap(myBase, mySize);
+        ::close(myDescriptor);
+    }
+
+    int SharedDocument::receive (int socket)
+    {
+        char byte = 0;
+        ::iovec data = { &byte, 1 };
+        union {
+            ::cmsghdr header;
+            char buffer[CMSG_SPACE(sizeof(int))];
+        } control;
+        std::memset(&control, 0, sizeof(control));
+        ::msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &data, message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+        flags |= MSG_CMSG_CLOEXEC;
+#endif
+        ssize_t received = 0;
+        do {
+            received = ::recvmsg(socket, &message, flags);
+        }
+        while ((received < 0) && (errno == EINTR));
+        const ::cmsghdr *const header = CMSG_FIRSTHDR(&message);
+        if ((received != 1) || (header == 0) ||
+            (header->cmsg_level != SOL_SOCKET) ||
+            (header->cmsg_type != SCM_RIGHTS) ||
+            (header->cmsg_len != CMSG_LEN(sizeof(int))))
+        {
+            throw (std::runtime_error("Could not receive shared document."));
+        }
+        int descriptor = -1;
+        std::memcpy(&descriptor, CMSG_DATA(header), sizeof(descriptor));
+        return (descriptor);
+    }
+
+    void SharedDocument::send (int socket) const
+    {
+        char byte = 0;
+        ::iovec data = { &byte, 1 };
+        union {
+            ::cmsghdr header;
+            char buffer[CMSG_SPACE(sizeof(int))];
+        } control;
+        std::memset(&control, 0, sizeof(control));
+        ::msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &data, message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        ::cmsghdr *const header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(header), &myDescriptor, sizeof(myDescriptor));
+        ssize_t sent = 0;
+        do {
+            sent = ::sendmsg(socket, &message, 0);
+        }
+        while ((sent < 0) && (errno == EINTR));
+        if (sent != 1) {
+            throw (std::runtime_error("Could not send shared document."));
+        }
+    }
+
+    // Move every link from the creating process' mapping at `base` to
+    // ours, visiting each node once.  When `base` is ours, only check
+    // that the links stay within the segment.
+    void SharedDocument::relocate (char * base)
+    {
+        const std::size_t from = reinterpret_cast<std::size_t>(base);
+        const std::size_t to = reinterpret_cast<std::size_t>(myBase);
+        std::vector< ::cJSON*> stack(1, myRoot);
+        while (!stack.empty())
+        {
+            ::cJSON *const node = stack.back();
+            stack.pop_back();
+            if (!adjust(node->next, from, mySize, to) ||
+                !adjust(node->prev, from, mySize, to) ||
+                !adjust(node->child, from, mySize, to) ||
+                !adjust(node->string, from, mySize, to) ||
+                !adjust(node->valuestring, from, mySize, to))
+            {
+                throw (std::runtime_error("Corrupt shared document."));
+            }
+            if (node->next != 0) {
+                stack.push_back(node->next);
+            }
+            if (node->child != 0) {
+                stack.push_back(node->child);
+            }
+        }
+    }
+
+}
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef _shared_hpp__
+#define _shared_hpp__
+
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file shared.hpp
+ * @brief Documents shared between processes through shared memory.
+ */
+
+#include "json.hpp"
+
+#include <cstddef>
+
+#ifndef _WIN32
+
+namespace json {
+
+    /*!
+     * @brief Document parsed into a shared memory segment, which other
+     *  processes open without copying or parsing it again.
+     *
+     * The parser builds the tree directly into the segment (a @c memfd on
+     * Linux, an unlinked @c shm_open() object elsewhere), which is then
+     * made read-only.  Handing the document to another process only takes
+     * its file descriptor, inherited across @c fork() or passed with
+     * @c send() and @c receive() over a Unix domain socket.
+     *
+     * The tree is made of ordinary nodes, so @c Any, @c List and @c Map
+     * work as usual.  Their links are addresses in the creating process:
+     * other processes map the segment at the same address when it is free
+     * there, which makes opening it free.  Otherwise, they map a private
+     * copy-on-write view elsewhere and adjust the links once, which still
+     * costs much less than parsing.
+     *
+     * @code
+     *  // Sidecar.
+     *  json::SharedDocument request(data, size);
+     *  request.send(worker);
+     *
+     *  // Worker.
+     *  json::SharedDocument request(json::SharedDocument::receive(sidecar));
+     *  const json::Map fields(request.root());
+     * @endcode
+     *
+     * On Linux, the @c memfd is sealed against writes, shrinking and
+     * growth once parsed, and one that is not is refused: no process can
+     * change a document under its readers.  Segments that cannot be sealed
+     * have their links checked to stay within the segment even when they
+     * need no adjusting.
+     *
+     * @note The creating process is trusted with the content of sealed
+     *  segments: their links are only checked when they need to be
+     *  adjusted.
+     */
+    class SharedDocument
+    {
+        /* nested types. */
+    private:
+        struct Header;
+
+        /* data. */
+    private:
+        int myDescriptor;
+        char * myBase;
+        std::size_t mySize;
+        ::cJSON * myRoot;
+        bool myRelocated;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Parse @a size bytes of JSON text at @a data into a new
+         *  shared memory segment.
+         *
+         * @throw std::runtime_error The segment cannot be created, or the
+         *  text is not valid JSON.
+         */
+        SharedDocument (const char * data, std::size_t size);
+
+        /*!
+         * @brief Open a document created by another process.
+         * @param descriptor File descriptor of the segment, from
+         *  @c descriptor() or @c receive().  The document takes ownership
+         *  of it, even if this throws.
+         *
+         * @throw std::runtime_error The segment cannot be mapped, or does
+         *  not hold a document.
+         */
+        explicit SharedDocument (int descriptor);
+
+    private:
+        SharedDocument (const SharedDocument&);
+
+    public:
+        /*!
+         * @brief Unmap the segment and close its descriptor.  The segment
+         *  is released once no process has it open anymore.
+         */
+        ~SharedDocument ();
+
+        /* class methods. */
+    public:
+        /*!
+         * @brief Wait for a document's descriptor sent with @c send().
+         * @param socket Connected Unix domain socket.
+         * @return The descriptor, for the constructor.
+         *
+         * @throw std::runtime_error No descriptor was received.
+         */
+        static int receive (int socket);
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Access the document's root value.
+         */
+        Any root () const {
+            return (Any(myRoot));
+        }
+
+        /*!
+         * @brief Obtain the segment's file descriptor, to hand it to
+         *  another process.
+         */
+        int descriptor () const {
+            return (myDescriptor);
+        }
+
+        /*!
+         * @brief Obtain the size of the segment, in bytes.
+         */
+        std::size_t size () const {
+            return (mySize);
+        }
+
+        /*!
+         * @brief Checks if opening the document required adjusting its
+         *  links, because its address was taken in this process.
+         */
+        bool relocated () const {
+            return (myRelocated);
+        }
+
+        /*!
+         * @brief Send the document's descriptor to another process.
+         * @param socket Connected Unix domain socket.
+         *
+         * @throw std::runtime_error The descriptor could not be sent.
+         */
+        void send (int socket) const;
+
+    private:
+        void relocate (char * base);
+
+        /* operators. */
+    private:
+        SharedDocument& operator= (const SharedDocument&);
+    };
+
+}
+
+#endif
+
+#endif /* _shared_hpp__ */
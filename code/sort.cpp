@@ -0,0 +1,520 @@
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file sort.cpp
+ * @brief External merge sort of NDJSON records.
+ */
+
+#include "sort.hpp"
+#include "ndjson.hpp"
+#include "thread.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+    // A record's location, and that of its key in the run's key buffer.
+    struct Entry
+    {
+        std::size_t key;
+        std::size_t key_size;
+        const char * data;
+        std::size_t size;
+    };
+
+    int compare (const char * lhs, std::size_t lhs_size,
+                 const char * rhs, std::size_t rhs_size)
+    {
+        const int order =
+            std::memcmp(lhs, rhs, std::min(lhs_size, rhs_size));
+        if (order != 0) {
+            return (order);
+        }
+        return ((lhs_size < rhs_size)? -1 : (lhs_size > rhs_size)? 1 : 0);
+    }
+
+    class ByKey
+    {
+        const std::string * myKeys;
+        bool myDescending;
+
+    public:
+        ByKey (const std::string& keys, bool descending)
+            : myKeys(&keys), myDescending(descending)
+        {}
+
+        bool operator() (const Entry& lhs, const Entry& rhs) const
+        {
+            const char *const keys = myKeys->data();
+            const int order = compare(keys+lhs.key, lhs.key_size,
+                                      keys+rhs.key, rhs.key_size);
+            return (myDescending? (order > 0) : (order < 0));
+        }
+    };
+
+    // The next record of one of the runs being merged.
+    struct Head
+    {
+        const char * key;
+        std::size_t key_size;
+        std::size_t run;
+    };
+
+    // Heap order: the record that must be written first is on top; among
+    // equal keys, that of the earliest run.
+    class Later
+    {
+        bool myDescending;
+
+    public:
+        explicit Later (bool descending)
+            : myDescending(descending)
+        {}
+
+        bool operator() (const Head& lhs, const Head& rhs) const
+        {
+            int order = compare(lhs.key, lhs.key_size, rhs.key, rhs.key_size);
+            order = myDescending? -order : order;
+            return ((order > 0) || ((order == 0) && (lhs.run > rhs.run)));
+        }
+    };
+
+    // Append a key to `keys`, such that comparing the bytes of two keys
+    // orders them as documented in sort.hpp.  Numbers are stored big endian,
+    // with the sign bit flipped (and the others too, for negatives).
+    void encode (::cJSON * node, std::string& keys)
+    {
+        const int type = (node == 0)? -1 : (node->type & 255);
+        if (type == cJSON_NULL) {
+            keys += '\1';
+        }
+        else if (type == cJSON_False) {
+            keys += '\2';
+        }
+        else if (type == cJSON_True) {
+            keys += '\3';
+        }
+        else if (type == cJSON_Number)
+        {
+            unsigned long long bits = 0;
+            const double value = node->valuedouble + 0.0;
+            std::memcpy(&bits, &value, sizeof(bits));
+            bits = ((bits >> 63) != 0)? ~bits : (bits | (1ULL << 63));
+            keys += '\4';
+            for (int shift = 56; (shift >= 0); shift -= 8) {
+                keys += char((bits >> shift) & 0xff);
+            }
+        }
+        else if (type == cJSON_String) {
+            (keys += '\5') += node->valuestring;
+        }
+        else if ((type == cJSON_Array) || (type == cJSON_Object))
+        {
+            std::ostringstream text;
+            text << json::Any(node);
+            (keys += '\6') += text.str();
+        }
+        else {
+            keys += '\0';
+        }
+    }
+
+}
+
+namespace json {
+
+    // A sorted run: in memory, or spilled to a temporary file as a sequence
+    // of key size (4 bytes), key, record size (8 bytes) and record.  Runs
+    // also keep their read position while they are merged.
+    struct Sort::Run
+    {
+        std::FILE * file;
+        std::string keys;
+        std::vector<Entry> entries;
+        std::size_t next;
+        std::string key;
+        std::string record;
+        Head head;
+        const char * data;
+        std::size_t size;
+
+        Run ()
+            : file(0), next(0), data(0), size(0)
+        {}
+
+        ~Run ()
+        {
+            if (file != 0) {
+                std::fclose(file);
+            }
+        }
+
+        std::size_t bytes () const
+        {
+            return (keys.capacity() + (entries.capacity() * sizeof(Entry)));
+        }
+
+        void sort (bool descending)
+        {
+            std::stable_sort(entries.begin(), entries.end(),
+                             ByKey(keys, descending));
+        }
+
+        void append (const char * key, std::size_t key_size,
+                     const char * data, std::size_t size)
+        {
+            if (file == 0)
+            {
+                if ((file = std::tmpfile()) == 0) {
+                    throw (std::runtime_error(
+                        "Could not create spill file."));
+                }
+                std::setvbuf(file, 0, _IOFBF, 64*1024);
+            }
+            const unsigned int key_length =
+                static_cast<unsigned int>(key_size);
+            const unsigned long long length = size;
+            if ((std::fwrite(&key_length, sizeof(key_length), 1, file) != 1)
+                || (std::fwrite(key, 1, key_size, file) != key_size)
+                || (std::fwrite(&length, sizeof(length), 1, file) != 1)
+                || (std::fwrite(data, 1, size, file) != size))
+            {
+                throw (std::runtime_error("Could not write spill file."));
+            }
+        }
+
+        // Move the (sorted) entries to disk.
+        void spill ()
+        {
+            for (std::size_t i=0; (i < entries.size()); ++i)
+            {
+                const Entry& entry = entries[i];
+                append(keys.data()+entry.key, entry.key_size,
+                       entry.data, entry.size);
+            }
+            if ((file != 0) && (std::fflush(file) != 0)) {
+                throw (std::runtime_error("Could not write spill file."));
+            }
+            std::string().swap(keys);
+            std::vector<Entry>().swap(entries);
+        }
+
+        void start ()
+        {
+            next = 0;
+            if ((file != 0) && (std::fseek(file, 0, SEEK_SET) != 0)) {
+                throw (std::runtime_error("Could not read spill file."));
+            }
+        }
+
+        // Load the next record in `head`, `data` and `size`.
+        bool advance ()
+        {
+            if (file == 0)
+            {
+                if (next == entries.size()) {
+                    return (false);
+                }
+                const Entry& entry = entries[next++];
+                head.key = keys.data() + entry.key;
+                head.key_size = entry.key_size;
+                data = entry.data, size = entry.size;
+                return (true);
+            }
+            unsigned int key_length = 0;
+            unsigned long long length = 0;
+            if (std::fread(&key_length, sizeof(key_length), 1, file) != 1)
+            {
+                if (std::ferror(file)) {
+                    throw (std::runtime_error("Could not read spill file."));
+                }
+                return (false);
+            }
+            key.resize(key_length);
+            if (((key_length > 0) &&
+                 (std::fread(&key[0], 1, key_length, file) != key_length)) ||
+                (std::fread(&length, sizeof(length), 1, file) != 1))
+            {
+                throw (std::runtime_error("Could not read spill file."));
+            }
+            record.resize(static_cast<std::size_t>(length));
+            if ((length > 0) &&
+                (std::fread(&record[0], 1, record.size(), file)
+                 != record.size()))
+            {
+                throw (std::runtime_error("Could not read spill file."));
+            }
+            head.key = key.data(), head.key_size = key.size();
+            data = record.data(), size = record.size();
+            return (true);
+        }
+    };
+
+    struct Sort::Worker
+    {
+        Sort * sort;
+        const char * data;
+        std::size_t size;
+        std::size_t share;
+        std::vector<Run*> runs;
+        Statistics statistics;
+        std::string error;
+    };
+
+    const std::size_t Sort::fan_in;
+
+    Sort::Sort (const std::string& pointer, std::size_t budget,
+                bool descending, const Expression * filter)
+        : myPointer(pointer)
+        , myBudget(budget)
+        , myDescending(descending)
+        , myFilter(filter)
+    {
+        const Statistics statistics = { 0, 0, 0, 0 };
+        myStatistics = statistics;
+    }
+
+    Sort::~Sort ()
+    {
+        for (std::size_t i=0; (i < myRuns.size()); ++i) {
+            delete myRuns[i];
+        }
+    }
+
+    void Sort::run (const char * data, std::size_t size,
+                    unsigned int threads)
+    {
+        threads = (threads == 0)? processors() : threads;
+
+        // Split the input in one range of whole lines per thread.
+        std::vector<Worker> workers;
+        std::size_t offset = 0;
+        for (unsigned int i=0; ((i < threads) && (offset < size)); ++i)
+        {
+            std::size_t last = (i+1 == threads)? size :
+                std::max(offset, std::min(size, size/threads*(i+1)));
+            const char *const end = static_cast<const char*>(
+                std::memchr(data+last, '\n', size-last));
+            last = (end == 0)? size : (end - data) + 1;
+            const Statistics statistics = { 0, 0, 0, 0 };
+            const Worker worker = {
+                this, data+offset, last-offset,
+                std::max<std::size_t>(myBudget/threads, 1),
+                std::vector<Run*>(), statistics, std::string()
+            };
+            workers.push_back(worker), offset = last;
+        }
+        if (workers.size() == 1) {
+            work(&workers[0]);
+        }
+        else
+        {
+            std::vector<Thread*> running;
+            try {
+                for (std::size_t i=0; (i < workers.size()); ++i) {
+                    running.push_back(new Thread(&work, &workers[i]));
+                }
+            }
+            catch (...) {
+                for (std::size_t i=0; (i < running.size()); ++i) {
+                    delete running[i];
+                }
+                throw;
+            }
+            for (std::size_t i=0; (i < running.size()); ++i) {
+                delete running[i];
+            }
+        }
+
+        // Keep the runs in input order, which keeps the sort stable.
+        std::string error;
+        for (std::size_t i=0; (i < workers.size()); ++i)
+        {
+            myRuns.insert(myRuns.end(),
+                          workers[i].runs.begin(), workers[i].runs.end());
+            myStatistics.records += workers[i].statistics.records;
+            myStatistics.invalid += workers[i].statistics.invalid;
+            myStatistics.skipped += workers[i].statistics.skipped;
+            myStatistics.spills += workers[i].statistics.spills;
+            if (error.empty()) {
+                error = workers[i].error;
+            }
+        }
+        if (!error.empty()) {
+            throw (std::runtime_error(error));
+        }
+
+        // Runs left in memory by earlier calls count against the budget.
+        std::size_t bytes = 0;
+        for (std::size_t i=0; (i < myRuns.size()); ++i) {
+            bytes += myRuns[i]->bytes();
+        }
+        for (std::size_t i=0;
+             ((bytes > myBudget) && (i < myRuns.size())); ++i)
+        {
+            if (myRuns[i]->file == 0) {
+                bytes -= myRuns[i]->bytes();
+                myRuns[i]->spill(), ++myStatistics.spills;
+            }
+        }
+    }
+
+    void Sort::work (void * context)
+    {
+        Worker& worker = *static_cast<Worker*>(context);
+        const Sort& self = *worker.sort;
+        try {
+            Arena arena;
+            worker.runs.push_back(0), worker.runs.back() = new Run();
+            const char *const last = worker.data + worker.size;
+            std::size_t size = 0;
+            for (const char * line = worker.data;
+                 (line < last); line += size+1)
+            {
+                const char *const end = static_cast<const char*>(
+                    std::memchr(line, '\n', last-line));
+                size = ((end == 0)? last : end) - line;
+                if ((size == 0) || ((size == 1) && (*line == '\r'))) {
+                    continue;
+                }
+                Run& run = *worker.runs.back();
+                const Entry entry = { run.keys.size(), 0, line, size };
+                Parser parser(arena, line, size);
+                if (parser.parse() != Parser::complete) {
+                    encode(0, run.keys), ++worker.statistics.invalid;
+                }
+                else if ((self.myFilter != 0) &&
+                         !self.myFilter->matches(Any(parser.root())))
+                {
+                    ++worker.statistics.skipped, arena.clear();
+                    continue;
+                }
+                else {
+                    encode(resolve(parser.root(), self.myPointer), run.keys);
+                }
+                arena.clear();
+                run.entries.push_back(entry);
+                run.entries.back().key_size = run.keys.size() - entry.key;
+                ++worker.statistics.records;
+                if (run.bytes() > worker.share)
+                {
+                    run.sort(self.myDescending), run.spill();
+                    ++worker.statistics.spills;
+                    worker.runs.push_back(0), worker.runs.back() = new Run();
+                }
+            }
+            if (worker.runs.back()->entries.empty()) {
+                delete worker.runs.back(), worker.runs.pop_back();
+            }
+            else {
+                worker.runs.back()->sort(self.myDescending);
+            }
+        }
+        catch (const std::exception& error) {
+            worker.error = error.what();
+        }
+    }
+
+    // Merge runs [first, last) to `stream`, or to the run `into`.
+    void Sort::merge (std::size_t first, std::size_t last,
+                      std::ostream * stream, Run * into)
+    {
+        const Later later(myDescending);
+        std::vector<Head> heap;
+        for (std::size_t i=first; (i < last); ++i)
+        {
+            myRuns[i]->start();
+            if (myRuns[i]->advance()) {
+                myRuns[i]->head.run = i;
+                heap.push_back(myRuns[i]->head);
+            }
+        }
+        std::make_heap(heap.begin(), heap.end(), later);
+        while (!heap.empty())
+        {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            Run& run = *myRuns[heap.back().run];
+            if (stream != 0) {
+                stream->write(run.data, run.size).put('\n');
+            }
+            else {
+                into->append(run.head.key, run.head.key_size,
+                             run.data, run.size);
+            }
+            if (run.advance()) {
+                run.head.run = heap.back().run, heap.back() = run.head;
+                std::push_heap(heap.begin(), heap.end(), later);
+            }
+            else {
+                heap.pop_back();
+            }
+        }
+    }
+
+    void Sort::write (std::ostream& stream)
+    {
+        // Merge groups of runs to disk until there are few enough left to
+        // merge straight to the output.  Groups are consecutive, so runs
+        // stay in input order.
+        while (myRuns.size() > fan_in)
+        {
+            std::vector<Run*> merged;
+            try {
+                for (std::size_t i=0; (i < myRuns.size()); i += fan_in)
+                {
+                    merged.push_back(0), merged.back() = new Run();
+                    merge(i, std::min(i+fan_in, myRuns.size()),
+                          0, merged.back());
+                    ++myStatistics.spills;
+                }
+            }
+            catch (...) {
+                for (std::size_t i=0; (i < merged.size()); ++i) {
+                    delete merged[i];
+                }
+                throw;
+            }
+            for (std::size_t i=0; (i < myRuns.size()); ++i) {
+                delete myRuns[i];
+            }
+            myRuns.swap(merged);
+        }
+        merge(0, myRuns.size(), &stream, 0);
+
+        // Start over.
+        for (std::size_t i=0; (i < myRuns.size()); ++i) {
+            delete myRuns[i];
+        }
+        myRuns.clear();
+    }
+
+}
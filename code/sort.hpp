@@ -0,0 +1,193 @@
+#ifndef _sort_hpp__
+#define _sort_hpp__
+
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file sort.hpp
+ * @brief External merge sort of NDJSON records.
+ */
+
+#include "json.hpp"
+#include "query.hpp"
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace json {
+
+    /*!
+     * @brief Sort NDJSON records by the value at a JSON Pointer, in bounded
+     *  memory.
+     *
+     * Records are parsed in parallel to extract their key, each thread
+     * sorting its own run of keys and record locations.  When a thread's
+     * share of the memory budget is used up, it writes its sorted run to a
+     * temporary file, records included, and starts a new one.  Runs are
+     * then merged, @c fan_in at a time, and the records' bytes are copied
+     * to the output as they are: records are never re-serialized.
+     *
+     * Keys are ordered by type, then by value: missing, @c null, @c false,
+     * @c true, numbers, strings (by UTF-8 bytes), then lists and maps (by
+     * their compact text).  The sort is stable.  Records that are not valid
+     * JSON are kept, and sort as if the key was missing.
+     *
+     * @code
+     *  json::Sort sort("/timestamp", 1024<<20);
+     *  sort.run(data, size);
+     *  sort.write(std::cout);
+     * @endcode
+     */
+    class Sort
+    {
+        /* nested types. */
+    private:
+        struct Run;
+        struct Worker;
+
+    public:
+        /*!
+         * @brief Sort activity report.
+         */
+        struct Statistics
+        {
+            /*!
+             * @brief Number of records sorted.
+             */
+            unsigned long long records;
+
+            /*!
+             * @brief Number of records that were not valid JSON.
+             */
+            unsigned long long invalid;
+
+            /*!
+             * @brief Number of records skipped by the filter.
+             */
+            unsigned long long skipped;
+
+            /*!
+             * @brief Number of runs written to disk, including those of
+             *  intermediate merges.
+             */
+            unsigned long long spills;
+        };
+
+        /* class data. */
+    public:
+        /*!
+         * @brief Largest number of runs merged at once.
+         */
+        static const std::size_t fan_in = 64;
+
+        /* data. */
+    private:
+        std::string myPointer;
+        std::size_t myBudget;
+        bool myDescending;
+        const Expression * myFilter;
+        std::vector<Run*> myRuns;
+        Statistics myStatistics;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Prepare a sort.
+         * @param pointer JSON Pointer to the sort key, such as
+         *  @c "/timestamp".
+         * @param budget Approximate bound on the memory used by keys and
+         *  record locations, in bytes.
+         * @param descending Sort from the largest key to the smallest.
+         *  Records with equal keys still keep their input order.
+         * @param filter Optional expression records must satisfy.  It must
+         *  outlive the sort.
+         */
+        Sort (const std::string& pointer, std::size_t budget,
+              bool descending=false, const Expression * filter=0);
+
+    private:
+        Sort (const Sort&);
+
+    public:
+        ~Sort ();
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Extract keys from a buffer of NDJSON records and sort them
+         *  in runs.
+         * @param data Buffer holding whole records, one per line.  Records
+         *  that are not spilled are copied from it by @c write(), so it
+         *  must remain valid until then (e.g. a mapped file).
+         * @param size Size of @a data, in bytes.
+         * @param threads Number of threads to use, or 0 for one per
+         *  processor.
+         *
+         * May be called several times (e.g. once per file) before
+         * @c write(); the output then lists records from earlier calls
+         * first among equal keys.
+         *
+         * @throw std::runtime_error A run cannot be written to disk.
+         */
+        void run (const char * data, std::size_t size,
+                  unsigned int threads=0);
+
+        /*!
+         * @brief Merge the runs and write the records in order, one per
+         *  line.
+         * @param stream Output stream.
+         *
+         * The runs are then released, so that the sort can be run again on
+         * other input.
+         *
+         * @throw std::runtime_error A run cannot be read or written.
+         */
+        void write (std::ostream& stream);
+
+        /*!
+         * @brief Report activity so far.
+         */
+        Statistics statistics () const {
+            return (myStatistics);
+        }
+
+    private:
+        static void work (void * context);
+        void merge (std::size_t first, std::size_t last,
+                    std::ostream * stream, Run * into);
+
+        /* operators. */
+    private:
+        Sort& operator= (const Sort&);
+    };
+
+}
+
+#endif /* _sort_hpp__ */
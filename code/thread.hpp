@@ -0,0 +1,355 @@
+#ifndef _thread_hpp__
+#define _thread_hpp__
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @internal
+ * @file thread.hpp
+ * @brief Minimal portable synchronization primitives.
+ */
+
+#include <exception>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <pthread.h>
+#   include <unistd.h>
+#endif
+
+namespace json {
+
+    /*!
+     * @internal
+     * @brief Mutual exclusion lock.
+     */
+    class Mutex
+    {
+        /* data. */
+    private:
+#ifdef _WIN32
+        ::CRITICAL_SECTION myHandle;
+#else
+        ::pthread_mutex_t myHandle;
+#endif
+
+        /* construction. */
+    public:
+        Mutex ()
+        {
+#ifdef _WIN32
+            ::InitializeCriticalSection(&myHandle);
+#else
+            ::pthread_mutex_init(&myHandle, 0);
+#endif
+        }
+
+    private:
+        Mutex (const Mutex&);
+
+    public:
+        ~Mutex ()
+        {
+#ifdef _WIN32
+            ::DeleteCriticalSection(&myHandle);
+#else
+            ::pthread_mutex_destroy(&myHandle);
+#endif
+        }
+
+        /* methods. */
+    public:
+        void acquire ()
+        {
+#ifdef _WIN32
+            ::EnterCriticalSection(&myHandle);
+#else
+            ::pthread_mutex_lock(&myHandle);
+#endif
+        }
+
+        void release ()
+        {
+#ifdef _WIN32
+            ::LeaveCriticalSection(&myHandle);
+#else
+            ::pthread_mutex_unlock(&myHandle);
+#endif
+        }
+
+        /* operators. */
+    private:
+        Mutex& operator= (const Mutex&);
+
+        /* friends. */
+    private:
+        friend class Condition;
+    };
+
+    /*!
+     * @internal
+     * @brief Scoped ownership of a @c Mutex.
+     */
+    class Lock
+    {
+        /* data. */
+    private:
+        Mutex& myMutex;
+
+        /* construction. */
+    public:
+        explicit Lock (Mutex& mutex)
+            : myMutex(mutex)
+        {
+            myMutex.acquire();
+        }
+
+    private:
+        Lock (const Lock&);
+
+    public:
+        ~Lock () {
+            myMutex.release();
+        }
+
+        /* operators. */
+    private:
+        Lock& operator= (const Lock&);
+    };
+
+    /*!
+     * @internal
+     * @brief Condition variable, to wait for a change made by another
+     *  thread while holding a @c Mutex.
+     */
+    class Condition
+    {
+        /* data. */
+    private:
+#ifdef _WIN32
+        ::CONDITION_VARIABLE myHandle;
+#else
+        ::pthread_cond_t myHandle;
+#endif
+
+        /* construction. */
+    public:
+        Condition ()
+        {
+#ifdef _WIN32
+            ::InitializeConditionVariable(&myHandle);
+#else
+            ::pthread_cond_init(&myHandle, 0);
+#endif
+        }
+
+    private:
+        Condition (const Condition&);
+
+    public:
+        ~Condition ()
+        {
+#ifndef _WIN32
+            ::pthread_cond_destroy(&myHandle);
+#endif
+        }
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Release @a mutex until woken up, then acquire it again.
+         *
+         * @note Wake-ups can be spurious: check the condition in a loop.
+         */
+        void wait (Mutex& mutex)
+        {
+#ifdef _WIN32
+            ::SleepConditionVariableCS(&myHandle, &mutex.myHandle, INFINITE);
+#else
+            ::pthread_cond_wait(&myHandle, &mutex.myHandle);
+#endif
+        }
+
+        /*!
+         * @brief Wake up all waiting threads.
+         */
+        void broadcast ()
+        {
+#ifdef _WIN32
+            ::WakeAllConditionVariable(&myHandle);
+#else
+            ::pthread_cond_broadcast(&myHandle);
+#endif
+        }
+
+        /* operators. */
+    private:
+        Condition& operator= (const Condition&);
+    };
+
+    /*!
+     * @internal
+     * @brief Thread of execution, joined on destruction.
+     */
+    class Thread
+    {
+        /* nested types. */
+    public:
+        typedef void(*Function)(void*);
+
+        /* data. */
+    private:
+        Function myFunction;
+        void * myContext;
+        bool myJoined;
+#ifdef _WIN32
+        ::HANDLE myHandle;
+#else
+        ::pthread_t myHandle;
+#endif
+
+        /* class methods. */
+    private:
+#ifdef _WIN32
+        static ::DWORD WINAPI entry (::LPVOID self)
+        {
+            static_cast<Thread*>(self)->myFunction(
+                static_cast<Thread*>(self)->myContext);
+            return (0);
+        }
+#else
+        static void * entry (void * self)
+        {
+            static_cast<Thread*>(self)->myFunction(
+                static_cast<Thread*>(self)->myContext);
+            return (0);
+        }
+#endif
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Start running @a function(@a context).
+         * @throw std::exception The thread could not be started.
+         */
+        Thread (Function function, void * context)
+            : myFunction(function)
+            , myContext(context)
+            , myJoined(false)
+        {
+#ifdef _WIN32
+            myHandle = ::CreateThread(0, 0, &Thread::entry, this, 0, 0);
+            if (myHandle == 0) {
+                throw (std::exception());
+            }
+#else
+            if (::pthread_create(&myHandle, 0, &Thread::entry, this) != 0) {
+                throw (std::exception());
+            }
+#endif
+        }
+
+    private:
+        Thread (const Thread&);
+
+    public:
+        ~Thread () {
+            join();
+        }
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Wait until the thread's function returns.
+         */
+        void join ()
+        {
+            if (myJoined) {
+                return;
+            }
+#ifdef _WIN32
+            ::WaitForSingleObject(myHandle, INFINITE);
+            ::CloseHandle(myHandle);
+#else
+            ::pthread_join(myHandle, 0);
+#endif
+            myJoined = true;
+        }
+
+        /* operators. */
+    private:
+        Thread& operator= (const Thread&);
+    };
+
+    /*!
+     * @internal
+     * @brief Obtain the number of processors available to this process.
+     */
+    inline unsigned int processors ()
+    {
+#ifdef _WIN32
+        ::SYSTEM_INFO system;
+        ::GetSystemInfo(&system);
+        return (system.dwNumberOfProcessors);
+#else
+        const long count = ::sysconf(_SC_NPROCESSORS_ONLN);
+        return ((count > 0)? static_cast<unsigned int>(count) : 1);
+#endif
+    }
+
+    /*!
+     * @internal
+     * @brief Atomically increment @a value.
+     * @return The new value.
+     */
+    inline long atomic_increment (volatile long& value)
+    {
+#ifdef _WIN32
+        return (::InterlockedIncrement(&value));
+#else
+        return (__sync_add_and_fetch(&value, 1));
+#endif
+    }
+
+    /*!
+     * @internal
+     * @brief Atomically decrement @a value.
+     * @return The new value.
+     */
+    inline long atomic_decrement (volatile long& value)
+    {
+#ifdef _WIN32
+        return (::InterlockedDecrement(&value));
+#else
+        return (__sync_sub_and_fetch(&value, 1));
+#endif
+    }
+
+}
+
+#endif /* _thread_hpp__ */
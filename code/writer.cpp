@@ -0,0 +1,364 @@
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file writer.cpp
+ * @brief Ordered NDJSON output from several threads.
+ */
+
+#include "writer.hpp"
+#include "internal.hpp"
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+    using json::internal::Appender;
+
+    // Write all of [data, data+size), resuming partial writes.
+    bool write_all (int descriptor, const char * data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            const ::ssize_t written = ::write(descriptor, data, size);
+            if (written < 0)
+            {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return (false);
+            }
+            data += written, size -= written;
+        }
+        return (true);
+    }
+
+}
+
+namespace json {
+
+    // Kept for the batch's lifetime: setting up a stream for each record
+    // costs about as much as serializing a small one.
+    class OrderedWriter::Batch::Stream :
+        public std::ostream
+    {
+        /* data. */
+    private:
+        Appender myBuffer;
+
+        /* construction. */
+    public:
+        explicit Stream (std::string& text)
+            : std::ostream(0)
+            , myBuffer(text)
+        {
+            rdbuf(&myBuffer);
+        }
+    };
+
+    OrderedWriter::Batch::Batch (unsigned long long sequence)
+        : mySequence(sequence)
+        , myRecords(0)
+        , myStream(0)
+    {
+    }
+
+    OrderedWriter::Batch::~Batch ()
+    {
+        delete myStream;
+    }
+
+    void OrderedWriter::Batch::append (const Any& value)
+    {
+        if (myStream == 0) {
+            myStream = new Stream(myText);
+        }
+        *myStream << value;
+        myText.push_back('\n');
+        ++myRecords;
+    }
+
+    void OrderedWriter::Batch::append (const char * data, std::size_t size)
+    {
+        myText.append(data, size);
+        myText.push_back('\n');
+        ++myRecords;
+    }
+
+    void OrderedWriter::Batch::reset (unsigned long long sequence)
+    {
+        mySequence = sequence;
+        myRecords = 0;
+        myText.clear();
+    }
+
+    void OrderedWriter::committer (void * context)
+    {
+        static_cast<OrderedWriter*>(context)->commit();
+    }
+
+    OrderedWriter::OrderedWriter (const std::string& path,
+                                  std::size_t window, bool direct)
+        : myFile(-1)
+        , myOwned(true)
+        , myDirect(false)
+        , myWindow(0)
+        , myBlock(0)
+        , myUsed(0)
+        , myNext(0)
+        , myClosing(false)
+        , myClosed(false)
+        , myCommitter(0)
+    {
+        const int flags = O_WRONLY|O_CREAT|O_TRUNC;
+#ifdef O_DIRECT
+        // Not all file systems support it (tmpfs does not, for one).
+        if (direct)
+        {
+            myFile = ::open(path.c_str(), flags|O_DIRECT, 0666);
+            myDirect = (myFile >= 0);
+        }
+#else
+        (void)direct;
+#endif
+        if (myFile < 0) {
+            myFile = ::open(path.c_str(), flags, 0666);
+        }
+        if (myFile < 0) {
+            throw (std::runtime_error("Could not create '" + path + "'."));
+        }
+        try {
+            start(window);
+        }
+        catch (...) {
+            ::close(myFile); throw;
+        }
+    }
+
+    OrderedWriter::OrderedWriter (int descriptor, std::size_t window)
+        : myFile(descriptor)
+        , myOwned(false)
+        , myDirect(false)
+        , myWindow(0)
+        , myBlock(0)
+        , myUsed(0)
+        , myNext(0)
+        , myClosing(false)
+        , myClosed(false)
+        , myCommitter(0)
+    {
+        start(window);
+    }
+
+    OrderedWriter::~OrderedWriter ()
+    {
+        try {
+            close();
+        }
+        catch (...) {
+        }
+    }
+
+    void OrderedWriter::start (std::size_t window)
+    {
+        myWindow = (window == 0)? 4*processors() : window;
+        std::memset(&myStatistics, 0, sizeof(myStatistics));
+        void * block = 0;
+        if (::posix_memalign(&block, alignment, block_size) != 0) {
+            throw (std::bad_alloc());
+        }
+        myBlock = static_cast<char*>(block);
+        try {
+            myCommitter = new Thread(&OrderedWriter::committer, this);
+        }
+        catch (...) {
+            std::free(myBlock); throw;
+        }
+    }
+
+    void OrderedWriter::submit (Batch& batch)
+    {
+        Lock lock(myMutex);
+        while (myError.empty() && !myClosing &&
+               (batch.mySequence >= myNext+myWindow))
+        {
+            myChanged.wait(myMutex);
+        }
+        if (!myError.empty()) {
+            throw (std::runtime_error(myError));
+        }
+        if (myClosing) {
+            throw (std::runtime_error("Output is closed."));
+        }
+        if ((batch.mySequence < myNext) ||
+            (myPending.find(batch.mySequence) != myPending.end()))
+        {
+            throw (std::runtime_error("Batch was already submitted."));
+        }
+        Pending& pending = myPending[batch.mySequence];
+        pending.text.swap(batch.myText);
+        pending.records = batch.myRecords;
+        batch.myRecords = 0;
+
+        // Hand back the memory of a batch that was written.
+        if (!mySpare.empty())
+        {
+            batch.myText.swap(mySpare.back());
+            mySpare.pop_back();
+        }
+        if (batch.mySequence == myNext) {
+            myChanged.broadcast();
+        }
+    }
+
+    void OrderedWriter::commit ()
+    {
+        std::string text;
+        for (;;)
+        {
+            {
+                Lock lock(myMutex);
+                if ((text.capacity() > 0) && (mySpare.size() < myWindow))
+                {
+                    text.clear();
+                    mySpare.push_back(std::string());
+                    mySpare.back().swap(text);
+                }
+                while (myError.empty() && !myClosing &&
+                       (myPending.empty() ||
+                        (myPending.begin()->first != myNext)))
+                {
+                    myChanged.wait(myMutex);
+                }
+                // When closing, stop at the first missing batch.
+                if (!myError.empty() || myPending.empty() ||
+                    (myPending.begin()->first != myNext))
+                {
+                    return;
+                }
+                const std::map<unsigned long long, Pending>::iterator
+                    batch = myPending.begin();
+                text.swap(batch->second.text);
+                ++myStatistics.batches;
+                myStatistics.records += batch->second.records;
+                myPending.erase(batch);
+                ++myNext;
+                myChanged.broadcast();
+            }
+
+            // Only this thread touches the block until it is joined.
+            const char * data = text.data();
+            std::size_t size = text.size();
+            while (size > 0)
+            {
+                const std::size_t count = std::min(size, block_size-myUsed);
+                std::memcpy(myBlock+myUsed, data, count);
+                myUsed += count, data += count, size -= count;
+                if ((myUsed == block_size) && !flush())
+                {
+                    Lock lock(myMutex);
+                    myError = "Could not write output.";
+                    myChanged.broadcast();
+                    return;
+                }
+            }
+        }
+    }
+
+    bool OrderedWriter::flush ()
+    {
+        if (!write_all(myFile, myBlock, myUsed)) {
+            return (false);
+        }
+        Lock lock(myMutex);
+        myStatistics.bytes += myUsed;
+        ++myStatistics.writes;
+        myUsed = 0;
+        return (true);
+    }
+
+    void OrderedWriter::close ()
+    {
+        if (myClosed) {
+            return;
+        }
+        myClosed = true;
+        {
+            Lock lock(myMutex);
+            myClosing = true;
+            myChanged.broadcast();
+        }
+        myCommitter->join();
+        delete myCommitter, myCommitter = 0;
+
+        // The last block is partial: O_DIRECT would reject it.
+        const bool missing = !myPending.empty();
+        if (myError.empty() && (myUsed > 0))
+        {
+#ifdef O_DIRECT
+            if (myDirect) {
+                ::fcntl(myFile, F_SETFL,
+                        ::fcntl(myFile, F_GETFL) & ~O_DIRECT);
+            }
+#endif
+            if (!flush()) {
+                myError = "Could not write output.";
+            }
+        }
+        std::free(myBlock), myBlock = 0;
+        myPending.clear();
+        mySpare.clear();
+        if (myOwned && (::close(myFile) != 0) && myError.empty()) {
+            myError = "Could not write output.";
+        }
+        if (!myError.empty()) {
+            throw (std::runtime_error(myError));
+        }
+        if (missing) {
+            throw (std::runtime_error("A batch was never submitted."));
+        }
+    }
+
+    OrderedWriter::Statistics OrderedWriter::statistics () const
+    {
+        Lock lock(myMutex);
+        return (myStatistics);
+    }
+
+}
+
+#endif
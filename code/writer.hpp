@@ -0,0 +1,313 @@
+#ifndef _writer_hpp__
+#define _writer_hpp__
+
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*!
+ * @file writer.hpp
+ * @brief Ordered NDJSON output from several threads.
+ */
+
+#include "json.hpp"
+#include "thread.hpp"
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+
+namespace json {
+
+    /*!
+     * @brief Writes batches of NDJSON records, serialized on any number of
+     *  threads, to a file in the order of their sequence numbers.
+     *
+     * Each worker serializes records into its own @c Batch, tagged with the
+     * batch's sequence number, without taking any lock.  @c submit() hands
+     * the batch's text over to a committer thread (a swap, under a short
+     * lock), which appends batches in sequence order to an aligned block and
+     * writes the file one whole block at a time.  Batches that arrive early
+     * wait in memory; a worker that gets more than @c window() batches ahead
+     * of the oldest missing one blocks in @c submit() until it is written.
+     *
+     * Sequence numbers start at 0 and every number must be submitted once.
+     * A worker should submit each batch before it takes a later sequence
+     * number (say, from a shared counter), or it may wait for itself.
+     *
+     * @code
+     *  json::OrderedWriter output("output.ndjson");
+     *  // on each worker, for each chunk of input:
+     *  json::OrderedWriter::Batch batch(chunk);
+     *  for (...) {
+     *      batch.append(record);
+     *  }
+     *  output.submit(batch);
+     *  // once all workers are done:
+     *  output.close();
+     * @endcode
+     */
+    class OrderedWriter
+    {
+        /* nested types. */
+    public:
+        /*!
+         * @brief Records serialized by a single thread, to be written as a
+         *  unit.
+         */
+        class Batch
+        {
+            /* nested types. */
+        private:
+            class Stream;
+
+            /* data. */
+        private:
+            unsigned long long mySequence;
+            std::size_t myRecords;
+            std::string myText;
+            Stream * myStream;
+
+            /* construction. */
+        public:
+            /*!
+             * @brief Prepare an empty batch.
+             * @param sequence Position of the batch in the output.
+             */
+            explicit Batch (unsigned long long sequence=0);
+
+        private:
+            Batch (const Batch&);
+
+        public:
+            ~Batch ();
+
+            /* methods. */
+        public:
+            /*!
+             * @brief Obtain the position of the batch in the output.
+             */
+            unsigned long long sequence () const {
+                return (mySequence);
+            }
+
+            /*!
+             * @brief Obtain the number of records in the batch.
+             */
+            std::size_t records () const {
+                return (myRecords);
+            }
+
+            /*!
+             * @brief Obtain the size of the batch's text, in bytes.
+             */
+            std::size_t size () const {
+                return (myText.size());
+            }
+
+            /*!
+             * @brief Append the compact serialization of @a value and a
+             *  line break.
+             */
+            void append (const Any& value);
+
+            /*!
+             * @brief Append a record that is already serialized, and a line
+             *  break.
+             * @pre @a data holds no line breaks.
+             */
+            void append (const char * data, std::size_t size);
+
+            /*!
+             * @brief Empty the batch to reuse it, keeping its memory.
+             * @param sequence Position of the next batch in the output.
+             */
+            void reset (unsigned long long sequence);
+
+            /* operators. */
+        private:
+            Batch& operator= (const Batch&);
+
+            /* friends. */
+        private:
+            friend class OrderedWriter;
+        };
+
+    private:
+        struct Pending
+        {
+            std::string text;
+            std::size_t records;
+        };
+
+    public:
+        /*!
+         * @brief Counters, for monitoring.
+         */
+        struct Statistics
+        {
+            //! Number of batches written.
+            unsigned long long batches;
+
+            //! Number of records written.
+            unsigned long long records;
+
+            //! Number of bytes written.
+            unsigned long long bytes;
+
+            //! Number of blocks written.
+            unsigned long long writes;
+        };
+
+        /* class data. */
+    public:
+        /*!
+         * @brief Size of the blocks written to the file, in bytes.
+         */
+        static const std::size_t block_size = 1024 * 1024;
+
+        /*!
+         * @brief Alignment of the blocks in memory and in the file.
+         */
+        static const std::size_t alignment = 4096;
+
+        /* class methods. */
+    private:
+        static void committer (void * context);
+
+        /* data. */
+    private:
+        int myFile;
+        bool myOwned;
+        bool myDirect;
+        std::size_t myWindow;
+        char * myBlock;
+        std::size_t myUsed;
+        std::map<unsigned long long, Pending> myPending;
+        std::vector<std::string> mySpare;
+        unsigned long long myNext;
+        bool myClosing;
+        bool myClosed;
+        std::string myError;
+        Statistics myStatistics;
+        mutable Mutex myMutex;
+        Condition myChanged;
+        Thread * myCommitter;
+
+        /* construction. */
+    public:
+        /*!
+         * @brief Create (or truncate) the file at @a path.
+         * @param path Path to the output file.
+         * @param window Number of batches that may wait for an earlier one,
+         *  @c 0 for four per processor.
+         * @param direct Write with @c O_DIRECT, bypassing the page cache,
+         *  where the file system supports it.
+         *
+         * @throw std::runtime_error The file cannot be created.
+         */
+        explicit OrderedWriter (const std::string& path,
+                                std::size_t window=0, bool direct=false);
+
+        /*!
+         * @brief Write to an open file, pipe or socket.
+         * @param descriptor Output, in blocking mode.  It is not closed.
+         * @param window Number of batches that may wait for an earlier one,
+         *  @c 0 for four per processor.
+         */
+        explicit OrderedWriter (int descriptor, std::size_t window=0);
+
+    private:
+        OrderedWriter (const OrderedWriter&);
+
+    public:
+        /*!
+         * @brief Close the output, ignoring errors.
+         *
+         * @note Call @c close() to learn whether all records were written.
+         */
+        ~OrderedWriter ();
+
+        /* methods. */
+    public:
+        /*!
+         * @brief Obtain the number of batches that may wait for an earlier
+         *  one.
+         */
+        std::size_t window () const {
+            return (myWindow);
+        }
+
+        /*!
+         * @brief Check whether the file was opened with @c O_DIRECT.
+         */
+        bool direct () const {
+            return (myDirect);
+        }
+
+        /*!
+         * @brief Queue @a batch for writing.
+         *
+         * On return, @a batch is empty and can be @c reset() for the next
+         * batch.  The call blocks while @a batch is @c window() batches or
+         * more ahead of the oldest batch not yet written.
+         *
+         * @throw std::runtime_error @a batch's sequence number was already
+         *  submitted, or the output could not be written.
+         */
+        void submit (Batch& batch);
+
+        /*!
+         * @brief Write all batches and close the output.
+         *
+         * @throw std::runtime_error A batch was never submitted, or the
+         *  output could not be written.
+         */
+        void close ();
+
+        /*!
+         * @brief Obtain a snapshot of the counters.
+         */
+        Statistics statistics () const;
+
+    private:
+        void start (std::size_t window);
+        void commit ();
+        bool flush ();
+
+        /* operators. */
+    private:
+        OrderedWriter& operator= (const OrderedWriter&);
+    };
+
+}
+
+#endif
+
+#endif /* _writer_hpp__ */
@@ -24,8 +24,35 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <aggregate.hpp>
+#include <cache.hpp>
+#include <csv.hpp>
+#include <edit.hpp>
+#include <gather.hpp>
+#include <join.hpp>
 #include <json.hpp>
+#include <ndjson.hpp>
+#include <query.hpp>
+#include <rpc.hpp>
+#include <serialize.hpp>
+#include <shared.hpp>
+#include <sort.hpp>
+#include <thread.hpp>
+#include <writer.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#ifndef _WIN32
+#   include <fcntl.h>
+#   include <netinet/in.h>
+#   include <sys/mman.h>
+#   include <sys/socket.h>
+#   include <unistd.h>
+#endif
 
 namespace {
 
@@ -81,6 +108,1023 @@ namespace {
         return (EXIT_FAILURE);
     }
 
+    int test_3 ()
+    try
+    {
+        static const char text[] =
+            "{\"side\": \"buy\", \"qty\": [100, 200], \"px\": 1.5e2}";
+        json::StaticDocument<1024> document;
+        if (document.parse(text, sizeof(text)-1) != json::Parser::complete) {
+            std::cerr << "Test #3: parse failed." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        const json::Map root(document.root());
+        json::Any side(0);
+        json::Any missing(0);
+        if (!root.get("side", side) || root.get("missing", missing)) {
+            std::cerr << "Test #3: lookup failed." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout
+            << "side: " << side.c_str() << ", document: " << root
+            << " (" << document.size() << " bytes)."
+            << std::endl;
+
+        // Running out of room is reported, not thrown.
+        json::StaticDocument<64> small;
+        if (small.parse(text, sizeof(text)-1) != json::Parser::capacity) {
+            std::cerr << "Test #3: capacity not enforced." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #3: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_4 ()
+    try
+    {
+        static const char text[] =
+            "{\"items\": [1, 2, 3], \"name\": \"resumable parsing\"}";
+        json::Document document;
+        json::Parser parser(document, text, sizeof(text)-1);
+        int steps = 0;
+        json::Parser::Status status = json::Parser::pending;
+        for (; (status == json::Parser::pending); ++steps) {
+            status = parser.step(json::Parser::Budget(8));
+        }
+        if (status != json::Parser::complete) {
+            std::cerr << "Test #4: parse failed." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout
+            << "document: " << json::Map(document)
+            << " (" << steps << " steps)."
+            << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #4: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_5 ()
+    try
+    {
+        json::Document document("{\"a\": [1, {\"b\": \"c\"}], \"d\": null}");
+        std::ostringstream before;
+        before << json::Map(document);
+        document.compact();
+        std::ostringstream after;
+        after << json::Map(document);
+        if (before.str() != after.str()) {
+            std::cerr << "Test #5: document altered." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout << "compacted: " << after.str() << "." << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #5: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_6 ()
+    try
+    {
+        const std::string text("{\"service\": \"quotes\", \"ttl\": 30}");
+        json::DocumentCache cache(1024*1024);
+        const json::DocumentCache::Handle first = cache.get(text);
+        const json::DocumentCache::Handle second = cache.get(text);
+        const json::DocumentCache::Statistics statistics = cache.statistics();
+        if ((&*first != &*second) ||
+            (statistics.hits != 1) || (statistics.misses != 1))
+        {
+            std::cerr << "Test #6: document not shared." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout
+            << "cached: " << json::Map(second->root())
+            << " (" << statistics.bytes << " bytes)."
+            << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #6: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_7 ()
+    try
+    {
+        const std::string path("demo.ndjson");
+        std::remove((path + ".idx").c_str());
+        {
+            std::ofstream file(path.c_str(), std::ios::binary);
+            file << "{\"id\": 1}\n\n{\"id\": 2}\n";
+        }
+        json::LineIndex index(path);
+        {
+            std::ofstream file(path.c_str(), std::ios::binary|std::ios::app);
+            file << "{\"id\": 3}\n";
+        }
+        json::Document document;
+        if ((index.update() != 1) || (index.size() != 3) ||
+            (index.parse(2, document) != json::Parser::complete))
+        {
+            std::cerr << "Test #7: appended record not indexed." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout << "record #2: " << json::Map(document) << std::endl;
+        std::remove(path.c_str());
+        std::remove((path + ".idx").c_str());
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #7: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_8 ()
+    try
+    {
+        const std::string path("demo-users.ndjson");
+        {
+            std::ofstream file(path.c_str(), std::ios::binary);
+            file
+                << "{\"user\": {\"id\": \"bob\"}, \"n\": 1}\n"
+                << "{\"user\": {\"id\": \"alice\"}, \"n\": 2}\n"
+                << "{\"user\": {}, \"n\": 3}\n"
+                << "{\"user\": {\"id\": \"alice\"}, \"n\": 4}\n";
+        }
+        json::LineIndex records(path);
+        json::FieldIndex::build(records, "/user/id", path + ".user.id.idx");
+        json::FieldIndex index(path + ".user.id.idx");
+        std::vector<unsigned long long> offsets;
+        if ((index.size() != 3) || (index.find("\"alice\"", offsets) != 2))
+        {
+            std::cerr << "Test #8: wrong candidates." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        for (std::size_t i=0; (i < offsets.size()); ++i)
+        {
+            json::Document document;
+            if (!index.fetch(records, offsets[i], "\"alice\"", document)) {
+                std::cerr << "Test #8: record not confirmed." << std::endl;
+                return (EXIT_FAILURE);
+            }
+            std::cout << "alice: " << json::Map(document) << std::endl;
+        }
+        std::remove(path.c_str());
+        std::remove((path + ".idx").c_str());
+        std::remove((path + ".user.id.idx").c_str());
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #8: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_9 ()
+    try
+    {
+        const std::string text =
+            "{\"status\": \"ok\", \"note\": \"error\"}\n"
+            "{\"status\": \"error\", \"n\": 1}\n"
+            "{\"status\": \"ok\"}\n"
+            "{\"status\": \"\\u0065rror\", \"n\": 2}\n";
+        const json::Selector selector("/status", "\"error\"");
+        json::Arena arena;
+        int candidates = 0;
+        int matches = 0;
+        std::size_t offset = 0;
+        std::size_t length = 0;
+        const char * record = 0;
+        while ((record = selector.next(
+                    text.data(), text.size(), offset, length)) != 0)
+        {
+            ++candidates;
+            matches += selector.matches(record, length, arena);
+            arena.clear();
+        }
+        if ((candidates != 3) || (matches != 2))
+        {
+            std::cerr << "Test #9: wrong selection." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout
+            << "selected: " << matches << " of " << candidates
+            << " candidates."
+            << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #9: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_10 ()
+    try
+    {
+        json::Document document(
+            "{\"status\": \"error\", \"latency_ms\": 300,"
+            " \"user\": {\"id\": \"alice\"}, \"tags\": [\"slow\"]}");
+        const json::Expression slow_errors(
+            ".status == \"error\" && .latency_ms > 250");
+        const json::Expression fast_or_missing(
+            ".latency_ms < 100 || .missing.field == 1");
+        const json::Expression tagged("!(.tags[0] != \"slow\")");
+        if (!slow_errors.matches(document.root()) ||
+            fast_or_missing.matches(document.root()) ||
+            !tagged.matches(document.root()))
+        {
+            std::cerr << "Test #10: wrong evaluation." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        const json::Projection projection(".user.id, .latency_ms, .none");
+        std::cout << "projected: ";
+        projection.write(std::cout, document.root());
+        std::cout << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #10: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_11 ()
+    try
+    {
+        const std::string records =
+            "{\"host\": \"a\", \"ms\": 10}\n"
+            "{\"host\": \"b\", \"ms\": 5}\n"
+            "{\"host\": \"a\", \"ms\": 30}\n"
+            "{\"ms\": 7}\n";
+        json::Aggregation aggregation(".host", ".ms", 1024*1024);
+        aggregation.run(records.data(), records.size(), 2);
+        std::ostringstream output;
+        aggregation.write(output);
+        const std::string result = output.str();
+        const std::string group =
+            "{\"key\":\"a\",\"count\":2,\"sum\":40,\"min\":10,"
+            "\"max\":30}\n";
+        if ((aggregation.statistics().records != 4) ||
+            (result.find(group) == std::string::npos) ||
+            (result.find("{\"key\":null,\"count\":1,")
+             == std::string::npos))
+        {
+            std::cerr << "Test #11: wrong groups." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout << result;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #11: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_12 ()
+    try
+    {
+        const std::string records =
+            "{\"id\": 1, \"t\": 30}\n"
+            "{\"id\": 2, \"t\": \"late\"}\n"
+            "{\"id\": 3, \"t\": -5}\n"
+            "{\"id\": 4}\n"
+            "{\"id\": 5, \"t\": 30}\n";
+        json::Sort sort("/t", 1024*1024);
+        sort.run(records.data(), records.size(), 2);
+        std::ostringstream output;
+        sort.write(output);
+        const std::string expected =
+            "{\"id\": 4}\n"
+            "{\"id\": 3, \"t\": -5}\n"
+            "{\"id\": 1, \"t\": 30}\n"
+            "{\"id\": 5, \"t\": 30}\n"
+            "{\"id\": 2, \"t\": \"late\"}\n";
+        if (output.str() != expected)
+        {
+            std::cerr << "Test #12: wrong order." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout << output.str();
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #12: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_13 ()
+    try
+    {
+        const std::string events =
+            "{\"user\": 1, \"page\": \"/\"}\n"
+            "{\"user\": 3, \"page\": \"/a\"}\n"
+            "{\"user\": 2}\n"
+            "{\"user\": 9, \"page\": \"/b\"}\n";
+        const std::string users =
+            "{\"id\": 2, \"name\": \"bob\"}\n"
+            "{\"id\": 1, \"name\": \"alice\", \"page\": \"?\"}\n";
+        json::Join join(".user, .id");
+        std::ostringstream output;
+        join.run(events.data(), events.size(),
+                 users.data(), users.size(), output, 2);
+        const std::string expected =
+            "{\"user\": 1, \"page\": \"/\",\"id\":1,"
+            "\"name\":\"alice\"}\n"
+            "{\"user\": 2,\"id\":2,\"name\":\"bob\"}\n";
+        if (output.str() != expected)
+        {
+            std::cerr << "Test #13: wrong records." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout << output.str();
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #13: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_14 ()
+    try
+    {
+        const std::string records =
+            "[{\"id\": 1, \"name\": \"a, b\", \"ms\": 2.5},"
+            " {\"id\": 2, \"name\": \"say \\\"hi\\\"\"},"
+            " {\"name\": \"c\", \"id\": 3, \"ms\": [1]}]";
+        std::ostringstream output;
+        {
+            json::Csv csv(output, ".id, .name, .ms");
+            csv.header();
+            csv.write(records.data(), records.size());
+        }
+        const std::string expected =
+            "id,name,ms\n"
+            "1,\"a, b\",2.5\n"
+            "2,\"say \"\"hi\"\"\",\n"
+            "3,c,[1]\n";
+        if (output.str() != expected)
+        {
+            std::cerr << "Test #14: wrong rows." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout << output.str();
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #14: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+#ifndef _WIN32
+    int test_15 ()
+    try
+    {
+        const std::string text =
+            "{\"id\": 7, \"tags\": [\"a\", \"b\"],"
+            " \"user\": {\"name\": \"x\"}}";
+        const json::SharedDocument original(text.data(), text.size());
+
+        // Opening it again in this process means adjusting its links.
+        const json::SharedDocument copy(::dup(original.descriptor()));
+        const json::Map user = json::Map(copy.root())["user"];
+        const std::string name = user["name"];
+        std::ostringstream lhs;
+        std::ostringstream rhs;
+        lhs << original.root();
+        rhs << copy.root();
+        if (!copy.relocated() || (lhs.str() != rhs.str()) ||
+            (name != "x"))
+        {
+            std::cerr << "Test #15: wrong document." << std::endl;
+            return (EXIT_FAILURE);
+        }
+#ifdef F_SEAL_WRITE
+        // Sealed: nobody holding the descriptor can change the document.
+        void *const base = ::mmap(0, 1, PROT_READ|PROT_WRITE, MAP_SHARED,
+                                  original.descriptor(), 0);
+        if ((::fcntl(original.descriptor(), F_GET_SEALS) >= 0) &&
+            (base != MAP_FAILED))
+        {
+            std::cerr << "Test #15: writable segment." << std::endl;
+            return (EXIT_FAILURE);
+        }
+#endif
+        std::cout << "shared: " << rhs.str() << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #15: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+#endif
+
+#ifdef __linux__
+    void add (const json::Any& params, std::ostream& result, void *)
+    {
+        const json::List operands(params);
+        result << (double(operands[0]) + double(operands[1]));
+    }
+
+    void serve (void * server)
+    {
+        static_cast<json::RpcServer*>(server)->run();
+    }
+
+    int test_16 ()
+    try
+    {
+        json::RpcServer server("127.0.0.1", 0, 1);
+        server.bind("add", &add);
+        json::Thread running(&serve, &server);
+
+        const int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+        ::sockaddr_in endpoint;
+        std::memset(&endpoint, 0, sizeof(endpoint));
+        endpoint.sin_family = AF_INET;
+        endpoint.sin_port = htons(server.port());
+        endpoint.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::connect(socket, reinterpret_cast<::sockaddr*>(&endpoint),
+                      sizeof(endpoint)) != 0)
+        {
+            server.stop();
+            std::cerr << "Test #16: could not connect." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        const std::string messages =
+            "{\"jsonrpc\": \"2.0\", \"method\": \"add\","
+            " \"params\": [1, 2], \"id\": 1}\n"
+            "[{\"jsonrpc\": \"2.0\", \"method\": \"add\","
+            " \"params\": [3, 4]},"
+            " {\"jsonrpc\": \"2.0\", \"method\": \"sub\", \"id\": 2}]\n";
+        const std::string expected =
+            "{\"jsonrpc\":\"2.0\",\"result\":3,\"id\":1}\n"
+            "[{\"jsonrpc\":\"2.0\",\"error\":{\"code\":-32601,"
+            "\"message\":\"Method not found\"},\"id\":2}]\n";
+        ::write(socket, messages.data(), messages.size());
+        ::shutdown(socket, SHUT_WR);
+        std::string responses;
+        char data[256];
+        for (::ssize_t size = 0; (size = ::read(socket, data, 256)) > 0;) {
+            responses.append(data, size);
+        }
+        ::close(socket);
+        server.stop();
+        if (responses != expected)
+        {
+            std::cerr << "Test #16: wrong responses." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout << responses;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #16: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+#endif
+
+#ifndef _WIN32
+    int test_17 ()
+    try
+    {
+        const std::string text =
+            "{\"id\": 1,"
+            " \"body\": \"<p>a long \\\"quoted\\\" paragraph</p>\"}";
+        const json::Document document(text);
+        json::Gather gather(8);
+        gather.write(document.root());
+
+        // The text is the same as what streams get.
+        const std::vector<::iovec>& vectors = gather.vectors();
+        std::string output;
+        for (std::size_t i=0; (i < vectors.size()); ++i)
+        {
+            output.append(static_cast<const char*>(vectors[i].iov_base),
+                          vectors[i].iov_len);
+        }
+        std::ostringstream expected;
+        expected << document.root();
+        if ((output != expected.str()) || (gather.referenced() == 0))
+        {
+            std::cerr << "Test #17: wrong output." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout
+            << output << " (" << vectors.size() << " buffers, "
+            << gather.referenced() << " bytes referenced)" << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #17: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+#endif
+
+    int test_18 ()
+    try
+    {
+        const std::string text =
+            "{\"name\": \"tab\\there \\u0001\", \"sizes\": [1, -0.5, 1e300],"
+            " \"nested\": {\"empty\": [], \"ok\": true}, \"none\": null}";
+        const json::Document document(text);
+        std::ostringstream compact;
+        compact << document.root();
+        std::ostringstream indented;
+        json::pretty(indented, document.root(), 4);
+        const json::Any root = document.root();
+        if ((json::serialized_size(root) != compact.str().size()) ||
+            (json::serialized_size(root, 4) != indented.str().size()))
+        {
+            std::cerr << "Test #18: wrong size." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout
+            << compact.str() << " ("
+            << json::serialized_size(root) << " bytes)"
+            << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #18: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_19 ()
+    try
+    {
+        json::Document document(std::string(
+            "{\"name\": \"state\", \"counters\": {\"hits\": 1},"
+            " \"log\": [\"start\"]}"));
+        json::Editor editor(document);
+        const json::Map root(document);
+        std::ostringstream before;
+        editor.write(before);
+
+        const json::Map counters = root["counters"];
+        editor.set(counters, "hits", editor.number(2));
+        editor.set(counters, "misses", editor.number(0));
+        editor.push_back(root["log"], editor.string("tick"));
+        editor.erase(root, "name");
+        std::ostringstream after;
+        editor.write(after);
+        std::ostringstream expected;
+        expected << document.root();
+        if ((after.str() != expected.str()) || (after.str() !=
+             "{\"counters\":{\"hits\":2,\"misses\":0},"
+             "\"log\":[\"start\",\"tick\"]}"))
+        {
+            std::cerr << "Test #19: wrong text." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout << before.str() << " -> " << after.str() << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #19: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_20 ()
+    try
+    {
+        std::ostringstream text;
+        text << "{\"name\": \"big\", \"items\": [";
+        for (int i=0; (i < 1000); ++i) {
+            text << ((i == 0)? "" : ", ")
+                 << "{\"id\": " << i << ", \"tag\": \"t\\n\"}";
+        }
+        text << "], \"done\": true}";
+        const json::Document document(text.str());
+        std::ostringstream expected;
+        expected << document.root();
+        std::ostringstream actual;
+        json::serialize(actual, document.root(), 4);
+        if (actual.str() != expected.str())
+        {
+            std::cerr << "Test #20: wrong text." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout << actual.str().size() << " bytes." << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #20: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+#ifndef _WIN32
+    int test_21 ()
+    try
+    {
+        const std::string path = "demo-ordered.ndjson";
+        {
+            // Batches arrive out of order, as from several workers.
+            json::OrderedWriter output(path);
+            const char * records[] = {
+                "{\"id\": 3}", "{\"id\": 1}", "{\"id\": 2}",
+            };
+            for (int i=0; (i < 3); ++i)
+            {
+                const json::Document document(std::string(records[i]));
+                json::OrderedWriter::Batch batch((i+2) % 3);
+                batch.append(document.root());
+                output.submit(batch);
+            }
+            output.close();
+        }
+        std::ifstream file(path.c_str(), std::ios::binary);
+        std::ostringstream text;
+        text << file.rdbuf();
+        file.close();
+        std::remove(path.c_str());
+        if (text.str() != "{\"id\":1}\n{\"id\":2}\n{\"id\":3}\n")
+        {
+            std::cerr << "Test #21: wrong order." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout << text.str();
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #21: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+#endif
+
+    int test_22 ()
+    try
+    {
+        json::Document document(std::string("{\"log\": [\"start\"]}"));
+        json::Editor editor(document);
+        const json::List log = json::Map(document)["log"];
+        for (int i=0; (i < 1000); ++i) {
+            editor.push_back(log, editor.number(i));
+        }
+        if ((editor.size(log) != 1001) ||
+            (editor.size(log) != std::size_t(log.size())) ||
+            (double(editor.back(log)) != 999.0) ||
+            (editor.size(json::Map(document)) != 1))
+        {
+            std::cerr << "Test #22: wrong size." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout << editor.size(log) << " items." << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #22: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_23 ()
+    try
+    {
+        json::Document document(std::string(
+            "{\"user\": \"alice\", \"token\": \"\", \"seen\": 0}"));
+        json::Editor editor(document);
+        const json::Map session(document);
+        std::size_t size = 0;
+        for (int i=0; (i < 100); ++i)
+        {
+            editor.set(session, "seen", editor.number(i));
+            editor.set(session, "token", editor.string("token-42"));
+            editor.erase(session, "cart");
+            editor.set(session, "cart", editor.list());
+            if (i == 1) {
+                size = document.statistics().size;
+            }
+        }
+        const json::Editor::Memory memory = editor.memory();
+        if ((document.statistics().size != size) ||
+            (memory.recycled + 10 < memory.allocated))
+        {
+            std::cerr << "Test #23: memory not reused." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        // Nodes couldn't hold the part after the NUL.
+        try {
+            editor.string(std::string("a\0b", 3));
+            std::cerr << "Test #23: accepted a NUL." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        catch (const std::invalid_argument&) {
+        }
+        if (editor.memory().slack != memory.slack) {
+            std::cerr << "Test #23: wrong slack." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout
+            << memory.recycled << " of " << memory.allocated
+            << " allocations reused." << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #23: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_24 ()
+    try
+    {
+        json::Document payload;
+        json::Document copy;
+        {
+            json::Document request(std::string(
+                "{\"id\": 7, \"payload\": {\"items\": [1, \"two\"]}}"));
+            payload.extract(json::Map(request)["payload"]);
+            request.clone(copy);
+        }
+        std::ostringstream text;
+        text << payload.root() << ' ' << copy.root();
+        if (text.str() != "{\"items\":[1,\"two\"]} "
+            "{\"id\":7,\"payload\":{\"items\":[1,\"two\"]}}")
+        {
+            std::cerr << "Test #24: wrong copy." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout << text.str() << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #24: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_25 ()
+    try
+    {
+        const json::Document document(
+            std::string("{\"say \\\"hi\\\"\\n\": 1}"));
+        const json::Projection projection(".[\"say \\\"hi\\\"\\n\"]");
+        std::ostringstream output;
+        projection.write(output, document.root());
+        if (output.str() != "{\"say \\\"hi\\\"\\n\":1}")
+        {
+            std::cerr << "Test #25: wrong key." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        std::cout << "projected: " << output.str() << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #25: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_26 ()
+    try
+    {
+        // 12345678901234567 has no double: the nearest one needs all 17
+        // digits to read back.
+        const json::Document document(std::string(
+            "[true, false, \"a\\\"b\\\\c\\nd\\u0001\","
+            " 0.1, 1e300, 12345678901234567]"));
+        std::ostringstream output;
+        output << document.root();
+        if (output.str() != "[true,false,\"a\\\"b\\\\c\\nd\\u0001\","
+            "0.1,1e+300,12345678901234568]")
+        {
+            std::cerr << "Test #26: wrong text." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        // Without indentation, pretty() writes the compact text.
+        for (int indent=-1; (indent <= 2); ++indent)
+        {
+            std::ostringstream text;
+            json::pretty(text, document.root(), indent);
+            if ((text.str().size() !=
+                 json::serialized_size(document.root(), indent)) ||
+                ((indent < 0) && (text.str() != output.str())))
+            {
+                std::cerr << "Test #26: wrong size." << std::endl;
+                return (EXIT_FAILURE);
+            }
+        }
+        std::cout << output.str() << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #26: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_27 ()
+    try
+    {
+        std::ostringstream text;
+        text << '[';
+        for (int i=0; (i < 1000); ++i) {
+            text << ((i == 0)? "" : ",") << "{\"id\":" << i << '}';
+        }
+        text << ']';
+        const std::string data = text.str();
+        // Unless transparent huge pages are off, a mapped block must be
+        // backed by one.
+        std::ifstream setting("/sys/kernel/mm/transparent_hugepage/enabled");
+        std::string modes;
+        std::getline(setting, modes);
+        const bool transparent =
+            (!modes.empty() && (modes.find("[never]") == std::string::npos));
+        const json::Arena::Pages kinds[] = {
+            json::Arena::huge_pages, json::Arena::reserved_huge_pages
+        };
+        for (std::size_t i=0; (i < 2); ++i)
+        {
+            json::Document document(kinds[i]);
+            json::Parser parser(document, data.data(), data.size());
+            if (parser.parse() != json::Parser::complete) {
+                std::cerr << "Test #27: invalid JSON." << std::endl;
+                return (EXIT_FAILURE);
+            }
+            // The document fits in one block: a whole huge page when it
+            // was mapped, else a small block from the heap, which can't
+            // be backed by huge pages.
+            const json::Arena::Statistics statistics =
+                document.statistics();
+            const bool mapped =
+                (statistics.capacity > json::Arena::huge_page_size/2);
+            if ((statistics.blocks != 1) || (statistics.size == 0) ||
+                (statistics.size > statistics.capacity) ||
+                (statistics.huge_page_bytes >
+                 (mapped? json::Arena::huge_page_size : 0)))
+            {
+                std::cerr << "Test #27: wrong statistics." << std::endl;
+                return (EXIT_FAILURE);
+            }
+            if (mapped && transparent && (statistics.huge_page_bytes == 0))
+            {
+                std::cerr << "Test #27: no huge pages." << std::endl;
+                return (EXIT_FAILURE);
+            }
+            if (!mapped || !transparent) {
+                std::cout << "huge page check skipped." << std::endl;
+            }
+            std::cout
+                << "pages: " << kinds[i] << ", " << statistics.size
+                << " of " << statistics.capacity << " bytes, "
+                << statistics.huge_page_bytes << " in huge pages."
+                << std::endl;
+        }
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #27: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    int test_28 ()
+    try
+    {
+        const std::string text("{\"face\": \"\\ud83d\\ude00\"}");
+        json::Document document;
+        json::Parser parser(document, text.data(), text.size());
+        const json::Expression pair(".face == \"\\ud83d\\ude00\"");
+        if ((parser.parse() != json::Parser::complete) ||
+            !pair.matches(document.root()))
+        {
+            std::cerr << "Test #28: wrong code point." << std::endl;
+            return (EXIT_FAILURE);
+        }
+        // Lone surrogates, escapes cut short and unknown escapes.
+        const char *const invalid[] = {
+            ".face == \"\\ud83d\"",
+            ".face == \"\\ude00\"",
+            ".face == \"\\ud83d\\u0041\"",
+            ".face == \"\\u1",
+            ".face == \"\\ud83d\\u",
+            ".face == \"\\x41\"",
+            ".face == \"\\q\"",
+        };
+        for (std::size_t i=0; (i < 7); ++i)
+        {
+            try {
+                const json::Expression expression(invalid[i]);
+                std::cerr
+                    << "Test #28: accepted a bad escape."
+                    << std::endl;
+                return (EXIT_FAILURE);
+            }
+            catch (const std::runtime_error&) {
+            }
+        }
+        std::cout << "surrogates: ok" << std::endl;
+        return (EXIT_SUCCESS);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr
+            << "Test #28: "
+            << error.what()
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
 }
 
 int main (int, char **)
@@ -90,6 +1134,40 @@ try
     static const test tests[] = {
         test_1,
         test_2,
+        test_3,
+        test_4,
+        test_5,
+        test_6,
+        test_7,
+        test_8,
+        test_9,
+        test_10,
+        test_11,
+        test_12,
+        test_13,
+        test_14,
+#ifndef _WIN32
+        test_15,
+#endif
+#ifdef __linux__
+        test_16,
+#endif
+#ifndef _WIN32
+        test_17,
+#endif
+        test_18,
+        test_19,
+        test_20,
+#ifndef _WIN32
+        test_21,
+#endif
+        test_22,
+        test_23,
+        test_24,
+        test_25,
+        test_26,
+        test_27,
+        test_28,
     };
     static const int n = sizeof(tests) / sizeof(test);
 
@@ -0,0 +1,640 @@
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Filter, project, count, validate and reformat JSON and NDJSON, like a
+// small, fast jq.  NDJSON input is mapped in memory, split in blocks at line
+// boundaries and processed in parallel; output keeps the input's order.
+//
+//   jsonxx [options] [file]
+
+#include <aggregate.hpp>
+#include <csv.hpp>
+#include <join.hpp>
+#include <mapping.hpp>
+#include <ndjson.hpp>
+#include <query.hpp>
+#include <sort.hpp>
+#include <thread.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <time.h>
+#endif
+
+namespace {
+
+    const char usage[] =
+        "Usage: jsonxx [options] [file]\n"
+        "\n"
+        "Reads JSON (one record) or NDJSON (one record per line) from file,\n"
+        "or from standard input, and writes the selected records.\n"
+        "\n"
+        "  -f, --filter EXPR     keep records where EXPR holds,\n"
+        "                        e.g. '.status == \"error\" && .ms > 250'\n"
+        "  -s, --select PTR=VAL  keep records whose value at JSON Pointer\n"
+        "                        PTR is VAL, skipping the others before\n"
+        "                        parsing them, e.g. '/status=\"error\"'\n"
+        "  -p, --project PATHS   write only these values, as a map,\n"
+        "                        e.g. '.id, .user.name'\n"
+        "  -c, --count           write the number of selected records\n"
+        "      --csv PATHS       write the values as comma separated\n"
+        "                        values, with a header, e.g. '.id, .ms'\n"
+        "                        (not with --select or --count)\n"
+        "      --tsv PATHS       the same, separated with tabs\n"
+        "  -g, --group PATH      write one line per distinct value at PATH\n"
+        "                        with the number of selected records (not\n"
+        "                        with --select, --project or --count)\n"
+        "  -a, --aggregate PATH  with --group, also the sum, min and max\n"
+        "                        of the numbers at PATH\n"
+        "      --sort PTR        write records ordered by their value at\n"
+        "                        JSON Pointer PTR, e.g. '/timestamp', as\n"
+        "                        they are (not with --select or\n"
+        "                        --project)\n"
+        "  -r, --reverse         with --sort, largest values first\n"
+        "      --join FILE       write the records merged with those of\n"
+        "                        NDJSON file FILE with the same key (not\n"
+        "                        with --select, --project, --count,\n"
+        "                        --compact or --pretty)\n"
+        "      --on PATHS        with --join, the key's path in both files,\n"
+        "                        or in each, e.g. '.user_id, .id'\n"
+        "      --outer           with --join, also write records that\n"
+        "                        match nothing\n"
+        "      --budget MB       with --group or --sort, memory for groups\n"
+        "                        or keys before spilling to disk\n"
+        "                        (default: 256)\n"
+        "  -V, --validate        only check that records are valid JSON\n"
+        "      --compact         re-serialize records on one line\n"
+        "      --pretty          re-serialize records with indentation\n"
+        "  -n, --ndjson          input is NDJSON (default for files named\n"
+        "                        *.ndjson or *.jsonl)\n"
+        "  -j, --threads N       NDJSON worker threads (default: one per\n"
+        "                        processor)\n"
+        "      --stats           report throughput on standard error\n"
+        "\n"
+        "Without --compact or --pretty, selected NDJSON records are copied\n"
+        "as is and a JSON document is written compactly.\n";
+
+    // Records go to a worker in blocks of (at least) this many bytes.
+    const std::size_t block_size = 4*1024*1024;
+
+    enum Format
+    {
+        raw,
+        compact,
+        pretty
+    };
+
+    struct Options
+    {
+        const json::Expression * filter;
+        const json::Selector * selector;
+        const json::Projection * projection;
+        bool count;
+        bool validate;
+        Format format;
+        bool ndjson;
+        bool stats;
+        unsigned int threads;
+        std::string group;
+        std::string aggregate;
+        std::string sort;
+        bool reverse;
+        std::string columns;
+        char separator;
+        std::string join;
+        std::string on;
+        bool outer;
+        std::size_t budget;
+    };
+
+    // Wall clock, in seconds.
+    double now ()
+    {
+#ifdef _WIN32
+        LARGE_INTEGER frequency, counter;
+        ::QueryPerformanceFrequency(&frequency);
+        ::QueryPerformanceCounter(&counter);
+        return (double(counter.QuadPart) / double(frequency.QuadPart));
+#else
+        ::timespec now;
+        ::clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec + (now.tv_nsec * 1e-9));
+#endif
+    }
+
+    // A block of NDJSON records, and what came of it.
+    struct Job
+    {
+        const Options * options;
+        const char * data;
+        std::size_t size;
+        unsigned long long base;
+        std::string output;
+        std::vector<unsigned long long> errors;
+        std::size_t records;
+        std::size_t matched;
+        bool failed;
+    };
+
+    // Write one selected record.
+    void emit (const Options& options, std::ostream& stream,
+               const json::Any& root, const char * data, std::size_t size)
+    {
+        if (options.projection != 0) {
+            options.projection->write(stream, root);
+        }
+        else if (options.format == pretty) {
+            json::pretty(stream, root);
+        }
+        else if (options.format == compact) {
+            stream << root;
+        }
+        else {
+            stream.write(data, size);
+        }
+        stream << '\n';
+    }
+
+    // Parse, select and write one record.
+    void process (Job& job, json::Arena& arena, std::ostream& stream,
+                  const char * data, std::size_t size)
+    {
+        const Options& options = *job.options;
+        json::Parser parser(arena, data, size);
+        if (parser.parse() != json::Parser::complete) {
+            job.errors.push_back(job.base + (data - job.data));
+        }
+        else
+        {
+            const json::Any root(parser.root());
+            if (((options.selector == 0) || options.selector->matches(root))
+                && ((options.filter == 0) || options.filter->matches(root)))
+            {
+                ++job.matched;
+                if (!options.count && !options.validate) {
+                    emit(options, stream, root, data, size);
+                }
+            }
+        }
+        arena.clear();
+    }
+
+    void run (void * context)
+    {
+        Job& job = *static_cast<Job*>(context);
+        const Options& options = *job.options;
+        try {
+            json::Arena arena;
+            std::ostringstream stream;
+            std::size_t offset = 0;
+            std::size_t size = 0;
+            const char * record = 0;
+            if ((options.selector != 0) && !options.validate)
+            {
+                // Skip straight to the candidates: we can't count records.
+                while ((record = options.selector->next(
+                            job.data, job.size, offset, size)) != 0)
+                {
+                    process(job, arena, stream, record, size);
+                }
+            }
+            else
+            {
+                const char *const last = job.data + job.size;
+                for (record = job.data; (record < last); record += size+1)
+                {
+                    const char * end = static_cast<const char*>(
+                        std::memchr(record, '\n', last-record));
+                    size = ((end == 0)? last : end) - record;
+                    const std::size_t length = size -
+                        (((size > 0) && (record[size-1] == '\r'))? 1 : 0);
+                    if (length > 0) {
+                        ++job.records;
+                        process(job, arena, stream, record, length);
+                    }
+                }
+            }
+            job.output = stream.str();
+        }
+        catch (...) {
+            job.failed = true;
+        }
+    }
+
+    // Process NDJSON in rounds of one block per thread, writing each round's
+    // output in order before starting the next.
+    bool ndjson (const Options& options, const char * data, std::size_t size,
+                 std::size_t& records, std::size_t& matched)
+    {
+        std::size_t invalid = 0;
+        std::size_t offset = 0;
+        records = matched = 0;
+        while (offset < size)
+        {
+            std::vector<Job> jobs;
+            for (unsigned int i=0;
+                 ((i < options.threads) && (offset < size)); ++i)
+            {
+                std::size_t last = std::min(offset+block_size, size);
+                const char *const end = static_cast<const char*>(
+                    std::memchr(data+last, '\n', size-last));
+                last = (end == 0)? size : (end - data) + 1;
+                Job job = {
+                    &options, data+offset, last-offset, offset,
+                    std::string(), std::vector<unsigned long long>(),
+                    0, 0, false
+                };
+                jobs.push_back(job), offset = last;
+            }
+            if (jobs.size() == 1) {
+                run(&jobs[0]);
+            }
+            else
+            {
+                std::vector<json::Thread*> workers;
+                try {
+                    for (std::size_t i=0; (i < jobs.size()); ++i) {
+                        workers.push_back(new json::Thread(&run, &jobs[i]));
+                    }
+                }
+                catch (...) {
+                    for (std::size_t i=0; (i < workers.size()); ++i) {
+                        delete workers[i];
+                    }
+                    throw;
+                }
+                for (std::size_t i=0; (i < workers.size()); ++i) {
+                    delete workers[i];
+                }
+            }
+            for (std::size_t i=0; (i < jobs.size()); ++i)
+            {
+                if (jobs[i].failed) {
+                    throw (std::runtime_error("Out of memory."));
+                }
+                std::cout.write(jobs[i].output.data(),
+                                jobs[i].output.size());
+                for (std::size_t j=0; (j < jobs[i].errors.size()); ++j)
+                {
+                    std::cerr
+                        << "jsonxx: invalid record at byte "
+                        << jobs[i].errors[j] << "."
+                        << std::endl;
+                }
+                invalid += jobs[i].errors.size();
+                records += jobs[i].records;
+                matched += jobs[i].matched;
+            }
+        }
+        return (invalid == 0);
+    }
+
+    // Process a single JSON document.
+    bool document (const Options& options,
+                   const char * data, std::size_t size)
+    {
+        json::Document document;
+        json::Parser parser(document, data, size);
+        if (parser.parse() != json::Parser::complete)
+        {
+            std::cerr
+                << "jsonxx: invalid JSON at byte " << parser.offset() << "."
+                << std::endl;
+            return (false);
+        }
+        const json::Any root = document.root();
+        const bool selected =
+            ((options.selector == 0) || options.selector->matches(root)) &&
+            ((options.filter == 0) || options.filter->matches(root));
+        if (options.count) {
+            std::cout << (selected? 1 : 0) << std::endl;
+        }
+        else if (selected && !options.validate)
+        {
+            // There is no raw form of a document's root to copy.
+            Options copy = options;
+            copy.format = (options.format == raw)? compact : options.format;
+            emit(copy, std::cout, root, data, size);
+        }
+        return (true);
+    }
+
+    // Process the input, then report throughput if asked to.
+    int execute (const Options& options,
+                 const char * data, std::size_t size)
+    {
+        const double start = now();
+        std::size_t records = 1;
+        std::size_t matched = 0;
+        bool valid = true;
+        if (!options.columns.empty())
+        {
+            json::Csv csv(std::cout, options.columns,
+                          options.separator, options.filter);
+            csv.header();
+            csv.write(data, size);
+            const json::Csv::Statistics statistics = csv.statistics();
+            records = statistics.rows + statistics.invalid +
+                statistics.skipped;
+            matched = statistics.rows;
+            valid = (statistics.invalid == 0);
+        }
+        else if (!options.join.empty())
+        {
+            const json::Mapping other(options.join);
+            other.sequential();
+            json::Join join(options.on, options.outer, options.filter);
+            join.run(data, size, other.data(), other.size(),
+                     std::cout, options.threads);
+            const json::Join::Statistics statistics = join.statistics();
+            records = statistics.built + statistics.probed;
+            matched = statistics.written;
+            valid = (statistics.invalid == 0);
+        }
+        else if (!options.sort.empty())
+        {
+            json::Sort sort(options.sort, options.budget,
+                            options.reverse, options.filter);
+            sort.run(data, size, options.threads);
+            sort.write(std::cout);
+            const json::Sort::Statistics statistics = sort.statistics();
+            records = statistics.records + statistics.skipped;
+            matched = statistics.records;
+            if (options.stats && (statistics.spills > 0)) {
+                std::cerr
+                    << "jsonxx: spilled " << statistics.spills << " runs."
+                    << std::endl;
+            }
+        }
+        else if (!options.group.empty())
+        {
+            json::Aggregation aggregation(options.group, options.aggregate,
+                                          options.budget, options.filter);
+            aggregation.run(data, size, options.threads);
+            aggregation.write(std::cout);
+            const json::Aggregation::Statistics statistics =
+                aggregation.statistics();
+            records = statistics.records + statistics.skipped;
+            matched = statistics.records;
+            if (options.stats && (statistics.spills > 0)) {
+                std::cerr
+                    << "jsonxx: spilled " << statistics.spills << " times."
+                    << std::endl;
+            }
+        }
+        else if (options.ndjson)
+        {
+            valid = ndjson(options, data, size, records, matched);
+            if (options.count) {
+                std::cout << matched << std::endl;
+            }
+        }
+        else {
+            valid = document(options, data, size);
+        }
+        std::cout.flush();
+        const double elapsed = now() - start;
+
+        if (options.stats)
+        {
+            std::cerr
+                << "jsonxx: " << size << " bytes";
+            if (options.ndjson &&
+                ((options.selector == 0) || options.validate))
+            {
+                std::cerr << ", " << records << " records";
+            }
+            if (options.ndjson) {
+                std::cerr << ", " << matched << " selected";
+            }
+            std::cerr
+                << " in " << elapsed << " s ("
+                << ((size / (1024.0*1024.0)) / elapsed) << " MB/s";
+            if (options.ndjson && (options.threads > 1)) {
+                std::cerr << ", " << options.threads << " threads";
+            }
+            std::cerr << ")." << std::endl;
+        }
+        return (valid? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    bool ends_with (const std::string& text, const std::string& suffix)
+    {
+        return ((text.size() >= suffix.size()) &&
+                (text.compare(text.size()-suffix.size(),
+                              suffix.size(), suffix) == 0));
+    }
+
+}
+
+int main (int argc, char ** argv)
+try
+{
+    std::ios::sync_with_stdio(false);
+
+    Options options = {
+        0, 0, 0, false, false, raw, false, false, json::processors(),
+        std::string(), std::string(), std::string(), false,
+        std::string(), ',', std::string(), std::string(), false, 256
+    };
+    std::string filter;
+    std::string select;
+    std::string projection;
+    std::string path;
+    for (int i=1; (i < argc); ++i)
+    {
+        const std::string option(argv[i]);
+        const bool has_value = (i+1 < argc);
+        if (((option == "-f") || (option == "--filter")) && has_value) {
+            filter = argv[++i];
+        }
+        else if (((option == "-s") || (option == "--select")) && has_value) {
+            select = argv[++i];
+        }
+        else if (((option == "-p") || (option == "--project")) && has_value) {
+            projection = argv[++i];
+        }
+        else if (((option == "-g") || (option == "--group")) && has_value) {
+            options.group = argv[++i];
+        }
+        else if (((option == "-a") || (option == "--aggregate")) &&
+                 has_value)
+        {
+            options.aggregate = argv[++i];
+        }
+        else if ((option == "--sort") && has_value) {
+            options.sort = argv[++i];
+        }
+        else if ((option == "-r") || (option == "--reverse")) {
+            options.reverse = true;
+        }
+        else if (((option == "--csv") || (option == "--tsv")) && has_value)
+        {
+            options.columns = argv[++i];
+            options.separator = (option == "--csv")? ',' : '\t';
+        }
+        else if ((option == "--join") && has_value) {
+            options.join = argv[++i];
+        }
+        else if ((option == "--on") && has_value) {
+            options.on = argv[++i];
+        }
+        else if (option == "--outer") {
+            options.outer = true;
+        }
+        else if ((option == "--budget") && has_value) {
+            options.budget = std::strtoul(argv[++i], 0, 10);
+        }
+        else if ((option == "-j") || (option == "--threads"))
+        {
+            const int count = has_value? std::atoi(argv[++i]) : 0;
+            if (count < 1) {
+                std::cerr << usage; return (EXIT_FAILURE);
+            }
+            options.threads = count;
+        }
+        else if ((option == "-c") || (option == "--count")) {
+            options.count = true;
+        }
+        else if ((option == "-V") || (option == "--validate")) {
+            options.validate = true;
+        }
+        else if ((option == "-n") || (option == "--ndjson")) {
+            options.ndjson = true;
+        }
+        else if (option == "--compact") {
+            options.format = compact;
+        }
+        else if (option == "--pretty") {
+            options.format = pretty;
+        }
+        else if (option == "--stats") {
+            options.stats = true;
+        }
+        else if ((option == "-h") || (option == "--help")) {
+            std::cout << usage; return (EXIT_SUCCESS);
+        }
+        else if ((option[0] != '-') && path.empty()) {
+            path = option;
+        }
+        else {
+            std::cerr << usage; return (EXIT_FAILURE);
+        }
+    }
+    options.ndjson = options.ndjson || !options.group.empty() ||
+        !options.sort.empty() || !options.join.empty() ||
+        ends_with(path, ".ndjson") || ends_with(path, ".jsonl");
+    if (options.join.empty() != options.on.empty()) {
+        std::cerr << usage; return (EXIT_FAILURE);
+    }
+    // Sorted records are copied as they are, and only filters apply.
+    if (!options.sort.empty() && (!select.empty() || !projection.empty()))
+    {
+        std::cerr << usage; return (EXIT_FAILURE);
+    }
+    // Groups are written as counts, and only filters apply.
+    if (!options.group.empty() &&
+        (!select.empty() || !projection.empty() || options.count))
+    {
+        std::cerr << usage; return (EXIT_FAILURE);
+    }
+    // Rows are always written, and only filters apply.
+    if (!options.columns.empty() && (!select.empty() || options.count)) {
+        std::cerr << usage; return (EXIT_FAILURE);
+    }
+    // Merged records are written as they are, and only filters apply.
+    if (!options.join.empty() &&
+        (!select.empty() || !projection.empty() || options.count ||
+         (options.format != raw)))
+    {
+        std::cerr << usage; return (EXIT_FAILURE);
+    }
+    options.budget *= 1024*1024;
+
+    // Compile expressions up front, so syntax errors come before any output.
+    std::vector<json::Expression> compiled_filter;
+    if (!filter.empty()) {
+        compiled_filter.push_back(json::Expression(filter));
+        options.filter = &compiled_filter[0];
+    }
+    std::vector<json::Selector> compiled_selector;
+    if (!select.empty())
+    {
+        const std::string::size_type equal = select.find('=');
+        if (equal == std::string::npos) {
+            std::cerr << usage; return (EXIT_FAILURE);
+        }
+        compiled_selector.push_back(json::Selector(
+            select.substr(0, equal), select.substr(equal+1)));
+        options.selector = &compiled_selector[0];
+    }
+    std::vector<json::Projection> compiled_projection;
+    if (!projection.empty()) {
+        compiled_projection.push_back(json::Projection(projection));
+        options.projection = &compiled_projection[0];
+    }
+
+    // Map files in memory; read standard input into a buffer.
+    if (!path.empty())
+    {
+        const json::Mapping mapping(path);
+        mapping.sequential();
+        return (execute(options, mapping.data(), mapping.size()));
+    }
+    std::string buffer;
+    char chunk[64*1024];
+    std::size_t count = 0;
+    while ((count = std::fread(chunk, 1, sizeof(chunk), stdin)) > 0) {
+        buffer.append(chunk, count);
+    }
+    return (execute(options, buffer.data(), buffer.size()));
+}
+catch (const std::exception& error)
+{
+    std::cerr
+        << "Error: '" << error.what() << "'."
+        << std::endl;
+    return (EXIT_FAILURE);
+}
+catch (...)
+{
+    std::cerr
+        << "Unknown error."
+        << std::endl;
+    return (EXIT_FAILURE);
+}
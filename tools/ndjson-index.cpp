@@ -0,0 +1,158 @@
+
+// Copyright (c) 2012, Andre Caron (andre.l.caron@gmail.com)
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Build (or bring up to date) the line index of an NDJSON file, then print
+// the records at the requested positions.  With --field, build (or rebuild,
+// if stale) an index of the records by the value at a JSON Pointer and print
+// the records holding the requested values.
+//
+//   ndjson-index <file> [ordinal ...]
+//   ndjson-index <file> --field <pointer> [value ...]
+
+#include <ndjson.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+    // Name the field index after the data file and the pointer, so each
+    // field gets its own index file: "/user/id" -> "<file>.user.id.idx".
+    std::string field_index_path (const std::string& path,
+                                  const std::string& pointer)
+    {
+        std::string name(path);
+        for (std::string::size_type i=0; (i < pointer.size()); ++i) {
+            name += (pointer[i] == '/')? '.' : pointer[i];
+        }
+        return (name + ".idx");
+    }
+
+    int lookup (const json::LineIndex& records,
+                const std::string& path, const std::string& pointer,
+                char ** first, char ** last)
+    {
+        const std::string name = field_index_path(path, pointer);
+        try {
+            json::FieldIndex index(name);
+            if ((index.pointer() != pointer) ||
+                (index.indexed() != records.indexed()))
+            {
+                throw (std::exception());
+            }
+        }
+        catch (const std::exception&) {
+            json::FieldIndex::build(records, pointer, name);
+        }
+        json::FieldIndex index(name);
+        std::cerr
+            << index.size() << " records by '" << pointer << "'."
+            << std::endl;
+
+        std::vector<unsigned long long> offsets;
+        for (; (first != last); ++first)
+        {
+            index.find(*first, offsets);
+            for (std::size_t i=0; (i < offsets.size()); ++i)
+            {
+                json::Document document;
+                if (index.fetch(records, offsets[i], *first, document))
+                {
+                    std::size_t size = 0;
+                    const char *const data = records.line(offsets[i], size);
+                    std::cout.write(data, size) << std::endl;
+                }
+            }
+        }
+        return (EXIT_SUCCESS);
+    }
+
+}
+
+int main (int argc, char ** argv)
+try
+{
+    if (argc < 2)
+    {
+        std::cerr
+            << "Usage: ndjson-index <file> [ordinal ...]" << std::endl
+            << "       ndjson-index <file> --field <pointer> [value ...]"
+            << std::endl;
+        return (EXIT_FAILURE);
+    }
+
+    json::LineIndex index(argv[1]);
+    std::cerr
+        << index.size() << " records in "
+        << index.indexed() << " bytes."
+        << std::endl;
+
+    if ((argc > 3) && (std::strcmp(argv[2], "--field") == 0)) {
+        return (lookup(index, argv[1], argv[3], argv+4, argv+argc));
+    }
+
+    int status = EXIT_SUCCESS;
+    for (int i=2; (i < argc); ++i)
+    {
+        char * end = 0;
+        const unsigned long ordinal = std::strtoul(argv[i], &end, 10);
+        if ((*end != '\0') || (ordinal >= index.size()))
+        {
+            std::cerr
+                << "No record #" << argv[i] << "."
+                << std::endl;
+            status = EXIT_FAILURE; continue;
+        }
+        json::Document document;
+        if (index.parse(ordinal, document) != json::Parser::complete)
+        {
+            std::cerr
+                << "Record #" << ordinal << " is not valid JSON."
+                << std::endl;
+            status = EXIT_FAILURE; continue;
+        }
+        std::size_t size = 0;
+        const char *const data = index.record(ordinal, size);
+        std::cout.write(data, size) << std::endl;
+    }
+    return (status);
+}
+catch (const std::exception& error)
+{
+    std::cerr
+        << "Error: '" << error.what() << "'."
+        << std::endl;
+    return (EXIT_FAILURE);
+}
+catch (...)
+{
+    std::cerr
+        << "Unknown error."
+        << std::endl;
+    return (EXIT_FAILURE);
+}